@@ -0,0 +1,77 @@
+# Test of the in-process parameter scan, run by ctest (see CMakeLists.txt):
+# each point of a --scan, with and without --scan-keep, must give the same
+# monitor data as a separate run with the same parameters and seed, and
+# --scan-keep must read the PowderN table once when only lambda is scanned.
+#
+# Usage: cmake -DMCSTAS_PP=... -DCC=... -DSOURCE_DIR=... -DWORK_DIR=...
+#              -DRUNTIME_HEADER=... -P Test_scan.cmake
+
+set(sys ${WORK_DIR}/sys)
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${sys})
+
+# resource directory: runtime and components
+file(GLOB runtime ${SOURCE_DIR}/src/common/*.[ch] ${SOURCE_DIR}/src/nlib/*.[ch])
+file(COPY ${runtime} ${RUNTIME_HEADER} DESTINATION ${sys})
+foreach(dir sources optics monitors misc samples share)
+  file(COPY ${SOURCE_DIR}/comps/${dir} DESTINATION ${sys})
+endforeach()
+file(COPY ${SOURCE_DIR}/comps/examples/ESS/ESS_BEER_MCPL/duplex.laz DESTINATION ${WORK_DIR})
+
+function(run)
+  execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE status OUTPUT_VARIABLE out ERROR_VARIABLE out)
+  if(status)
+    message(FATAL_ERROR "${ARGN} failed (${status}):\n${out}")
+  endif()
+  set(out "${out}" PARENT_SCOPE)
+endfunction()
+
+function(compare a b)
+  file(STRINGS ${a} la)
+  file(STRINGS ${b} lb)
+  list(FILTER la EXCLUDE REGEX "Date|File|Directory|Creator")
+  list(FILTER lb EXCLUDE REGEX "Date|File|Directory|Creator")
+  if(NOT la STREQUAL lb)
+    message(FATAL_ERROR "${a} differs from ${b}")
+  endif()
+endfunction()
+
+run(${CMAKE_COMMAND} -E env TT=${sys} ${MCSTAS_PP} -o Test_scan.c
+  ${SOURCE_DIR}/comps/examples/Tests_/Test_scan/Test_scan.instr)
+run(${CC} -O1 -o Test_scan Test_scan.c -lm)
+
+# off moves the target of the source and so the PowderN position dependence,
+# lambda only changes the source
+set(scans off lambda)
+set(points_off    "off=0" "off=0.05" "off=-0.1")
+set(points_lambda "lambda=3" "lambda=4" "lambda=5")
+
+foreach(scan ${scans})
+  string(REPLACE ";" "\n" text "${points_${scan}}")
+  file(WRITE ${WORK_DIR}/${scan} "# points of the ${scan} scan\n${text}\n")
+
+  set(index 0)
+  foreach(point ${points_${scan}})
+    run(./Test_scan -n 1e4 -s 1000 -d ${scan}_${index} ${point})
+    math(EXPR index "${index} + 1")
+  endforeach()
+  math(EXPR last "${index} - 1")
+
+  foreach(keep "" "--scan-keep")
+    run(./Test_scan -n 1e4 -s 1000 -d scan_${scan}${keep} --scan=${scan} ${keep})
+    foreach(i RANGE ${last})
+      compare(${WORK_DIR}/scan_${scan}${keep}/${i}/psd.dat ${WORK_DIR}/${scan}_${i}/psd.dat)
+    endforeach()
+    string(REGEX MATCHALL "Reading [0-9]+ rows" reads "${out}")
+    list(LENGTH reads reads)
+    if(keep AND scan STREQUAL lambda)
+      set(expected 1)
+    else()
+      set(expected ${index})
+    endif()
+    if(NOT reads EQUAL expected)
+      message(FATAL_ERROR "--scan=${scan} ${keep} read the PowderN table ${reads} times, not ${expected}")
+    endif()
+  endforeach()
+endforeach()
@@ -3,7 +3,7 @@
 Simple Meta-Conic Neutron Raytracer is a framework for raytracing geometries of the form: @f$ r^2=k_1 + k_2 z + k_3 z^2 @f$. 
 
 <h3>General Notes</h3>
-To use the software you must make a Scene element using the function makeScene(). You must then add items to this scene element using the various add function (addDisk(), addParaboloid(), etc...). Next you must call the function traceSingleNeutron() for every neutron you would like to trace through the geometry. The maximum number of each geometry you can place in a scene is defined by the MAX_CONICSURF, MAX_DISK and MAX_DETECTOR definitions in the conic.h file.
+To use the software you must make a Scene element using the function makeScene(). You must then add items to this scene element using the various add function (addDisk(), addParaboloid(), etc...). Next you must call the function traceSingleNeutron() for every neutron you would like to trace through the geometry. There is no limit on the number of each geometry in a scene: the arrays grow as items are added, so a pointer returned by an add function is only valid until the next item of the same type is added. Once all items are added, initSimulation() sorts the ConicSurf and FlatSurf into z-bins, so that traceSingleNeutron() only tests the mirrors near the path of the neutron.
 
 <h3>TODO</h3>
 
@@ -113,7 +113,7 @@ int main() {
     double i;
     for (i = 0; i < NUM_NEUTRON; i++) {
         _class_particle p = generate_class_particleFromSource(0.005, 0.02422, 4, NUM_NEUTRON);
-        traceSingleNeutron(&p,s);
+        traceSingleNeutron(&p,&s);
     }
 
     //Finish Simulation of the Scene
@@ -171,17 +171,16 @@ int main() {
     Contains items general to the simulation
     @{
 */
-//! Max number of ConicSurf allowed in a Scene
-#define MAX_FLATSURF 200
-
-//! Max number of ConicSurf allowed in a Scene
-#define MAX_CONICSURF 100
-
-//! Max number of Disks allowed in a Scene
-#define MAX_DISK 100
+//! Number of z-bins used to sort the ConicSurf and FlatSurf of a Scene
+/*! 0 means one bin per mirror surface, up to CONIC_MAX_ZBINS. */
+#ifndef CONIC_ZBINS
+#define CONIC_ZBINS 0
+#endif
 
-//! Max number of Detectors allowed in a Scene
-#define MAX_DETECTOR 10
+//! Largest number of z-bins chosen automatically
+#ifndef CONIC_MAX_ZBINS
+#define CONIC_MAX_ZBINS 256
+#endif
 
 //! If "1" simulator will record z location where neutron with greatest grazing angle reflected for each ConicSurf
 /*! The information is stored in the max_ga and max_ga_z0 members of each ConicSurf, which are only present if
@@ -586,27 +585,76 @@ typedef struct {
     #endif
 
 } FlatSurf;
+/*! @ingroup simgroup
+\brief Entry of a z-bin of the Scene
+
+Holds a ConicSurf (id >= 0) or a FlatSurf (id = -1-index) and the range of
+its squared radius (x^2 for a FlatSurf) over the z-range of the bin. A surface
+is in all the bins it spans, prev and next linking its items in consecutive
+bins. */
+typedef struct {
+    int id;       //!< index in Scene.c, or -1-index in Scene.f
+    int prev;     //!< Item of the same surface in the previous bin, or -1
+    int next;     //!< Item of the same surface in the next bin, or -1
+    double r2lo;  //!< Smallest squared radius of the surface in the bin
+    double r2hi;  //!< Largest squared radius of the surface in the bin
+    double r2max; //!< Largest r2hi of this and the preceding items of the bin
+} SceneBinItem;
+
 /*! @ingroup simgroup
 \brief Structure to hold all scene geometry
 
-The number of possible ConicSurf, Disk and Detector in the Scene are
-determined by MAX_CONICSURF, MAX_DISK and MAX_DETECTOR.
+The arrays grow as items are added. The ConicSurf and FlatSurf are also
+sorted into nbins z-bins of width bin_dz from bin_zmin. The ConicSurf of bin
+b are bin_item[bin_start[2*b]] to bin_item[bin_start[2*b+1]-1], followed by
+its FlatSurf up to bin_item[bin_start[2*b+2]-1], each ordered by r2lo. The
+bins are built by initSimulation(), or by traceSingleNeutron() when items
+were added since (bin_dirty).
 */
 typedef struct {
-    FlatSurf f[MAX_FLATSURF]; //!< Array of all ConicSurf in Scene
-    int num_f;                  //!< Number of ConicSurf in Scene
+    FlatSurf *f;                //!< Array of all FlatSurf in Scene
+    int num_f;                  //!< Number of FlatSurf in Scene
+    int max_f;                  //!< Allocated size of f
 
-    ConicSurf c[MAX_CONICSURF]; //!< Array of all ConicSurf in Scene
+    ConicSurf *c;               //!< Array of all ConicSurf in Scene
     int num_c;                  //!< Number of ConicSurf in Scene
+    int max_c;                  //!< Allocated size of c
 
-    Disk di[MAX_DISK];          //!< Array of all Disk in Scene
+    Disk *di;                   //!< Array of all Disk in Scene
     int num_di;                 //!< Number of Disk in Scene
+    int max_di;                 //!< Allocated size of di
 
-    Detector d[MAX_DETECTOR];  //!< Array of all Detector in Scene
+    Detector *d;               //!< Array of all Detector in Scene
     int num_d;                 //!< Number of Detector in Scene
+    int max_d;                 //!< Allocated size of d
+
+    int nbins;                 //!< Number of z-bins
+    double bin_zmin;           //!< z of the start of the first bin
+    double bin_dz;             //!< Width of the bins
+    int *bin_start;            //!< Start of each bin in bin_item, 2*nbins+1 values
+    SceneBinItem *bin_item;    //!< Items of all bins
+    int bin_dirty;             //!< Set when items were added after the bins were built
+} Scene;
 
+/*! \brief Function to make room for one more item in a Scene array
 
-} Scene;
+@param a Array to grow, may be NULL
+@param num Number of items in the array
+@param max Pointer to allocated size of the array, updated
+@param size Size of one item
+@return The array, possibly moved
+*/
+void* growSceneArray(void* a, int num, int* max, size_t size) {
+    if (num < *max)
+        return a;
+    *max = (*max > 0 ? 2*(*max) : 8);
+    a = realloc(a, (*max)*size);
+    if (a == NULL) {
+        fprintf(stderr, "MEMORY ALLOCATION PROBLEM\n");
+        exit(-1);
+    }
+    return a;
+}
 
 /////////////////////////////////////
 // Inline Detector
@@ -687,10 +735,7 @@ Detector makeDetector(double z0,double xmin, double xmax, double ymin, double ym
 */
 Detector* addDetector(double z0, double xmin, double xmax, double ymin, double ymax, double xres,
     double yres, double num_particles, char* filename, Scene* s) {
-    if (s->num_d >= MAX_DETECTOR-1) {
-        fprintf(stderr,"TOO MANY DETECTORS IN SCENE");
-        exit(-1);
-    }
+    s->d = (Detector*)growSceneArray(s->d, s->num_d, &s->max_d, sizeof(Detector));
     s->d[s->num_d] = makeDetector(z0,xmin,xmax,ymin,ymax,xres,yres,num_particles,filename);
     s->num_d++;
     return &s->d[s->num_d-1];
@@ -698,17 +743,18 @@ Detector* addDetector(double z0, double xmin, double xmax, double ymin, double y
 
 /*! \brief Function to compute time of first collision for a Detector.
 
-@param p _class_particle to consider
-@param d Detector to consider
+@param p Pointer to _class_particle to consider
+@param d Pointer to Detector to consider
 
 @return Time until the propogation or -1 if particle will not hit detector
 */
-double getTimeOfFirstCollisionDetector(_class_particle p, Detector d) {
-    double t = (d.z0-p.z)/p.vz;
+double getTimeOfFirstCollisionDetector(_class_particle* p, Detector* d) {
+    double t = (d->z0-p->z)/p->vz;
     if (t <= 0)
         return -1;
-    _class_particle p2 = copyMove_class_particleT(t,p);
-    if (p2.x > d.xmax || p2.x < d.xmin || p2.y > d.ymax || p2.y < d.ymin)
+    double x = p->x+p->vx*t;
+    double y = p->y+p->vy*t;
+    if (x > d->xmax || x < d->xmin || y > d->ymax || y < d->ymin)
         return -1;
     return t;
 }
@@ -716,15 +762,15 @@ double getTimeOfFirstCollisionDetector(_class_particle p, Detector d) {
 /*! \brief Function to raytrace Detector
 
 @param p Pointer to particle to be traced
-@param d Detector to be traced
+@param d Pointer to Detector to be traced
 */
-void traceNeutronDetector(_class_particle* p, Detector d) {
-    double t = getTimeOfFirstCollisionDetector(*p, d);
+void traceNeutronDetector(_class_particle* p, Detector* d) {
+    double t = getTimeOfFirstCollisionDetector(p, d);
     if (t < 0)
         return;
     move_class_particleT(t,p);
-    d.data[(int)floor((p->x-d.xmin)/d.xstep)][(int)floor((p->y-d.ymin)/d.ystep)] += p->p;
-    (*d.num_count) += p->p;
+    d->data[(int)floor((p->x-d->xmin)/d->xstep)][(int)floor((p->y-d->ymin)/d->ystep)] += p->p;
+    (*d->num_count) += p->p;
 }
 
 /*! \brief Function to finalize detector
@@ -800,10 +846,7 @@ Disk makeDisk(double z0, double r0, double r1) {
 @see Disk
 */
 Disk* addDisk(double z0, double r0, double r1, Scene* s) {
-    if (s->num_di >= MAX_DISK-1) {
-        fprintf(stderr,"TOO MANY DISKS IN SCENE");
-        exit(-1);
-    }
+    s->di = (Disk*)growSceneArray(s->di, s->num_di, &s->max_di, sizeof(Disk));
     s->di[s->num_di] = makeDisk(z0, r0, r1);
     s->num_di++;
     return &s->di[s->num_di -1];
@@ -819,10 +862,7 @@ Disk* addDisk(double z0, double r0, double r1, Scene* s) {
 @see Disk
 */
 Disk* addEndDisk(double z0, double r0, double r1, Scene* s) {
-    if (s->num_di >= MAX_DISK-1) {
-        fprintf(stderr,"TOO MANY DISKS IN SCENE");
-        exit(-1);
-    }
+    s->di = (Disk*)growSceneArray(s->di, s->num_di, &s->max_di, sizeof(Disk));
     s->di[s->num_di] = makeDisk(z0, r0, r1);
     s->di[s->num_di].absorb = 0;
     s->num_di++;
@@ -831,34 +871,36 @@ Disk* addEndDisk(double z0, double r0, double r1, Scene* s) {
 
 /*! \brief Function to compute time of first collision for a disk
 
-@param p _class_particle to consider
-@param d Disk to consider
+@param p Pointer to _class_particle to consider
+@param d Pointer to Disk to consider
 @return Time until the propogation or -1 if particle will not hit disk
 */
-double getTimeOfFirstCollisionDisk(_class_particle p, Disk d) {
-    double tz = (d.z0-p.z)/p.vz;
+double getTimeOfFirstCollisionDisk(_class_particle* p, Disk* d) {
+    double tz = (d->z0-p->z)/p->vz;
     if (tz <= 0)
         return -1;
-    _class_particle p2 = copyMove_class_particleT(tz, p);
-    double rp = sqrt(p2.x*p2.x+p2.y*p2.y);
-    if (rp > d.r0 && rp < d.r1 && fabs(p2.z-d.z0) < 1e-11)
-        return (d.z0-p.z)/p.vz; 
+    double x = p->x+p->vx*tz;
+    double y = p->y+p->vy*tz;
+    double z = p->z+p->vz*tz;
+    double rp = sqrt(x*x+y*y);
+    if (rp > d->r0 && rp < d->r1 && fabs(z-d->z0) < 1e-11)
+        return tz;
     return -1;
 }
 
 /*! \brief Function to raytrace Disks
 
 @param p Pointer to particle to be traced
-@param d Disk to be traced
+@param d Pointer to Disk to be traced
 */
-void traceNeutronDisk(_class_particle* p, Disk d) {
-    double t = getTimeOfFirstCollisionDisk(*p, d);
+void traceNeutronDisk(_class_particle* p, Disk* d) {
+    double t = getTimeOfFirstCollisionDisk(p, d);
 
     if (t <= 0)
         return;
 
     move_class_particleT(t, p);
-    if (d.absorb)
+    if (d->absorb)
       absorb_class_particle(p);
 }
 
@@ -1139,10 +1181,8 @@ FlatSurf makeFlatparbola(
 */
 ConicSurf* addParaboloid(double f1, Point p, double zstart, double zend,
 			 double m, double R0, double Qc, double alpha, double W, Scene* s) {
-    if (s->num_c >= MAX_CONICSURF-1) {
-        fprintf(stderr,"TOO MANY CONICSURF IN SCENE");
-        exit(-1);
-    }
+    s->c = (ConicSurf*)growSceneArray(s->c, s->num_c, &s->max_c, sizeof(ConicSurf));
+    s->bin_dirty = 1;
     s->c[s->num_c] = makeParaboloid(f1,p,zstart,zend,m,R0,Qc,alpha,W);
     s->num_c++;
     return &s->c[s->num_c-1];
@@ -1171,10 +1211,8 @@ FlatSurf* addFlatParabola(
     double m,
     double R0, double Qc, double alpha, double W,
     Scene* s) {
-    if (s->num_f >= MAX_FLATSURF-1) {
-        fprintf(stderr,"TOO MANY FLATSURF IN SCENE");
-        exit(-1);
-    }
+    s->f = (FlatSurf*)growSceneArray(s->f, s->num_f, &s->max_f, sizeof(FlatSurf));
+    s->bin_dirty = 1;
     s->f[s->num_f] = makeFlatparbola(f,p,zstart,zend,ll,rl,m, R0, Qc, alpha, W);
     s->num_f++;
     return &s->f[s->num_f-1];
@@ -1194,10 +1232,8 @@ FlatSurf* addFlatParabola(
 */
 ConicSurf* addHyperboloid(double f1, double f2, Point p, double zstart,
     double zend, double m, double R0, double Qc, double alpha, double W, Scene* s) {
-    if (s->num_c >= MAX_CONICSURF-1) {
-        fprintf(stderr,"TOO MANY CONICSURF IN SCENE");
-        exit(-1);
-    }
+    s->c = (ConicSurf*)growSceneArray(s->c, s->num_c, &s->max_c, sizeof(ConicSurf));
+    s->bin_dirty = 1;
     s->c[s->num_c] = makeHyperboloid(f1,f2,p,zstart,zend,m,R0,Qc,alpha,W);
     s->num_c++;
     return &s->c[s->num_c-1];
@@ -1217,10 +1253,8 @@ ConicSurf* addHyperboloid(double f1, double f2, Point p, double zstart,
 */
 ConicSurf* addEllipsoid(double f1, double f2, Point p, double zstart,
     double zend, double m, double R0, double Qc, double alpha, double W, Scene* s) {
-    if (s->num_c >= MAX_CONICSURF-1) {
-        fprintf(stderr,"TOO MANY CONICSURF IN SCENE");
-        exit(-1);
-    }
+    s->c = (ConicSurf*)growSceneArray(s->c, s->num_c, &s->max_c, sizeof(ConicSurf));
+    s->bin_dirty = 1;
     s->c[s->num_c] = makeEllipsoid(f1,f2,p,zstart,zend,m,R0,Qc,alpha,W);
     s->num_c++;
     return &s->c[s->num_c-1];
@@ -1249,10 +1283,8 @@ FlatSurf* addFlatEllipse(
     double m,
     double R0, double Qc, double alpha, double W,
     Scene* s) {
-    if (s->num_f >= MAX_FLATSURF-1) {
-        fprintf(stderr,"TOO MANY FLATSURF IN SCENE");
-        exit(-1);
-    }
+    s->f = (FlatSurf*)growSceneArray(s->f, s->num_f, &s->max_f, sizeof(FlatSurf));
+    s->bin_dirty = 1;
     s->f[s->num_f] = makeFlatEllipse(f1,f2,p,zstart,zend,ll,rl,m,R0,Qc,alpha,W);
     s->num_f++;
     return &s->f[s->num_f-1];
@@ -1320,56 +1352,58 @@ Vec getNormFlat(Point p, FlatSurf s) {
 
 /*! \brief Function to compute time of first collision for a ConicSurf
 
-@param p _class_particle to consider
-@param s ConicSurf to consider
+@param p Pointer to _class_particle to consider
+@param s Pointer to ConicSurf to consider
 @return Time until the propogation or -1 if particle will not hit disk
 */ 
-double getTimeOfFirstCollisionConic(_class_particle p, ConicSurf s) {
-    double tz = (s.zs-p.z)/p.vz;
+double getTimeOfFirstCollisionConic(_class_particle* p, ConicSurf* s) {
+    double tz = (s->zs-p->z)/p->vz;
     if (tz < 0) {
        tz = 0;
-       if (p.z > s.ze)
+       if (p->z > s->ze)
             return -1;
     }
 
-    _class_particle p2 = copyMove_class_particleT(tz,p);
+    double x = p->x+p->vx*tz;
+    double y = p->y+p->vy*tz;
+    double z = p->z+p->vz*tz;
 
-    double A = p2.vx*p2.vx+p2.vy*p2.vy-s.k3*p2.vz*p2.vz;
-    double B = 2*(p2.vx*p2.x+p2.vy*p2.y-s.k3*p2.vz*p2.z)-s.k2*p2.vz;
-    double C = p2.x*p2.x+p2.y*p2.y-s.k3*p2.z*p2.z-s.k2*p2.z-s.k1;
+    double A = p->vx*p->vx+p->vy*p->vy-s->k3*p->vz*p->vz;
+    double B = 2*(p->vx*x+p->vy*y-s->k3*p->vz*z)-s->k2*p->vz;
+    double C = x*x+y*y-s->k3*z*z-s->k2*z-s->k1;
     
     double t = solveQuad(A,B,C);
 
-    if (t <= 0 || p2.vz*t+p2.z > s.ze || p2.vz*t+p2.z < s.zs)  
+    if (t <= 0 || p->vz*t+z > s->ze || p->vz*t+z < s->zs)  
         return -1;
     return t+tz;
 }
 
 /*! \brief Function to compute time of first collision for a FlatSurf
 
-@param p Particle to consider
-@param s FlatSurf to consider
+@param p Pointer to particle to consider
+@param s Pointer to FlatSurf to consider
 @return Time until the propogation or -1 if particle will not hit surface
 */
 //TODO
-double getTimeOfFirstCollisionFlat(_class_particle p, FlatSurf s) {
-    double tz = (s.zs-p.z)/p.vz;
+double getTimeOfFirstCollisionFlat(_class_particle* p, FlatSurf* s) {
+    double tz = (s->zs-p->z)/p->vz;
     if (tz < 0) {
        tz = 0;
-       if (p.z > s.ze)
+       if (p->z > s->ze)
             return -1;
     }
 
-    _class_particle p2 = copyMove_class_particleT(tz,p);
+    double z = p->z+p->vz*tz;
     double vs = 0;//the vector important for calculating the intersection with the ellipse
     double s0 = 0;
     double vt = 0;//the other component only important for testing whether the mirror is hit
     double t0 = 0;
     //if(s.b > 0){//obsolete iteration allowing to rotate by 90 deg with out rotation in McStas, not really needed
-    vs = p2.vx;
-    s0 = p2.x;
-    vt = p2.vy;
-    t0 = p2.y;
+    vs = p->vx;
+    s0 = p->x+p->vx*tz;
+    vt = p->vy;
+    t0 = p->y+p->vy*tz;
 
     //}
     /*else{
@@ -1379,13 +1413,13 @@ double getTimeOfFirstCollisionFlat(_class_particle p, FlatSurf s) {
     t0 = p2.x;
     };
     */
-    double A = vs*vs-s.k3*p2.vz*p2.vz;
-    double B = 2*(vs*s0-s.k3*p2.vz*p2.z)-s.k2*p2.vz;
-    double C = s0*s0-s.k3*p2.z*p2.z-s.k2*p2.z-s.k1;
+    double A = vs*vs-s->k3*p->vz*p->vz;
+    double B = 2*(vs*s0-s->k3*p->vz*z)-s->k2*p->vz;
+    double C = s0*s0-s->k3*z*z-s->k2*z-s->k1;
 
     double t = solveQuad(A,B,C);
 
-    if (t <= 0 || p2.vz*t+p2.z > s.ze || p2.vz*t+p2.z < s.zs||vt*t+t0 < s.ll||vt*t +t0 > s.rl)
+    if (t <= 0 || p->vz*t+z > s->ze || p->vz*t+z < s->zs||vt*t+t0 < s->ll||vt*t +t0 > s->rl)
         return -1;
     return t+tz;
 }
@@ -1660,20 +1694,20 @@ double reflectNeutronFlat(_class_particle* _particle, FlatSurf s) {
 /*! \brief Function to handle raytracing of neutron for a ConicSurf.
 
 @param p Pointer of particle to reflect
-@param c ConicSurf to use
+@param c Pointer to ConicSurf to use
 
 */
-void traceNeutronConic(_class_particle* _particle, ConicSurf c) {
-    double t = getTimeOfFirstCollisionConic(*_particle, c);
+void traceNeutronConic(_class_particle* _particle, ConicSurf* c) {
+    double t = getTimeOfFirstCollisionConic(_particle, c);
     if (t < 0)
         return;
     else {
         move_class_particleT(t, _particle);
-        double ga = reflectNeutronConic(_particle, c);
+        double ga = reflectNeutronConic(_particle, *c);
 #if REC_MAX_GA
-        if (ga > c.max_ga) {
-            c.max_ga = ga;
-            c.max_ga_z0 = _particle->z;
+        if (ga > c->max_ga) {
+            c->max_ga = ga;
+            c->max_ga_z0 = _particle->z;
         }
 #endif
     }
@@ -1682,23 +1716,23 @@ void traceNeutronConic(_class_particle* _particle, ConicSurf c) {
 /*! \brief Function to handle raytracing of neutron for a FlatSurf.
 
 @param p Pointer of particle to reflect
-@param f FlatSurf to use
+@param f Pointer to FlatSurf to use
 
 */
-void traceNeutronFlat(_class_particle* _particle, FlatSurf f) {
-    double t = getTimeOfFirstCollisionFlat(*_particle, f);
+void traceNeutronFlat(_class_particle* _particle, FlatSurf* f) {
+    double t = getTimeOfFirstCollisionFlat(_particle, f);
     if (t < 0)
         return;
     else {
 
         move_class_particleT(t, _particle);
 
-        double ga = reflectNeutronFlat(_particle, f);
+        double ga = reflectNeutronFlat(_particle, *f);
 
 #if REC_MAX_GA
-        if (ga > f.max_ga) {
-            f.max_ga = ga;
-            f.max_ga_z0 = p->_z;
+        if (ga > f->max_ga) {
+            f->max_ga = ga;
+            f->max_ga_z0 = _particle->z;
         }
 #endif
     }
@@ -1721,64 +1755,288 @@ enum GEO {
 //! Function to generate an empty Scene
 Scene makeScene() {
     Scene s;
-    s.num_f = 0;
-    s.num_c = 0;
-    s.num_di = 0;
-    s.num_d = 0;
+    s.f = NULL;
+    s.num_f = s.max_f = 0;
+    s.c = NULL;
+    s.num_c = s.max_c = 0;
+    s.di = NULL;
+    s.num_di = s.max_di = 0;
+    s.d = NULL;
+    s.num_d = s.max_d = 0;
+    s.nbins = 0;
+    s.bin_zmin = 0;
+    s.bin_dz = 0;
+    s.bin_start = NULL;
+    s.bin_item = NULL;
+    s.bin_dirty = 0;
     return s;
 }
 
+/*! \brief Function to compute range of @f$ k_1+k_2 z+k_3 z^2 @f$ for z in [za,zb]
+
+@param lo Pointer to smallest value, set
+@param hi Pointer to largest value, set
+*/
+void getRangeQuad(double k1, double k2, double k3, double za, double zb,
+    double* lo, double* hi) {
+    double va = k1+k2*za+k3*za*za;
+    double vb = k1+k2*zb+k3*zb*zb;
+    *lo = (va < vb ? va : vb);
+    *hi = (va < vb ? vb : va);
+    if (k3 != 0) {
+        double zv = -k2/(2*k3);
+        if (zv > za && zv < zb) {
+            double vv = k1+k2*zv+k3*zv*zv;
+            if (vv < *lo) *lo = vv;
+            if (vv > *hi) *hi = vv;
+        }
+    }
+}
+
+/*! \brief Function to get the z-bins spanned by a ConicSurf or FlatSurf of a Scene
+
+@param s Pointer of Scene
+@param i Index of surface, ConicSurf i or FlatSurf i-num_c
+@param z z-range of the surface, set
+@param b Range of z-bins, set
+*/
+void getSceneSurfBins(Scene* s, int i, double* z, int* b) {
+    z[0] = (i < s->num_c ? s->c[i].zs : s->f[i-s->num_c].zs);
+    z[1] = (i < s->num_c ? s->c[i].ze : s->f[i-s->num_c].ze);
+    b[0] = (int)floor((z[0]-s->bin_zmin)/s->bin_dz - 1e-9);
+    b[1] = (int)floor((z[1]-s->bin_zmin)/s->bin_dz + 1e-9);
+    if (b[0] < 0) b[0] = 0;
+    if (b[1] > s->nbins-1) b[1] = s->nbins-1;
+}
+
+//! qsort comparison of SceneBinItem by r2lo
+int compareSceneBinItem(const void* a, const void* b) {
+    double d = ((SceneBinItem*)a)->r2lo-((SceneBinItem*)b)->r2lo;
+    return (d < 0 ? -1 : (d > 0));
+}
+
 //! Function to init simulation items
 /*! Should be called after all items
 have been added to scene but before
-neutrons are traced.
+neutrons are traced. Sorts the ConicSurf
+and FlatSurf into z-bins, see Scene.
 
 @param s Pointer of Scene to init
 */
 void initSimulation(Scene* s) {
-    //
+    int n = s->num_c+s->num_f;
+    int i, b, k, bins[2];
+    int *cursor;
+    double z[2], zmin = 0, zmax = 0;
+
+    free(s->bin_start);
+    free(s->bin_item);
+    s->bin_start = NULL;
+    s->bin_item = NULL;
+    s->nbins = 0;
+    s->bin_dirty = 0;
+    if (!n)
+        return;
+
+    for (i = 0; i < n; i++) {
+        double zs = (i < s->num_c ? s->c[i].zs : s->f[i-s->num_c].zs);
+        double ze = (i < s->num_c ? s->c[i].ze : s->f[i-s->num_c].ze);
+        if (!i || zs < zmin) zmin = zs;
+        if (!i || ze > zmax) zmax = ze;
+    }
+    s->nbins = (CONIC_ZBINS > 0 ? CONIC_ZBINS : (n < CONIC_MAX_ZBINS ? n : CONIC_MAX_ZBINS));
+    if (zmax <= zmin)
+        s->nbins = 1;
+    s->bin_zmin = zmin;
+    s->bin_dz = (zmax > zmin ? (zmax-zmin)/s->nbins : 1);
+
+    //Count items of each bin
+    s->bin_start = (int*)calloc(2*s->nbins+1, sizeof(int));
+    cursor = (int*)malloc((n > 2*s->nbins ? n : 2*s->nbins)*sizeof(int));
+    if (s->bin_start == NULL || cursor == NULL) {
+        fprintf(stderr, "MEMORY ALLOCATION PROBLEM\n");
+        exit(-1);
+    }
+    for (i = 0; i < n; i++) {
+        getSceneSurfBins(s, i, z, bins);
+        for (b = bins[0]; b <= bins[1]; b++)
+            s->bin_start[2*b+(i >= s->num_c)+1]++;
+    }
+    for (b = 0; b < 2*s->nbins; b++) {
+        s->bin_start[b+1] += s->bin_start[b];
+        cursor[b] = s->bin_start[b];
+    }
+
+    //Fill bins
+    s->bin_item = (SceneBinItem*)malloc((s->bin_start[2*s->nbins]+1)*sizeof(SceneBinItem));
+    if (s->bin_item == NULL) {
+        fprintf(stderr, "MEMORY ALLOCATION PROBLEM\n");
+        exit(-1);
+    }
+    for (i = 0; i < n; i++) {
+        double k1 = (i < s->num_c ? s->c[i].k1 : s->f[i-s->num_c].k1);
+        double k2 = (i < s->num_c ? s->c[i].k2 : s->f[i-s->num_c].k2);
+        double k3 = (i < s->num_c ? s->c[i].k3 : s->f[i-s->num_c].k3);
+        getSceneSurfBins(s, i, z, bins);
+        for (b = bins[0]; b <= bins[1]; b++) {
+            SceneBinItem* it = &s->bin_item[cursor[2*b+(i >= s->num_c)]++];
+            double za = s->bin_zmin+b*s->bin_dz, zb = za+s->bin_dz, pad;
+            it->id = (i < s->num_c ? i : -1-(i-s->num_c));
+            getRangeQuad(k1, k2, k3, (za > z[0] ? za : z[0]), (zb < z[1] ? zb : z[1]),
+                &it->r2lo, &it->r2hi);
+            pad = 1e-6*fabs(it->r2hi)+1e-12;
+            it->r2lo -= pad;
+            it->r2hi += pad;
+            if (!(it->r2lo <= it->r2hi)) {
+                //Degenerate surface: always test it
+                it->r2lo = -HUGE_VAL;
+                it->r2hi = HUGE_VAL;
+            }
+        }
+    }
+
+    //Sort bins by r2lo, then link the items of each surface
+    for (b = 0; b < 2*s->nbins; b++) {
+        qsort(&s->bin_item[s->bin_start[b]], s->bin_start[b+1]-s->bin_start[b],
+            sizeof(SceneBinItem), compareSceneBinItem);
+        for (k = s->bin_start[b]; k < s->bin_start[b+1]; k++) {
+            SceneBinItem* it = &s->bin_item[k];
+            it->r2max = (k > s->bin_start[b] && it[-1].r2max > it->r2hi ? it[-1].r2max : it->r2hi);
+        }
+    }
+    for (i = 0; i < n; i++)
+        cursor[i] = -1;
+    for (k = 0; k < s->bin_start[2*s->nbins]; k++) {
+        SceneBinItem* it = &s->bin_item[k];
+        i = (it->id >= 0 ? it->id : s->num_c-1-it->id);
+        it->prev = cursor[i];
+        it->next = -1;
+        if (cursor[i] >= 0)
+            s->bin_item[cursor[i]].next = k;
+        cursor[i] = k;
+    }
+    free(cursor);
+}
+
+/*! \brief Function to test a bin item against the path of a neutron in the bin
+
+@param it Pointer to the bin item
+@param r2 Range of squared radius of the path, r2[0..1] for x^2+y^2, r2[2..3] for x^2
+@return 1 if the surface may be hit in the bin
+*/
+int overlapSceneBinItem(SceneBinItem* it, double* r2) {
+    if (it->id < 0)
+        r2 += 2;
+    return !(r2[1] < it->r2lo || r2[0] > it->r2hi);
 }
 
 /*! \brief Function to raytrace single neutron through geometries specified by d, di and c.
 
+The ConicSurf and FlatSurf are looked up by walking the z-bins
+of the Scene along the path of the neutron, stopping at the first
+bin that ends after the closest collision found so far.
+
 @param p Pointer of particle to trace
-@param s Scene to trace
+@param s Pointer of Scene to trace
 */
-void traceSingleNeutron(_class_particle* _particle, Scene s) {
+void traceSingleNeutron(_class_particle* _particle, Scene* s) {
    
     int contact = 1;
+    if (s->bin_dirty)
+        initSimulation(s);
     do {
         double t;
         enum  GEO type = NONE;
         int index = -1;
         int i;
 
-        for (i = 0; i < s.num_c; i++) {
-            double t2 = getTimeOfFirstCollisionConic(*_particle,s.c[i]);
-
-            if (t2 <= 0)
-                continue;
-            if (index == -1 || t2 < t) {
-                type = CONIC;
-                index = i;
-                t = t2;
+        if (s->nbins && _particle->vz != 0) {
+            int dir = (_particle->vz > 0 ? 1 : -1);
+            /* start a little behind, for collisions right after a reflection */
+            int b = (int)floor((_particle->z-s->bin_zmin)/s->bin_dz - dir*1e-9);
+            int b_start;
+            double r2_prev[4], r2[4];
+            if (b < 0)
+                b = (dir > 0 ? 0 : -1);
+            else if (b >= s->nbins)
+                b = (dir > 0 ? s->nbins : s->nbins-1);
+            b_start = b;
+            for (; b >= 0 && b < s->nbins; b += dir) {
+                double za = s->bin_zmin+b*s->bin_dz;
+                double ta = ((dir > 0 ? za : za+s->bin_dz)-_particle->z)/_particle->vz;
+                double tb = ((dir > 0 ? za+s->bin_dz : za)-_particle->z)/_particle->vz;
+                double vr2 = _particle->vx*_particle->vx, vr1 = _particle->x*_particle->vx;
+                double r0 = _particle->x*_particle->x;
+                int k;
+                if (ta < 0) ta = 0;
+                /* range of x^2 and x^2+y^2 along the path in the bin */
+                getRangeQuad(r0, 2*vr1, vr2, ta, tb, &r2[2], &r2[3]);
+                getRangeQuad(r0+_particle->y*_particle->y, 2*(vr1+_particle->y*_particle->vy),
+                    vr2+_particle->vy*_particle->vy, ta, tb, &r2[0], &r2[1]);
+                for (k = 2*b; k < 2*b+2; k++) {
+                    double* r2k = r2+2*(k-2*b);
+                    int lo = s->bin_start[k], hi = s->bin_start[k+1], j;
+                    /* items from lo to hi-1 have r2lo <= r2k[1] */
+                    while (lo < hi) {
+                        int mid = (lo+hi)/2;
+                        if (s->bin_item[mid].r2lo > r2k[1]) hi = mid;
+                        else lo = mid+1;
+                    }
+                    for (j = hi-1; j >= s->bin_start[k] && s->bin_item[j].r2max >= r2k[0]; j--) {
+                        SceneBinItem* it = &s->bin_item[j];
+                        int prev = (dir > 0 ? it->prev : it->next);
+                        double t2;
+                        if (it->r2hi < r2k[0])
+                            continue;
+                        /* already tested in the previous bin */
+                        if (b != b_start && prev >= 0 && overlapSceneBinItem(&s->bin_item[prev], r2_prev))
+                            continue;
+                        if (it->id >= 0)
+                            t2 = getTimeOfFirstCollisionConic(_particle, &s->c[it->id]);
+                        else
+                            t2 = getTimeOfFirstCollisionFlat(_particle, &s->f[-1-it->id]);
+                        if (t2 <= 0)
+                            continue;
+                        if (index == -1 || t2 < t) {
+                            type = (it->id >= 0 ? CONIC : FLAT);
+                            index = (it->id >= 0 ? it->id : -1-it->id);
+                            t = t2;
+                        }
+                    }
+                }
+                if (index != -1 && t <= tb)
+                    break;
+                for (k = 0; k < 4; k++)
+                    r2_prev[k] = r2[k];
+            }
+        } else {
+            for (i = 0; i < s->num_c; i++) {
+                double t2 = getTimeOfFirstCollisionConic(_particle,&s->c[i]);
+
+                if (t2 <= 0)
+                    continue;
+                if (index == -1 || t2 < t) {
+                    type = CONIC;
+                    index = i;
+                    t = t2;
+                }
             }
-        }
 
-        for (i = 0; i < s.num_f; i++) {
-            double t2 = getTimeOfFirstCollisionFlat(*_particle,s.f[i]);
+            for (i = 0; i < s->num_f; i++) {
+                double t2 = getTimeOfFirstCollisionFlat(_particle,&s->f[i]);
 
-            if (t2 <= 0)
-                continue;
-            if (index == -1 || t2 < t) {
-                type = FLAT;
-                index = i;
-                t = t2;
+                if (t2 <= 0)
+                    continue;
+                if (index == -1 || t2 < t) {
+                    type = FLAT;
+                    index = i;
+                    t = t2;
+                }
             }
         }
 
-        for (i = 0; i < s.num_di; i++)  {
-            double t2 = getTimeOfFirstCollisionDisk(*_particle,s.di[i]);
+        for (i = 0; i < s->num_di; i++)  {
+            double t2 = getTimeOfFirstCollisionDisk(_particle,&s->di[i]);
 
             if (t2 <= 0)
                 continue;
@@ -1789,8 +2047,8 @@ void traceSingleNeutron(_class_particle* _particle, Scene s) {
             }
         }
 
-        for (i = 0; i < s.num_d; i++) {
-            double t2 = getTimeOfFirstCollisionDetector(*_particle,s.d[i]);
+        for (i = 0; i < s->num_d; i++) {
+            double t2 = getTimeOfFirstCollisionDetector(_particle,&s->d[i]);
 
             if (t2 <= 0)
                 continue;
@@ -1803,16 +2061,16 @@ void traceSingleNeutron(_class_particle* _particle, Scene s) {
 
         switch (type) {
             case DETECTOR:
-                traceNeutronDetector(_particle, s.d[index]);
+                traceNeutronDetector(_particle, &s->d[index]);
                 break;
             case FLAT:
-	        traceNeutronFlat(_particle, s.f[index]);
+	        traceNeutronFlat(_particle, &s->f[index]);
                 break;
             case DISK:
-                traceNeutronDisk(_particle, s.di[index]);
+                traceNeutronDisk(_particle, &s->di[index]);
                 break;
             case CONIC:
-                traceNeutronConic(_particle, s.c[index]);
+                traceNeutronConic(_particle, &s->c[index]);
                 break;
             default:
                 contact = 0;
@@ -1824,7 +2082,8 @@ void traceSingleNeutron(_class_particle* _particle, Scene s) {
 
 //!Finishes tracing the scene
 /*! This function should be called after all of the
-particles have been raytraced.
+particles have been raytraced. Writes the detectors
+and frees the Scene arrays.
 
 @param s Pointer of Scene to finish tracing
 */
@@ -1834,6 +2093,14 @@ void finishSimulation(Scene* s) {
     //Finish Detectors
     for (i=0; i < s->num_d; i++)
         finishDetector(s->d[i]);
+
+    free(s->f);
+    free(s->c);
+    free(s->di);
+    free(s->d);
+    free(s->bin_start);
+    free(s->bin_item);
+    *s = makeScene();
 }
 
 /** @} */ //end of ingroup simgroup
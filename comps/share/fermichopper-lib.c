@@ -0,0 +1,185 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/fermichopper-lib.c
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the FermiChopper component.
+* See fermichopper-lib.h.
+*
+* Usage: within SHARE
+* %include "fermichopper-lib"
+*
+*******************************************************************************/
+
+#ifndef FERMICHOPPER_LIB_H
+#error McStas : please import this library with %include "fermichopper-lib"
+#endif
+
+/*****************************************************************************
+* FC_zrot: returns Z' in rotating frame, from X,Z and t,omega,ph0
+****************************************************************************/
+#pragma acc routine seq
+double FC_zrot(double X, double Z, double T, struct FermiChopper_struct *FCs)
+{
+  double phi = FCs->omega*T+FCs->ph0;
+
+  return( Z*cos(phi)-X*sin(phi) );
+}
+
+/*****************************************************************************
+ * FC_xrot: returns X' in rotating frame, from X,Z and omega,t,ph0
+ *          additional coordinate shift in case of curved slits
+ ****************************************************************************/
+#pragma acc routine seq
+double FC_xrot(double X, double Z, double T, struct FermiChopper_struct *FCs)
+{
+  double phi   =FCs->omega*T+FCs->ph0;
+  double C_slit=FCs->C_slit;
+  double c=cos(phi), s=sin(phi);
+  double ret, tmp;
+
+  ret = X*c+Z*s;
+
+  if (C_slit) {
+    tmp  = fabs(Z*c-X*s);
+    if (tmp < FCs->L_slit/2) {
+      tmp  = (FCs->L_slit/2 - tmp)*C_slit;
+      ret += (1-sqrt(1-tmp*tmp))/C_slit;
+    }
+  }
+  return( ret );
+}
+
+/*****************************************************************************
+ * FC_xzrot_dt(x,z,vx,vz, t,dt, type='x' or 'z', FCs)
+ *   returns X' or Z' in rotating frame, from X,Z and t,omega,ph0
+ *              taking into account propagation with velocity during time dt
+ ****************************************************************************/
+#pragma acc routine seq
+double FC_xzrot_dt(double x, double z, double vx, double vz,
+                   double t, double dt, char type, struct FermiChopper_struct *FCs)
+{
+  if (dt) /* with propagation */
+    return( (type == 'x' ? FC_xrot(x+vx*dt, z+vz*dt, t+dt, FCs)
+                         : FC_zrot(x+vx*dt, z+vz*dt, t+dt, FCs)) );
+  else    /* without propagation */
+    return( (type == 'x' ? FC_xrot(x,z,t,FCs)
+                         : FC_zrot(x,z,t,FCs)) );
+}
+
+/*****************************************************************************
+ * FC_xzrot_ddt(x,z,vx,vz, t,dt, type='x' or 'z', FCs, &deriv)
+ *   same as FC_xzrot_dt, and sets *deriv to the time derivative of the
+ *   returned X' or Z' at t+dt. With X=x+vx.dt, Z=z+vz.dt, phi=omega(t+dt)+ph0:
+ *     dX'/dt = vx.cos(phi) + vz.sin(phi) + omega.Z'
+ *     dZ'/dt = vz.cos(phi) - vx.sin(phi) - omega.X'
+ *   (X' without slit curvature), plus the chain rule on the curvature term.
+ ****************************************************************************/
+#pragma acc routine seq
+double FC_xzrot_ddt(double x, double z, double vx, double vz,
+                   double t, double dt, char type, struct FermiChopper_struct *FCs,
+                   double *deriv)
+{
+  double X = x+vx*dt, Z = z+vz*dt;
+  double phi = FCs->omega*(t+dt)+FCs->ph0;
+  double c = cos(phi), s = sin(phi);
+  double xp = X*c+Z*s, zp = Z*c-X*s;
+  double dzp = vz*c - vx*s - FCs->omega*xp;
+  double u, root;
+
+  if (type != 'x') {
+    *deriv = dzp;
+    return( zp );
+  }
+  *deriv = vx*c + vz*s + FCs->omega*zp;
+  if (FCs->C_slit && fabs(zp) < FCs->L_slit/2) {
+    u    = (FCs->L_slit/2 - fabs(zp))*FCs->C_slit;
+    root = sqrt(1-u*u);
+    xp  += (1-root)/FCs->C_slit;
+    if (root > 0) *deriv -= (zp < 0 ? -1 : 1)*u/root*dzp;
+  }
+  return( xp );
+}
+
+/*****************************************************************************
+ * FC_xzsolve(x,z,vx,vz, t,dt, type='x' or 'z', d, FCs)
+ *   solves X'=d or Z'=d in time interval [0, dt] with a Newton iteration kept
+ *           inside the bracketing interval, falling back to bisection when a
+ *           Newton step leaves it or does not reduce the interval fast enough
+ *           (NumRecip in C, chap 9, p366, rtsafe). The first guess is the
+ *           linear interpolation between the interval ends.
+ *           Returns time within [0,dt]
+ *           ERRORS: return -1 not used
+ *                          -2 if exceed MAX iteration
+ *                          -3 no sign change in range
+ ****************************************************************************/
+#pragma acc routine seq
+double FC_xzsolve(double x, double z, double vx, double vz,
+                  double t, double dt,
+                  char type, double d, struct FermiChopper_struct *FCs)
+{
+  int    iter;
+  double tol=0.5*FermiChopper_TimeAccuracy;
+  double df, dx, dxold, f, lo, hi, s;
+  double fa=FC_xzrot_ddt(x,z,vx,vz, t,0,  type, FCs, &df) - d;
+  double fb=FC_xzrot_ddt(x,z,vx,vz, t,dt, type, FCs, &df) - d;
+
+  if (fb*fa > 0.0) return -3;
+  if (fa == 0.0) return 0;
+  if (fb == 0.0) return dt;
+  /* orient the bracket so that f(lo) < 0 < f(hi) */
+  if (fa < 0) { lo=0;  hi=dt; }
+  else        { lo=dt; hi=0;  }
+  dxold = dx = fabs(dt);
+  s = fa*dt/(fa-fb);
+  f = FC_xzrot_ddt(x,z,vx,vz, t,s, type, FCs, &df) - d;
+  for (iter=1;iter<=FermiChopper_MAXITER;iter++) {
+    if (f == 0.0) return s;
+    if (f < 0.0) lo = s; else hi = s;
+    if ((((s-hi)*df-f)*((s-lo)*df-f) > 0.0)
+      || (fabs(2.0*f) > fabs(dxold*df))) {
+      /* Newton out of range or too slow: bisect */
+      dxold = dx;
+      dx    = 0.5*(hi-lo);
+      s     = lo+dx;
+    } else {
+      dxold = dx;
+      dx    = f/df;
+      s    -= dx;
+    }
+    if (fabs(dx) < tol) return s;
+    f = FC_xzrot_ddt(x,z,vx,vz, t,s, type, FCs, &df) - d;
+  }
+  return -2;
+} /* FC_xzsolve */
+
+/*****************************************************************************
+ * Wrappers to intersection algorithms
+ ****************************************************************************/
+#pragma acc routine seq
+double FC_xintersect(double x, double z, double vx, double vz,
+                   double t, double dt,
+                   double d, struct FermiChopper_struct *FCs)
+{
+  return(FC_xzsolve(x, z, vx, vz, t, dt, 'x', d, FCs));
+}
+#pragma acc routine seq
+double FC_zintersect(double x, double z, double vx, double vz,
+                   double t, double dt,
+                   double d, struct FermiChopper_struct *FCs)
+{
+  return(FC_xzsolve(x, z, vx, vz, t, dt, 'z', d, FCs));
+}
+
+/* end of fermichopper-lib.c */
@@ -0,0 +1,95 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/fermichopper-lib.h
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the FermiChopper component.
+* It holds the chopper state, the transformations to the rotating frame of
+* the slit package, and the solver for the time at which a straight
+* trajectory reaches a given X' (slit wall) or Z' (slit entrance/exit) in
+* that frame. The solver is a bracketed Newton iteration using the analytic
+* time derivative of the rotating frame coordinates.
+*
+* Usage: within SHARE
+* %include "fermichopper-lib"
+*
+*******************************************************************************/
+
+#ifndef FERMICHOPPER_LIB_H
+#define FERMICHOPPER_LIB_H "$Revision$"
+
+#ifndef FermiChopper_TimeAccuracy
+#define FermiChopper_TimeAccuracy 1e-9
+#endif
+#ifndef FermiChopper_MAXITER
+#define FermiChopper_MAXITER      100
+#endif
+
+/* Definition of internal variable structure: all counters */
+struct FermiChopper_struct
+{
+double omega;  /* chopper rotation */
+double ph0;    /* chopper rotation */
+double t0;     /* chopper rotation */
+double C_slit;          /* slit curvature radius in [m] */
+double L_slit;          /* slit package length [m] */
+double sum_t;
+double sum_v;
+double sum_N;
+double sum_N_pass;
+/* events */
+long absorb_alreadyinside;
+long absorb_topbottom;
+long absorb_cylentrance;
+long absorb_sideentrance;
+long absorb_notreachentrance;
+long absorb_packentrance;
+long absorb_slitcoating;
+long warn_notreachslitwall;
+long absorb_exitslitpack;
+long absorb_maxiterations;
+long absorb_wrongdirection;
+long absorb_nocontrol;
+long absorb_cylexit;
+long warn_notreachslitoutput;
+char compcurname[256];
+};
+
+#pragma acc routine seq
+double FC_zrot(double X, double Z, double T, struct FermiChopper_struct *FCs);
+#pragma acc routine seq
+double FC_xrot(double X, double Z, double T, struct FermiChopper_struct *FCs);
+#pragma acc routine seq
+double FC_xzrot_dt(double x, double z, double vx, double vz,
+                   double t, double dt, char type, struct FermiChopper_struct *FCs);
+#pragma acc routine seq
+double FC_xzrot_ddt(double x, double z, double vx, double vz,
+                   double t, double dt, char type, struct FermiChopper_struct *FCs,
+                   double *deriv);
+#pragma acc routine seq
+double FC_xzsolve(double x, double z, double vx, double vz,
+                  double t, double dt,
+                  char type, double d, struct FermiChopper_struct *FCs);
+#pragma acc routine seq
+double FC_xintersect(double x, double z, double vx, double vz,
+                   double t, double dt,
+                   double d, struct FermiChopper_struct *FCs);
+#pragma acc routine seq
+double FC_zintersect(double x, double z, double vx, double vz,
+                   double t, double dt,
+                   double d, struct FermiChopper_struct *FCs);
+
+#endif
+
+/* end of fermichopper-lib.h */
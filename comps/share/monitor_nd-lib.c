@@ -159,6 +159,7 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     Vars->Flag_log          = 0;   /* log10 of the flux */
     Vars->Flag_parallel     = 0;   /* set neutron state back after detection (parallel components) */
     Vars->Flag_Binary_List  = 0;   /* save list as a binary file (smaller) */
+    Vars->Flag_Stream       = 0;   /* write 'list all' blocks to a binary file from TRACE */
     Vars->Coord_Number      = 0;   /* total number of variables to monitor, plus intensity (0) */
     Vars->Coord_NumberNoPixel=0;   /* same but without counting PixelID */
 
@@ -166,6 +167,9 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     Vars->Neutron_Counter   = 0;   /* event counter, simulation total counts is mcget_ncount() */
     Vars->Buffer_Counter    = 0;   /* index in Buffer size (for realloc) */
     Vars->Buffer_Size       = 0;
+    Vars->Stream_File       = NULL;
+    Vars->Stream_Column     = NULL;
+    Vars->Stream_Events     = 0;
     Vars->He3_pressure      = 0;
     Vars->Flag_capture      = 0;
     Vars->Flag_signal       = DEFS->COORD_P;
@@ -175,6 +179,8 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     Vars->mean_dx=Vars->mean_dy=0;
     Vars->min_x = Vars->max_x  =0;
     Vars->min_y = Vars->max_y  =0;
+    for (i = 0; i < MONnD_COORD_NMAX; i++)
+    { Vars->Auto_Min[i] = FLT_MAX; Vars->Auto_Max[i] = -FLT_MAX; }
 
     Set_Vars_Coord_Type = DEFS->COORD_NONE;
     Set_Coord_Mode = DEFS->COORD_VAR;
@@ -325,6 +331,7 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
         if (!strcmp(token, "inactivate")) {
           Flag_End = 1; Vars->Coord_Number = 0; iskeyword=1; }
         if (!strcmp(token, "all"))    { Flag_All = 1;  iskeyword=1; }
+        if (!strcmp(token, "stream")) { Vars->Flag_Stream = 1; iskeyword=1; }
         if (!strcmp(token, "sphere")) { Vars->Flag_Shape = DEFS->SHAPE_SPHERE; iskeyword=1; }
         if (!strcmp(token, "cylinder")) { Vars->Flag_Shape = DEFS->SHAPE_CYLIND; iskeyword=1; }
         if (!strcmp(token, "banana")) { Vars->Flag_Shape = DEFS->SHAPE_BANANA; iskeyword=1; }
@@ -693,6 +700,18 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     /* Vars->Coord_Number  0   : intensity or signal
      * Vars->Coord_Number  1:n : detector variables */
 
+    /* streamed list: 'list all' written by blocks of at most MONnD_STREAM_BLOCK events */
+    if (Vars->Flag_Stream && Vars->Coord_Number)
+    {
+    #ifdef OPENACC
+      printf("Monitor_nD: %s: the 'stream' option is not available on GPU. Using a plain list.\n", Vars->compcurname);
+      Vars->Flag_Stream = 0;
+    #else
+      Vars->Flag_List = 2;
+      if (Vars->Buffer_Block > MONnD_STREAM_BLOCK) Vars->Buffer_Block = MONnD_STREAM_BLOCK;
+    #endif
+    } else Vars->Flag_Stream = 0;
+
     if ((Vars->Coord_NumberNoPixel != 2) && !Vars->Flag_Multiple && !Vars->Flag_List)
     { Vars->Flag_Multiple = 1; /* default is n1D */
       if (Vars->Coord_Number != Vars->Coord_NumberNoPixel) Vars->Flag_List = 1; }
@@ -766,6 +785,30 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     Vars->p2sum = 0;
     Vars->Nsum  = 0;
 
+    /* accumulators written in checkpoints and restored by --resume */
+    {
+      char name[256];
+      long k;
+      sprintf(name, "%s.Nsum",  Vars->compcurname); mccheckpoint_add(name, &Vars->Nsum,  sizeof(Vars->Nsum));
+      sprintf(name, "%s.psum",  Vars->compcurname); mccheckpoint_add(name, &Vars->psum,  sizeof(Vars->psum));
+      sprintf(name, "%s.p2sum", Vars->compcurname); mccheckpoint_add(name, &Vars->p2sum, sizeof(Vars->p2sum));
+      sprintf(name, "%s.Neutron_Counter", Vars->compcurname);
+      mccheckpoint_add(name, &Vars->Neutron_Counter, sizeof(Vars->Neutron_Counter));
+      if (Vars->Mon2D_N && Vars->Flag_Multiple) {
+        for (k = 0; k < Vars->Coord_Number; k++) {
+          sprintf(name, "%s.Mon2D_N",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_N[k],  Vars->Coord_Bin[k+1]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p[k],  Vars->Coord_Bin[k+1]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p2", Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p2[k], Vars->Coord_Bin[k+1]*sizeof(double));
+        }
+      } else if (Vars->Mon2D_N) {
+        for (k = 0; k < Vars->Coord_Bin[1]; k++) {
+          sprintf(name, "%s.Mon2D_N",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_N[k],  Vars->Coord_Bin[2]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p[k],  Vars->Coord_Bin[2]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p2", Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p2[k], Vars->Coord_Bin[2]*sizeof(double));
+        }
+      }
+    }
+
     Vars->area  = fabs(Vars->mxmax - Vars->mxmin)*fabs(Vars->mymax - Vars->mymin)*1E4; /* in cm**2 for square and box shapes */
     Vars->Sphere_Radius = fabs(Vars->mxmax - Vars->mxmin)/2;
     if ((abs(Vars->Flag_Shape) == DEFS->SHAPE_DISK) || (abs(Vars->Flag_Shape) == DEFS->SHAPE_SPHERE))
@@ -796,6 +839,9 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
       Vars->Coord_BinProd[i]=Vars->Coord_Bin[i]*Vars->Coord_BinProd[i-1];
     }
 
+    /* variable extractors and bin scale factors used in TRACE */
+    Monitor_nD_Compile(DEFS, Vars);
+
     #ifdef USE_NEXUS
 
     #ifdef USE_MPI
@@ -1053,6 +1099,155 @@ void Monitor_nD_Init(MonitornD_Defines_type *DEFS,
     #endif // USE_NEXUS
     } /* end Monitor_nD_Init */
 
+/* ========================================================================= */
+/* Monitor_nD_Compile: this routine sets the extractor and the bin scale     */
+/*   factor of each variable from Coord_Type and Coord_Min/Max/Bin, for      */
+/*   Monitor_nD_Trace. Call it again when these are changed after Init.      */
+/* ========================================================================= */
+
+void Monitor_nD_Compile(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Vars)
+  {
+    long   i;
+    int    type, get;
+    double XY;
+
+    for (i = 0; i <= Vars->Coord_Number; i++)
+    {
+      type = Vars->Coord_Type[i] & (DEFS->COORD_LOG-1);
+      Vars->Coord_Arg[i] = 0;
+      if      (type == DEFS->COORD_X)      get = MONnD_GET_X;
+      else if (type == DEFS->COORD_Y)      get = MONnD_GET_Y;
+      else if (type == DEFS->COORD_Z)      get = MONnD_GET_Z;
+      else if (type == DEFS->COORD_VX)     get = MONnD_GET_VX;
+      else if (type == DEFS->COORD_VY)     get = MONnD_GET_VY;
+      else if (type == DEFS->COORD_VZ)     get = MONnD_GET_VZ;
+      else if (type == DEFS->COORD_KX)     get = MONnD_GET_KX;
+      else if (type == DEFS->COORD_KY)     get = MONnD_GET_KY;
+      else if (type == DEFS->COORD_KZ)     get = MONnD_GET_KZ;
+      else if (type == DEFS->COORD_SX)     get = MONnD_GET_SX;
+      else if (type == DEFS->COORD_SY)     get = MONnD_GET_SY;
+      else if (type == DEFS->COORD_SZ)     get = MONnD_GET_SZ;
+      else if (type == DEFS->COORD_T)      get = MONnD_GET_T;
+      else if (type == DEFS->COORD_P)      get = MONnD_GET_P;
+      else if (type >= DEFS->COORD_USERDOUBLE0 && type <= DEFS->COORD_USERDOUBLE15)
+      {
+        get = MONnD_GET_USERDOUBLE;
+        Vars->Coord_Arg[i] = type - DEFS->COORD_USERDOUBLE0;
+      }
+      else if (type == DEFS->COORD_HDIV)   get = MONnD_GET_HDIV;
+      else if (type == DEFS->COORD_VDIV)   get = MONnD_GET_VDIV;
+      else if (type == DEFS->COORD_V)      get = MONnD_GET_V;
+      else if (type == DEFS->COORD_RADIUS) get = MONnD_GET_RADIUS;
+      else if (type == DEFS->COORD_XY)     get = MONnD_GET_XY;
+      else if (type == DEFS->COORD_YZ)     get = MONnD_GET_YZ;
+      else if (type == DEFS->COORD_XZ)     get = MONnD_GET_XZ;
+      else if (type == DEFS->COORD_VXY)    get = MONnD_GET_VXY;
+      else if (type == DEFS->COORD_VXZ)    get = MONnD_GET_VXZ;
+      else if (type == DEFS->COORD_VYZ)    get = MONnD_GET_VYZ;
+      else if (type == DEFS->COORD_K)      get = MONnD_GET_K;
+      else if (type == DEFS->COORD_KXY)    get = MONnD_GET_KXY;
+      else if (type == DEFS->COORD_KXZ)    get = MONnD_GET_KXZ;
+      else if (type == DEFS->COORD_KYZ)    get = MONnD_GET_KYZ;
+      else if (type == DEFS->COORD_ENERGY) get = MONnD_GET_ENERGY;
+      else if (type == DEFS->COORD_LAMBDA) get = MONnD_GET_LAMBDA;
+      else if (type == DEFS->COORD_NCOUNT) get = MONnD_GET_NCOUNT;
+      else if (type == DEFS->COORD_ANGLE)  get = MONnD_GET_ANGLE;
+      else if (type == DEFS->COORD_THETA)  get = MONnD_GET_THETA;
+      else if (type == DEFS->COORD_PHI)    get = MONnD_GET_PHI;
+      else if (type == DEFS->COORD_USER1 || type == DEFS->COORD_USER2 || type == DEFS->COORD_USER3)
+      {
+        get = MONnD_GET_USER;
+        Vars->Coord_Arg[i] = 1 + type - DEFS->COORD_USER1;
+      }
+      else if (type == DEFS->COORD_PIXELID) get = MONnD_GET_PIXELID;
+      else                                  get = MONnD_GET_NONE;
+      Vars->Coord_Extract[i] = get;
+
+      /* index = floor((value-min)*scale), with scale=0 when not binned */
+      XY = Vars->Coord_Max[i]-Vars->Coord_Min[i];
+      Vars->Coord_Scale[i] = (Vars->Coord_Bin[i] > 1 && XY > 0) ? Vars->Coord_Bin[i]/XY : 0;
+    }
+  } /* end Monitor_nD_Compile */
+
+/* ========================================================================= */
+/* Monitor_nD_Stream: writes the events stored in the Buffer as one block of */
+/*   the streamed list file (see monitor_nd-lib.h), and empties the Buffer.  */
+/*   The file is created at the first call, as Mon_File is set after Init.   */
+/* ========================================================================= */
+
+void Monitor_nD_Stream(MonitornD_Variables_type *Vars)
+  {
+    long long n    = Vars->Buffer_Counter;
+    long      ncol = Vars->Coord_Number+1;
+    size_t    size = Vars->Flag_Binary_List == 1 ? sizeof(float) : sizeof(double);
+    long long j;
+    long      i;
+
+    if (Vars->Flag_Stream == 1 && !Vars->Stream_File)
+    { /* open the output file of this process and write its header */
+      char  fname[256];
+      char  name[32];
+      char *path;
+      int   header[3] = { 1, ncol, size };
+
+      strncpy(fname, Vars->Mon_File, 128); fname[128] = '\0';
+      if (strchr(fname,'.') == NULL) strcat(fname, "_list.bin");
+      #ifdef USE_MPI
+      sprintf(fname+strlen(fname), ".%i", mpi_node_rank);
+      #endif
+      Vars->Stream_Column = (char *)malloc(Vars->Buffer_Block*size);
+      if (Vars->Stream_Column && strlen(Vars->Mon_File))
+      {
+        path = mcfull_file(fname, NULL);
+        Vars->Stream_File = fopen(path, "wb");
+        free(path);
+      }
+      if (!Vars->Stream_File)
+      {
+        printf("Monitor_nD: %s cannot create streamed list file %s. Skipping list.\n", Vars->compcurname, fname);
+        Vars->Flag_Stream = 2; /* do not retry */
+      }
+      else
+      {
+        fwrite("MCNDLIST", 1, 8, Vars->Stream_File);
+        fwrite(header, sizeof(int), 3, Vars->Stream_File);
+        for (i = 0; i < ncol; i++)
+        {
+          memset(name, 0, sizeof(name));
+          strncpy(name, Vars->Coord_Var[i], sizeof(name)-1);
+          fwrite(name, 1, sizeof(name), Vars->Stream_File);
+        }
+        if (Vars->Flag_Verbose) printf("Monitor_nD: %s streams list to %s by blocks of %lu events.\n", Vars->compcurname, fname, Vars->Buffer_Block);
+      }
+    }
+
+    Vars->Buffer_Counter = 0;
+    if (!Vars->Stream_File || !n) return;
+
+    fwrite(&n, sizeof(n), 1, Vars->Stream_File);
+    for (i = 0; i < ncol; i++)
+    {
+      if (size == sizeof(float))
+      {
+        float *column = (float *)Vars->Stream_Column;
+        for (j = 0; j < n; j++) column[j] = (float)Vars->Mon2D_Buffer[i + j*ncol];
+      }
+      else
+      {
+        double *column = (double *)Vars->Stream_Column;
+        for (j = 0; j < n; j++) column[j] = Vars->Mon2D_Buffer[i + j*ncol];
+      }
+      if (fwrite(Vars->Stream_Column, size, n, Vars->Stream_File) != (size_t)n)
+      {
+        printf("Monitor_nD: %s cannot write streamed list after %llu events. Stopping list.\n", Vars->compcurname, Vars->Stream_Events);
+        fclose(Vars->Stream_File);
+        Vars->Stream_File = NULL;
+        return;
+      }
+    }
+    Vars->Stream_Events += n;
+  } /* end Monitor_nD_Stream */
+
 /* ========================================================================= */
 /* Monitor_nD_Trace: this routine is used to monitor one propagating neutron */
 /* return values: 0=neutron was absorbed, -1=neutron was outside bounds, 1=neutron was measured*/
@@ -1067,7 +1262,6 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
   long    Coord_Index[MONnD_COORD_NMAX];
   char    While_End   =0;
   long    While_Buffer=0;
-  char    Set_Vars_Coord_Type = DEFS->COORD_NONE;
   
   /* For the OPENACC list buffer an atomic capture/update of the
      updated Neutron_counter - captured below under list mode */
@@ -1091,15 +1285,11 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
     for (i = 1; i <= Vars->Coord_Number; i++)
     {
       if (Vars->Coord_Type[i] & DEFS->COORD_AUTO)
-      {
-        Vars->Coord_Min[i] =  FLT_MAX;
-        Vars->Coord_Max[i] = -FLT_MAX;
-        for (j = 0; j < Vars->Buffer_Counter; j++)
-        {
-          XY = Vars->Mon2D_Buffer[i+j*(Vars->Coord_Number+1)];  /* scanning variables in Buffer */
-          if (XY < Vars->Coord_Min[i]) Vars->Coord_Min[i] = XY;
-          if (XY > Vars->Coord_Max[i]) Vars->Coord_Max[i] = XY;
-        }
+      { /* limits of the Buffer, gathered while storing it */
+        Vars->Coord_Min[i] = Vars->Auto_Min[i];
+        Vars->Coord_Max[i] = Vars->Auto_Max[i];
+        XY = Vars->Coord_Max[i]-Vars->Coord_Min[i];
+        Vars->Coord_Scale[i] = (Vars->Coord_Bin[i] > 1 && XY > 0) ? Vars->Coord_Bin[i]/XY : 0;
         if  (Vars->Flag_Verbose)  
           printf("  %s: min=%g max=%g\n", Vars->Coord_Var[i], Vars->Coord_Min[i], Vars->Coord_Max[i]);
       }
@@ -1109,7 +1299,7 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
 
 #ifndef OPENACC
   /* manage realloc for 'list all' if Buffer size exceeded: flush Buffer to file */
-  if ((Vars->Buffer_Counter >= Vars->Buffer_Block) && (Vars->Flag_List >= 2))
+  if ((Vars->Buffer_Counter >= Vars->Buffer_Block) && (Vars->Flag_List >= 2) && !Vars->Flag_Stream)
   {
     if (Vars->Buffer_Size >= 1000000 || Vars->Flag_List == 3)
     { /* save current (possibly append) and re-use Buffer */
@@ -1119,6 +1309,7 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
       Vars->Buffer_Block = Vars->Buffer_Size;
       Vars->Buffer_Counter  = 0;
       Vars->Neutron_Counter = 0;
+      ParticleCount = Vars->Neutron_Counter++; /* this event starts the new Buffer */
     }
     else
     {
@@ -1145,11 +1336,10 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
         {
           /* scanning variables in Buffer */
           if (Vars->Coord_Bin[i] <= 1) continue;
-          XY = (Vars->Coord_Max[i]-Vars->Coord_Min[i]);
 
           Coord[i] = Vars->Mon2D_Buffer[i+While_Buffer*(Vars->Coord_Number+1)];
-          if (XY > 0) Coord_Index[i] = floor((Coord[i]-Vars->Coord_Min[i])*Vars->Coord_Bin[i]/XY);
-          else        Coord_Index[i] = 0;
+          if (Vars->Coord_Scale[i] > 0) Coord_Index[i] = floor((Coord[i]-Vars->Coord_Min[i])*Vars->Coord_Scale[i]);
+          else                          Coord_Index[i] = 0;
           if (Vars->Flag_With_Borders)
           {
             if (Coord_Index[i] < 0)                   Coord_Index[i] = 0;
@@ -1160,8 +1350,7 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
         /* update the PixelID, we compute it from the previous variables index */
         if (Vars->Coord_NumberNoPixel < Vars->Coord_Number) /* there is a Pixel variable */
         for (i = 1; i <= Vars->Coord_Number; i++) {
-          char Set_Vars_Coord_Type = (Vars->Coord_Type[i] & (DEFS->COORD_LOG-1));
-          if (Set_Vars_Coord_Type == DEFS->COORD_PIXELID) {
+          if (Vars->Coord_Extract[i] == MONnD_GET_PIXELID) {
             char flag_outside=0;
             Coord_Index[i] = Coord[i] = 0;
             for (j= 1; j < i; j++) {
@@ -1194,180 +1383,124 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
     
     if (Vars->Flag_Auto_Limits != 2 || !Vars->Coord_Number) /* Vars->Flag_Auto_Limits == 0 (no auto limits/list) or 1 (store events into Buffer) */
     {
-      /* automatically compute area and steradian solid angle when in AUTO mode */
-      /* compute the steradian solid angle incoming on the monitor */
-      double v;
-      double tmp;
-      v=sqrt(_particle->vx*_particle->vx + _particle->vy*_particle->vy + _particle->vz*_particle->vz);
-      tmp=_particle->x;
-      if (Vars->min_x > _particle->x){
-        #pragma acc atomic write
-        Vars->min_x = tmp;
-      }
-      if (Vars->max_x < _particle->x){
-        #pragma acc atomic write
-        Vars->max_x = tmp;
-      }
-      tmp=_particle->y;
-      if (Vars->min_y > _particle->y){
-        #pragma acc atomic write
-        Vars->min_y = tmp;
-      }
-      if (Vars->max_y < _particle->y){
-	tmp=_particle->y;
-        #pragma acc atomic write
-	Vars->max_y = tmp;
-      }
+      /* beam area and steradian solid angle incoming on the monitor, only
+         displayed in SAVE with 'verbose per cm2': skip the shared updates otherwise */
+      if (Vars->Flag_Verbose && Vars->Flag_per_cm2) {
+        double v;
+        double tmp;
+        v=sqrt(_particle->vx*_particle->vx + _particle->vy*_particle->vy + _particle->vz*_particle->vz);
+        tmp=_particle->x;
+        if (Vars->min_x > _particle->x){
+          #pragma acc atomic write
+          Vars->min_x = tmp;
+        }
+        if (Vars->max_x < _particle->x){
+          #pragma acc atomic write
+          Vars->max_x = tmp;
+        }
+        tmp=_particle->y;
+        if (Vars->min_y > _particle->y){
+          #pragma acc atomic write
+          Vars->min_y = tmp;
+        }
+        if (Vars->max_y < _particle->y){
+          #pragma acc atomic write
+          Vars->max_y = tmp;
+        }
 
-      #pragma acc atomic
-      Vars->mean_p = Vars->mean_p + _particle->p;
-      if (v) {
-        tmp=_particle->p*fabs(_particle->vx/v);
         #pragma acc atomic
-        Vars->mean_dx = Vars->mean_dx + tmp; //_particle->p*fabs(_particle->vx/v);
-        tmp=_particle->p*fabs(_particle->vy/v);
-        #pragma acc atomic
-        Vars->mean_dy = Vars->mean_dy + tmp; //_particle->p*fabs(_particle->vy/v);
-      }
+        Vars->mean_p = Vars->mean_p + _particle->p;
+        if (v) {
+          tmp=_particle->p*fabs(_particle->vx/v);
+          #pragma acc atomic
+          Vars->mean_dx = Vars->mean_dx + tmp; //_particle->p*fabs(_particle->vx/v);
+          tmp=_particle->p*fabs(_particle->vy/v);
+          #pragma acc atomic
+          Vars->mean_dy = Vars->mean_dy + tmp; //_particle->p*fabs(_particle->vy/v);
+        }
+      } /* end beam area and solid angle */
 
       for (i = 0; i <= Vars->Coord_Number; i++)
       { /* handle current neutron : last while */
         XY = 0;
-        Set_Vars_Coord_Type = (Vars->Coord_Type[i] & (DEFS->COORD_LOG-1));
-        /* get values for variables to monitor */
-        if (Set_Vars_Coord_Type == DEFS->COORD_X) XY = _particle->x;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_Y) XY = _particle->y;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_Z) XY = _particle->z;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VX) XY = _particle->vx;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VY) XY = _particle->vy;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VZ) XY = _particle->vz;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KX) XY = V2K*_particle->vx;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KY) XY = V2K*_particle->vy;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KZ) XY = V2K*_particle->vz;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_SX) XY = _particle->sx;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_SY) XY = _particle->sy;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_SZ) XY = _particle->sz;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_T) XY = _particle->t;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_P) XY = _particle->p;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE0) XY = Vars->UserDoubles[0];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE1) XY = Vars->UserDoubles[1];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE2) XY = Vars->UserDoubles[2];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE3) XY = Vars->UserDoubles[3];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE4) XY = Vars->UserDoubles[4];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE5) XY = Vars->UserDoubles[5];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE6) XY = Vars->UserDoubles[6];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE7) XY = Vars->UserDoubles[7];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE8) XY = Vars->UserDoubles[8];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE9) XY = Vars->UserDoubles[9];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE10) XY = Vars->UserDoubles[10];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE11) XY = Vars->UserDoubles[11];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE12) XY = Vars->UserDoubles[12];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE13) XY = Vars->UserDoubles[13];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE14) XY = Vars->UserDoubles[14];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USERDOUBLE15) XY = Vars->UserDoubles[15];
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_HDIV) XY = RAD2DEG*atan2(_particle->vx,_particle->vz);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VDIV) XY = RAD2DEG*atan2(_particle->vy,_particle->vz);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_V) XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_RADIUS)
-          XY = sqrt(_particle->x*_particle->x+_particle->y*_particle->y+_particle->z*_particle->z);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_XY)
-          XY = sqrt(_particle->x*_particle->x+_particle->y*_particle->y)*(_particle->x > 0 ? 1 : -1);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_YZ) XY = sqrt(_particle->y*_particle->y+_particle->z*_particle->z);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_XZ)
-          XY = sqrt(_particle->x*_particle->x+_particle->z*_particle->z);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VXY) XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VXZ) XY = sqrt(_particle->vx*_particle->vx+_particle->vz*_particle->vz);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_VYZ) XY = sqrt(_particle->vy*_particle->vy+_particle->vz*_particle->vz);
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_K) { XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz);  XY *= V2K; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KXY) { XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy);  XY *= V2K; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KXZ) { XY = sqrt(_particle->vx*_particle->vx+_particle->vz*_particle->vz);  XY *= V2K; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_KYZ) { XY = sqrt(_particle->vy*_particle->vy+_particle->vz*_particle->vz);  XY *= V2K; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_ENERGY) { XY = _particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz;  XY *= VS2E; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_LAMBDA) { XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz);  XY *= V2K; if (XY != 0) XY = 2*PI/XY; }
-        else
-	  if (Set_Vars_Coord_Type == DEFS->COORD_NCOUNT) XY = _particle->_uid;
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_ANGLE)
-        {  XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy);
-           if (_particle->vz != 0)
-                XY = RAD2DEG*atan2(XY,_particle->vz)*(_particle->x > 0 ? 1 : -1);
-           else XY = 0;
-        }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_THETA)  { if (_particle->z != 0) XY = RAD2DEG*atan2(_particle->x,_particle->z); }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_PHI) { double rr=sqrt(_particle->x*_particle->x+ _particle->y*_particle->y + _particle->z*_particle->z); if (rr != 0) XY = RAD2DEG*asin(_particle->y/rr); }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USER1) {int fail; XY = particle_getvar(_particle,Vars->UserVariable1,&fail); if(fail) XY=0; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USER2) {int fail; XY = particle_getvar(_particle,Vars->UserVariable2,&fail); if(fail) XY=0; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_USER3) {int fail; XY = particle_getvar(_particle,Vars->UserVariable3,&fail); if(fail) XY=0; }
-        else
-        if (Set_Vars_Coord_Type == DEFS->COORD_PIXELID && !Vars->Flag_Auto_Limits) {
-          /* compute the PixelID from previous coordinates 
-             the PixelID is the product of Coord_Index[i] in the detector geometry 
-             pixelID = sum( Coord_Index[j]*prod(Vars->Coord_Bin[1:(j-1)]) )
-             
-             this does not apply when we store events in the buffer as Coord_Index
-             is not set. Then the pixelID will be re-computed during SAVE.
-          */
-          char flag_outside=0;
-          for (j= 1; j < i; j++) {
-            /* not for 1D variables with Bin=1 such as PixelID, NCOUNT, Intensity */
-            if (Vars->Coord_Bin[j] <= 1) continue; 
-            if (0 > Coord_Index[j] || Coord_Index[j] >= Vars->Coord_Bin[j]) { 
-              flag_outside=1; XY=0; break;
+        /* get values for variables to monitor (see Monitor_nD_Compile) */
+        switch (Vars->Coord_Extract[i]) {
+          case MONnD_GET_X:  XY = _particle->x; break;
+          case MONnD_GET_Y:  XY = _particle->y; break;
+          case MONnD_GET_Z:  XY = _particle->z; break;
+          case MONnD_GET_VX: XY = _particle->vx; break;
+          case MONnD_GET_VY: XY = _particle->vy; break;
+          case MONnD_GET_VZ: XY = _particle->vz; break;
+          case MONnD_GET_KX: XY = V2K*_particle->vx; break;
+          case MONnD_GET_KY: XY = V2K*_particle->vy; break;
+          case MONnD_GET_KZ: XY = V2K*_particle->vz; break;
+          case MONnD_GET_SX: XY = _particle->sx; break;
+          case MONnD_GET_SY: XY = _particle->sy; break;
+          case MONnD_GET_SZ: XY = _particle->sz; break;
+          case MONnD_GET_T:  XY = _particle->t; break;
+          case MONnD_GET_P:  XY = _particle->p; break;
+          case MONnD_GET_USERDOUBLE: XY = Vars->UserDoubles[Vars->Coord_Arg[i]]; break;
+          case MONnD_GET_HDIV: XY = RAD2DEG*atan2(_particle->vx,_particle->vz); break;
+          case MONnD_GET_VDIV: XY = RAD2DEG*atan2(_particle->vy,_particle->vz); break;
+          case MONnD_GET_V: XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz); break;
+          case MONnD_GET_RADIUS:
+            XY = sqrt(_particle->x*_particle->x+_particle->y*_particle->y+_particle->z*_particle->z); break;
+          case MONnD_GET_XY:
+            XY = sqrt(_particle->x*_particle->x+_particle->y*_particle->y)*(_particle->x > 0 ? 1 : -1); break;
+          case MONnD_GET_YZ: XY = sqrt(_particle->y*_particle->y+_particle->z*_particle->z); break;
+          case MONnD_GET_XZ: XY = sqrt(_particle->x*_particle->x+_particle->z*_particle->z); break;
+          case MONnD_GET_VXY: XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy); break;
+          case MONnD_GET_VXZ: XY = sqrt(_particle->vx*_particle->vx+_particle->vz*_particle->vz); break;
+          case MONnD_GET_VYZ: XY = sqrt(_particle->vy*_particle->vy+_particle->vz*_particle->vz); break;
+          case MONnD_GET_K:   XY = V2K*sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz); break;
+          case MONnD_GET_KXY: XY = V2K*sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy); break;
+          case MONnD_GET_KXZ: XY = V2K*sqrt(_particle->vx*_particle->vx+_particle->vz*_particle->vz); break;
+          case MONnD_GET_KYZ: XY = V2K*sqrt(_particle->vy*_particle->vy+_particle->vz*_particle->vz); break;
+          case MONnD_GET_ENERGY: XY = VS2E*(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz); break;
+          case MONnD_GET_LAMBDA:
+            XY = V2K*sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy+_particle->vz*_particle->vz);
+            if (XY != 0) XY = 2*PI/XY;
+            break;
+          case MONnD_GET_NCOUNT: XY = _particle->_uid; break;
+          case MONnD_GET_ANGLE:
+            XY = sqrt(_particle->vx*_particle->vx+_particle->vy*_particle->vy);
+            if (_particle->vz != 0)
+                 XY = RAD2DEG*atan2(XY,_particle->vz)*(_particle->x > 0 ? 1 : -1);
+            else XY = 0;
+            break;
+          case MONnD_GET_THETA: if (_particle->z != 0) XY = RAD2DEG*atan2(_particle->x,_particle->z); break;
+          case MONnD_GET_PHI: {
+            double rr=sqrt(_particle->x*_particle->x+ _particle->y*_particle->y + _particle->z*_particle->z);
+            if (rr != 0) XY = RAD2DEG*asin(_particle->y/rr);
+            break; }
+          case MONnD_GET_USER: {
+            int fail;
+            XY = particle_getvar(_particle, Vars->Coord_Arg[i] == 1 ? Vars->UserVariable1 :
+              (Vars->Coord_Arg[i] == 2 ? Vars->UserVariable2 : Vars->UserVariable3), &fail);
+            if (fail) XY=0;
+            break; }
+          case MONnD_GET_PIXELID:
+            if (!Vars->Flag_Auto_Limits) {
+              /* compute the PixelID from previous coordinates 
+                 the PixelID is the product of Coord_Index[i] in the detector geometry 
+                 pixelID = sum( Coord_Index[j]*prod(Vars->Coord_Bin[1:(j-1)]) )
+                 
+                 this does not apply when we store events in the buffer as Coord_Index
+                 is not set. Then the pixelID will be re-computed during SAVE.
+              */
+              char flag_outside=0;
+              for (j= 1; j < i; j++) {
+                /* not for 1D variables with Bin=1 such as PixelID, NCOUNT, Intensity */
+                if (Vars->Coord_Bin[j] <= 1) continue; 
+                if (0 > Coord_Index[j] || Coord_Index[j] >= Vars->Coord_Bin[j]) { 
+                  flag_outside=1; XY=0; break;
+                }
+                XY += Coord_Index[j]*Vars->Coord_BinProd[j-1];
+              }
+              if (Vars->Flag_mantid && Vars->Flag_OFF && Vars->OFF_polyidx >=0) XY=Vars->OFF_polyidx;
+              if (!flag_outside) XY += Vars->Coord_Min[i];
             }
-            XY += Coord_Index[j]*Vars->Coord_BinProd[j-1];
-          }
-	  if (Vars->Flag_mantid && Vars->Flag_OFF && Vars->OFF_polyidx >=0) XY=Vars->OFF_polyidx;
-          if (!flag_outside) XY += Vars->Coord_Min[i];
+            break;
         }
         
         /* handle 'abs' and 'log' keywords */
@@ -1383,8 +1516,7 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
         /* check bounds for variables which have no automatic limits */
           if ((!Vars->Flag_Auto_Limits || !(Vars->Coord_Type[i] & DEFS->COORD_AUTO)) && Vars->Coord_Bin[i]>1)
           { /* compute index in histograms for each variable to monitor */
-            XY = (Vars->Coord_Max[i]-Vars->Coord_Min[i]);
-            if (XY > 0) Coord_Index[i] = floor((Coord[i]-Vars->Coord_Min[i])*Vars->Coord_Bin[i]/XY);
+            if (Vars->Coord_Scale[i] > 0) Coord_Index[i] = floor((Coord[i]-Vars->Coord_Min[i])*Vars->Coord_Scale[i]);
             if (Vars->Flag_With_Borders)
             {
               if (Coord_Index[i] >= Vars->Coord_Bin[i]) Coord_Index[i] = Vars->Coord_Bin[i] - 1;
@@ -1455,6 +1587,12 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
     
     if (Vars->Flag_Auto_Limits != 2 && !outsidebounds) /* not when reading auto limits Buffer */
     { /* now store Coord into Buffer (no index needed) if necessary (list or auto limits) */
+    #ifndef OPENACC
+      /* streamed list: write the full Buffer (auto limits are done) and re-use it */
+      if (Vars->Flag_Stream && (Vars->Buffer_Counter >= Vars->Buffer_Block) && !Vars->Flag_Auto_Limits)
+        Monitor_nD_Stream(Vars);
+      if (Vars->Flag_Stream) ParticleCount = Vars->Buffer_Counter;
+    #endif
       if ((Vars->Buffer_Counter < Vars->Buffer_Block) && ((Vars->Flag_List) || (Vars->Flag_Auto_Limits == 1)))
       {
         for (i = 0; i <= Vars->Coord_Number; i++)
@@ -1465,6 +1603,12 @@ int Monitor_nD_Trace(MonitornD_Defines_type *DEFS, MonitornD_Variables_type *Var
         }
 	#pragma acc atomic 
         Vars->Buffer_Counter = Vars->Buffer_Counter + 1;
+        if (Vars->Flag_Auto_Limits == 1) /* CPU only */
+          for (i = 1; i <= Vars->Coord_Number; i++)
+          {
+            if (Coord[i] < Vars->Auto_Min[i]) Vars->Auto_Min[i] = Coord[i];
+            if (Coord[i] > Vars->Auto_Max[i]) Vars->Auto_Max[i] = Coord[i];
+          }
         if (Vars->Flag_Verbose && (Vars->Buffer_Counter >= Vars->Buffer_Block) && (Vars->Flag_List == 1)) 
           printf("Monitor_nD: %s %li neutrons stored in List.\n", Vars->compcurname, Vars->Buffer_Counter);
       }
@@ -1533,15 +1677,11 @@ MCDETECTOR Monitor_nD_Save(MonitornD_Defines_type *DEFS, MonitornD_Variables_typ
       for (i = 1; i <= Vars->Coord_Number; i++)
       {
         if ((Vars->Coord_Type[i] & DEFS->COORD_AUTO) && Vars->Coord_Bin[i] > 1)
-        {
-          Vars->Coord_Min[i] = FLT_MAX;
-          Vars->Coord_Max[i] = -FLT_MAX;
-          for (j = 0; j < Vars->Buffer_Counter; j++)
-          {
-            XY = Vars->Mon2D_Buffer[i+j*(Vars->Coord_Number+1)];  /* scanning variables in Buffer */
-            if (XY < Vars->Coord_Min[i]) Vars->Coord_Min[i] = XY;
-            if (XY > Vars->Coord_Max[i]) Vars->Coord_Max[i] = XY;
-          }
+        { /* limits of the Buffer, gathered while storing it */
+          Vars->Coord_Min[i] = Vars->Auto_Min[i];
+          Vars->Coord_Max[i] = Vars->Auto_Max[i];
+          XY = Vars->Coord_Max[i]-Vars->Coord_Min[i];
+          Vars->Coord_Scale[i] = (Vars->Coord_Bin[i] > 1 && XY > 0) ? Vars->Coord_Bin[i]/XY : 0;
           if  (Vars->Flag_Verbose)  
             printf("  %s: min=%g max=%g in %li bins\n", Vars->Coord_Var[i], Vars->Coord_Min[i], Vars->Coord_Max[i], Vars->Coord_Bin[i]);
         }
@@ -1666,6 +1806,15 @@ MCDETECTOR Monitor_nD_Save(MonitornD_Defines_type *DEFS, MonitornD_Variables_typ
     if (strlen(Vars->Mon_File) > 0)
     {
       fname = (char*)malloc(strlen(Vars->Mon_File)+10*Vars->Coord_Number);
+      if (Vars->Flag_Stream) /* streamed List: write remaining events, 0D summary */
+      {
+        Monitor_nD_Stream(Vars);
+        if (Vars->Stream_File) fflush(Vars->Stream_File);
+        if (Vars->Flag_Verbose) printf("Monitor_nD: %s streamed %llu events.\n", Vars->compcurname, Vars->Stream_Events);
+        if (!Vars->Flag_Multiple && Vars->Coord_NumberNoPixel != 2)
+          detector = mcdetector_out_0D(Vars->Monitor_Label, Vars->Nsum, Vars->psum, Vars->p2sum, Vars->compcurname, Vars->compcurpos, Vars->compcurrot,Vars->compcurindex);
+      }
+      else
       if (Vars->Flag_List && Vars->Mon2D_Buffer) /* List: DETECTOR_OUT_2D */
       {
        
@@ -1905,6 +2054,8 @@ void Monitor_nD_Finally(MonitornD_Defines_type *DEFS,
     { /* Dim : (Vars->Coord_Number+1)*Vars->Buffer_Block matrix (for p, dp) */
       if (Vars->Mon2D_Buffer != NULL) free(Vars->Mon2D_Buffer);
     }
+    if (Vars->Stream_File)   fclose(Vars->Stream_File);
+    if (Vars->Stream_Column) free(Vars->Stream_Column);
 
     /* 1D and n1D case : Vars->Flag_Multiple */
     if (Vars->Flag_Multiple && Vars->Coord_Number)
@@ -18,6 +18,13 @@
 * This file is to be imported by the monitor_nd related components
 * It handles some shared functions.
 *
+* Streamed event lists ('list all stream' option, CPU only) are written per
+* process in <file>_list.bin (<file>_list.bin.<rank> with MPI), as:
+*   char[8] "MCNDLIST", int32 version (1), int32 columns, int32 value size
+*   (4=float with 'binary'/'float' option, 8=double), columns*char[32] names,
+* then any number of blocks: int64 n, followed by the n values of each column
+* in turn. All integers and values are in the native byte order.
+*
 * Usage: within SHARE
 * %include "monitor_nd-lib"
 *
@@ -27,6 +34,9 @@
 
 #define MONITOR_ND_LIB_H "$Revision$"
 #define MONnD_COORD_NMAX  30  /* max number of variables to record */
+#ifndef MONnD_STREAM_BLOCK
+#define MONnD_STREAM_BLOCK 1048576 /* max events per block of a streamed list */
+#endif
 
   typedef struct MonitornD_Defines
   {
@@ -112,6 +122,30 @@
 
   } MonitornD_Defines_type;
 
+  /* Extractor of each monitored variable, set from Coord_Type by
+     Monitor_nD_Compile, so that Monitor_nD_Trace reads the neutron state
+     through a single switch on constants (a jump table, which unlike an array
+     of function pointers is also available on GPU). */
+  enum MonitornD_Extractor
+  {
+    MONnD_GET_NONE=0,
+    MONnD_GET_X, MONnD_GET_Y, MONnD_GET_Z,
+    MONnD_GET_VX, MONnD_GET_VY, MONnD_GET_VZ,
+    MONnD_GET_KX, MONnD_GET_KY, MONnD_GET_KZ,
+    MONnD_GET_SX, MONnD_GET_SY, MONnD_GET_SZ,
+    MONnD_GET_T, MONnD_GET_P,
+    MONnD_GET_USERDOUBLE,     /* UserDoubles[Coord_Arg] */
+    MONnD_GET_HDIV, MONnD_GET_VDIV,
+    MONnD_GET_V, MONnD_GET_RADIUS,
+    MONnD_GET_XY, MONnD_GET_YZ, MONnD_GET_XZ,
+    MONnD_GET_VXY, MONnD_GET_VXZ, MONnD_GET_VYZ,
+    MONnD_GET_K, MONnD_GET_KXY, MONnD_GET_KXZ, MONnD_GET_KYZ,
+    MONnD_GET_ENERGY, MONnD_GET_LAMBDA,
+    MONnD_GET_NCOUNT, MONnD_GET_ANGLE, MONnD_GET_THETA, MONnD_GET_PHI,
+    MONnD_GET_USER,           /* particle_getvar(UserVariable<Coord_Arg>) */
+    MONnD_GET_PIXELID
+  };
+
   typedef struct MonitornD_Variables
   {
     double area;
@@ -128,6 +162,7 @@
     char   Flag_log          ;   /* log10 of the flux */
     char   Flag_parallel     ;   /* set neutron state back after detection (parallel components) */
     char   Flag_Binary_List  ;
+    char   Flag_Stream       ;   /* write 'list all' blocks to Stream_File from TRACE */
     char   Flag_capture      ;   /* lambda monitor with lambda/lambda(2200m/s = 1.7985 Angs) weightening */
     int    Flag_signal       ;   /* 0:monitor p, else monitor a mean value */
     int    Flag_mantid       ;   /* 0:normal monitor, else do mantid-event specifics */
@@ -140,6 +175,9 @@
     long long Neutron_Counter   ;   /* event counter, simulation total counts is mcget_ncount() */
     unsigned long Buffer_Counter    ;   /* index in Buffer size (for realloc) */
     unsigned long Buffer_Size       ;
+    FILE  *Stream_File       ;   /* streamed list output, see Monitor_nD_Stream */
+    char  *Stream_Column     ;   /* one column of a block, as written */
+    unsigned long long Stream_Events; /* events written to Stream_File */
     int    Coord_Type[MONnD_COORD_NMAX];      /* type of variable */
     char   Coord_Label[MONnD_COORD_NMAX][30]; /* label of variable */
     char   Coord_Var[MONnD_COORD_NMAX][30];   /* short id of variable */
@@ -147,6 +185,11 @@
     long   Coord_BinProd[MONnD_COORD_NMAX];   /* product of bins of variable array */
     double Coord_Min[MONnD_COORD_NMAX];
     double Coord_Max[MONnD_COORD_NMAX];
+    int    Coord_Extract[MONnD_COORD_NMAX];   /* enum MonitornD_Extractor */
+    int    Coord_Arg[MONnD_COORD_NMAX];       /* user variable index */
+    double Coord_Scale[MONnD_COORD_NMAX];     /* Coord_Bin/(Coord_Max-Coord_Min), 0: no binning */
+    double Auto_Min[MONnD_COORD_NMAX];        /* running limits of the events stored for auto limits */
+    double Auto_Max[MONnD_COORD_NMAX];
     char   Monitor_Label[MONnD_COORD_NMAX*30];/* Label for monitor */
     char   Mon_File[128];                     /* output file name */
 
@@ -190,8 +233,10 @@
 /* ========================================================================= */
 
 void Monitor_nD_Init(MonitornD_Defines_type *, MonitornD_Variables_type *, MCNUM, MCNUM, MCNUM, MCNUM, MCNUM, MCNUM, MCNUM, MCNUM, MCNUM, int);
+void Monitor_nD_Compile(MonitornD_Defines_type *, MonitornD_Variables_type *);
 #pragma acc routine
 int Monitor_nD_Trace(MonitornD_Defines_type *, MonitornD_Variables_type *, _class_particle* _particle);
+void Monitor_nD_Stream(MonitornD_Variables_type *);
 MCDETECTOR Monitor_nD_Save(MonitornD_Defines_type *, MonitornD_Variables_type *);
 void Monitor_nD_Finally(MonitornD_Defines_type *, MonitornD_Variables_type *);
 void Monitor_nD_McDisplay(MonitornD_Defines_type *, MonitornD_Variables_type *);
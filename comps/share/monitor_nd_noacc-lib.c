@@ -774,6 +774,30 @@ void Monitor_nd_noaccInit(Monitornd_noaccDefines_type *DEFS,
     Vars->p2sum = 0;
     Vars->Nsum  = 0;
 
+    /* accumulators written in checkpoints and restored by --resume */
+    {
+      char name[256];
+      long k;
+      sprintf(name, "%s.Nsum",  Vars->compcurname); mccheckpoint_add(name, &Vars->Nsum,  sizeof(Vars->Nsum));
+      sprintf(name, "%s.psum",  Vars->compcurname); mccheckpoint_add(name, &Vars->psum,  sizeof(Vars->psum));
+      sprintf(name, "%s.p2sum", Vars->compcurname); mccheckpoint_add(name, &Vars->p2sum, sizeof(Vars->p2sum));
+      sprintf(name, "%s.Neutron_Counter", Vars->compcurname);
+      mccheckpoint_add(name, &Vars->Neutron_Counter, sizeof(Vars->Neutron_Counter));
+      if (Vars->Mon2D_N && Vars->Flag_Multiple) {
+        for (k = 0; k < Vars->Coord_Number; k++) {
+          sprintf(name, "%s.Mon2D_N",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_N[k],  Vars->Coord_Bin[k+1]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p[k],  Vars->Coord_Bin[k+1]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p2", Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p2[k], Vars->Coord_Bin[k+1]*sizeof(double));
+        }
+      } else if (Vars->Mon2D_N) {
+        for (k = 0; k < Vars->Coord_Bin[1]; k++) {
+          sprintf(name, "%s.Mon2D_N",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_N[k],  Vars->Coord_Bin[2]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p",  Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p[k],  Vars->Coord_Bin[2]*sizeof(double));
+          sprintf(name, "%s.Mon2D_p2", Vars->compcurname); mccheckpoint_add(name, Vars->Mon2D_p2[k], Vars->Coord_Bin[2]*sizeof(double));
+        }
+      }
+    }
+
     Vars->area  = fabs(Vars->mxmax - Vars->mxmin)*fabs(Vars->mymax - Vars->mymin)*1E4; /* in cm**2 for square and box shapes */
     Vars->Sphere_Radius = fabs(Vars->mxmax - Vars->mxmin)/2;
     if ((abs(Vars->Flag_Shape) == DEFS->SHAPE_DISK) || (abs(Vars->Flag_Shape) == DEFS->SHAPE_SPHERE))
@@ -0,0 +1,261 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/sasview_table-lib.c
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the SasView_model component.
+* See sasview_table-lib.h.
+*
+* Usage: within SHARE, after sasview_proxy.c
+* %include "sasview_table-lib"
+*
+*******************************************************************************/
+
+#ifndef SASVIEW_TABLE_LIB_H
+#error McStas : please import this library with %include "sasview_table-lib"
+#endif
+
+/*****************************************************************************
+ * sasview_table_dims: returns 1 when the kernel only depends on q,
+ *   2 when it only depends on (qx,qy) (oriented models), 0 otherwise.
+ *   Arguments which are not used by a kernel give exactly the same result.
+ ****************************************************************************/
+static int sasview_table_dims(sasview_iq_function iq, double *pars, double qmax)
+{
+  int    k;
+  int    dims = 1;
+  double q;
+  float  value;
+
+  for (k = 1; k <= 4 && dims == 1; k++) {
+    q     = qmax*k/5;
+    value = iq(q, 0.6*q, 0.8*q, pars);
+    if (iq(q, -0.28*q, 0.96*q, pars) != value || iq(q, 0, 0, pars) != value)
+      dims = 2;
+  }
+  for (k = 1; k <= 4 && dims == 2; k++) {
+    q = qmax*k/5;
+    if (iq(q, 0.6*q, 0.8*q, pars) != iq(q/2, 0.6*q, 0.8*q, pars))
+      dims = 0;
+  }
+  return(dims);
+}
+
+/*****************************************************************************
+ * sasview_table_add: appends (q, value) to a 1D table of allocated size *size
+ ****************************************************************************/
+static void sasview_table_add(struct sasview_table *table, long *size, double q, double value)
+{
+  if (table->n >= *size) {
+    *size = *size ? 2*(*size) : 1024;
+    table->q  = (double*)realloc(table->q,  *size*sizeof(double));
+    table->iq = (double*)realloc(table->iq, *size*sizeof(double));
+    if (!table->q || !table->iq)
+      exit(fprintf(stderr, "Error: Out of memory %li (sasview_table_add)\n", *size));
+  }
+  table->q[table->n]  = q;
+  table->iq[table->n] = value;
+  table->n++;
+}
+
+/*****************************************************************************
+ * sasview_table_refine: appends the points of ]a,b] to a 1D table, bisecting
+ *   the interval as long as the kernel at its quarter points differs from the
+ *   linear interpolation between a and b by more than the tolerance relative
+ *   to the largest value in the interval. Testing the middle alone misses
+ *   oscillations which are symmetric in the interval. The relative scale
+ *   avoids endless bisection around the zeros of form factors.
+ ****************************************************************************/
+static void sasview_table_refine(struct sasview_table *table, long *size,
+  sasview_iq_function iq, double *pars,
+  double a, double fa, double b, double fb, double tolerance, int depth)
+{
+  double m  = (a+b)/2,    fm = iq(m, m, 0, pars);
+  double q1 = (a+m)/2,    f1 = iq(q1, q1, 0, pars);
+  double q3 = (m+b)/2,    f3 = iq(q3, q3, 0, pars);
+  double scale = fmax(fmax(fabs(fa), fabs(fb)), fmax(fabs(fm), fmax(fabs(f1), fabs(f3))));
+  double err   = fmax(fabs(fm - (fa+fb)/2),
+                 fmax(fabs(f1 - (3*fa+fb)/4), fabs(f3 - (fa+3*fb)/4)));
+
+  /* the kernel takes q as a float: do not bisect below its resolution */
+  if (depth < SASVIEW_TABLE_MAXDEPTH && table->n < SASVIEW_TABLE_MAXPOINTS
+   && (float)q1 != (float)a && (float)q3 != (float)b
+   && err > tolerance*scale + FLT_MIN) {
+    sasview_table_refine(table, size, iq, pars, a, fa, m, fm, tolerance, depth+1);
+    sasview_table_refine(table, size, iq, pars, m, fm, b, fb, tolerance, depth+1);
+  } else {
+    sasview_table_add(table, size, q1, f1);
+    sasview_table_add(table, size, m,  fm);
+    sasview_table_add(table, size, q3, f3);
+    sasview_table_add(table, size, b,  fb);
+  }
+}
+
+/*****************************************************************************
+ * sasview_table_init: tabulates the kernel iq for the given parameters,
+ *   up to qmax [1/Angs] with the given relative tolerance.
+ *   returns the table dimension, 0 when the kernel is evaluated in TRACE.
+ ****************************************************************************/
+int sasview_table_init(struct sasview_table *table, sasview_iq_function iq,
+                       double *pars, double qmax, double tolerance, char *name)
+{
+  long   i, j, k;
+  long   size = 0;
+  double err  = 0;
+
+  table->dims = 0;
+  table->n    = 0;
+  table->qmax = qmax;
+  table->step = 0;
+  table->q    = NULL;
+  table->iq   = NULL;
+  if (tolerance <= 0 || qmax <= 0) return(0);
+
+#ifdef OPENACC
+  printf("SasView_model: %s: I(q) tables are not available on GPU. Evaluating the model.\n", name);
+  return(0);
+#endif
+
+  table->dims = sasview_table_dims(iq, pars, qmax);
+  if (table->dims == 1) {
+    /* log spaced initial intervals on [qmax/1024, qmax], then bisection */
+    double qmin = qmax/1024, a, b, fa, fb;
+    a  = qmin;
+    fa = iq(a, a, 0, pars);
+    sasview_table_add(table, &size, a, fa);
+    for (k = 1; k <= 256; k++) {
+      b  = qmin*pow(1024, k/256.0);
+      fb = iq(b, b, 0, pars);
+      sasview_table_refine(table, &size, iq, pars, a, fa, b, fb, tolerance, 0);
+      a = b; fa = fb;
+    }
+    if (table->n >= SASVIEW_TABLE_MAXPOINTS)
+      printf("SasView_model: %s: I(q) table limited to %li points. Tolerance %g may not be reached.\n",
+        name, table->n, tolerance);
+  } else if (table->dims == 2) {
+    /* regular grid on [-qmax,qmax]^2, doubled until the new points match
+       the bilinear interpolation of the previous grid */
+    long    n = 65, n2;
+    double *grid, *fine, qx, qy, v, c[4], interp, scale;
+
+    table->step = 2*qmax/(n-1);
+    grid = (double*)malloc(n*n*sizeof(double));
+    if (!grid) exit(fprintf(stderr, "Error: Out of memory %li (sasview_table_init)\n", n*n));
+    for (i = 0; i < n; i++)
+      for (j = 0; j < n; j++) {
+        qx = -qmax+i*table->step; qy = -qmax+j*table->step;
+        grid[i*n+j] = iq(sqrt(qx*qx+qy*qy), qx, qy, pars);
+      }
+    do {
+      n2 = 2*n-1;
+      if (n2*n2 > SASVIEW_TABLE_MAXPOINTS) {
+        printf("SasView_model: %s: I(qx,qy) table limited to %lix%li points. Tolerance %g not reached (%g).\n",
+          name, n, n, tolerance, err);
+        break;
+      }
+      fine = (double*)malloc(n2*n2*sizeof(double));
+      if (!fine) exit(fprintf(stderr, "Error: Out of memory %li (sasview_table_init)\n", n2*n2));
+      table->step /= 2;
+      err = 0;
+      for (i = 0; i < n2; i++)
+        for (j = 0; j < n2; j++) {
+          if (!(i%2) && !(j%2)) { fine[i*n2+j] = grid[(i/2)*n+j/2]; continue; }
+          qx = -qmax+i*table->step; qy = -qmax+j*table->step;
+          v  = fine[i*n2+j] = iq(sqrt(qx*qx+qy*qy), qx, qy, pars);
+          c[0] = grid[(i/2)*n+j/2];     c[1] = grid[((i+1)/2)*n+(j+1)/2];
+          c[2] = grid[((i+1)/2)*n+j/2]; c[3] = grid[(i/2)*n+(j+1)/2];
+          interp = (c[0] + c[1] + c[2] + c[3])/4;
+          /* error relative to the largest value in the cell, as in 1D */
+          scale = fmax(fabs(v), fmax(fmax(fabs(c[0]), fabs(c[1])), fmax(fabs(c[2]), fabs(c[3]))));
+          if (fabs(v - interp) > tolerance*scale + FLT_MIN
+           && fabs(v - interp)/scale > err)
+            err = fabs(v - interp)/scale;
+        }
+      free(grid);
+      grid = fine;
+      n    = n2;
+    } while (err);
+    table->n  = n;
+    table->iq = grid;
+  }
+
+  /* a kernel diverging in the tabulated range can not be interpolated */
+  for (i = 0; table->dims && i < (table->dims == 1 ? table->n : table->n*table->n); i++)
+    if (!isfinite(table->iq[i])) {
+      printf("SasView_model: %s: model is not finite for q up to %g 1/Angs. Evaluating the model.\n", name, qmax);
+      sasview_table_free(table);
+      return(0);
+    }
+  if (table->dims == 1)
+    printf("SasView_model: %s: tabulated I(q) with %li points for q in [%g,%g] 1/Angs.\n",
+      name, table->n, table->q[0], qmax);
+  else if (table->dims == 2)
+    printf("SasView_model: %s: tabulated I(qx,qy) with %lix%li points for qx,qy in [%g,%g] 1/Angs.\n",
+      name, table->n, table->n, -qmax, qmax);
+  else
+    printf("SasView_model: %s: model depends on both q and (qx,qy). Evaluating the model.\n", name);
+  return(table->dims);
+} /* sasview_table_init */
+
+/*****************************************************************************
+ * sasview_table_interpolate: sets *value to the interpolated kernel.
+ *   returns 0 when (q,qx,qy) is outside of the table, which must then be
+ *   evaluated directly.
+ ****************************************************************************/
+#pragma acc routine seq
+int sasview_table_interpolate(struct sasview_table *table,
+                              double q, double qx, double qy, double *value)
+{
+  long   lo, hi, mid, i, j;
+  double x, y, *g;
+
+  if (table->dims == 1) {
+    if (q < table->q[0] || q > table->q[table->n-1]) return(0);
+    lo = 0; hi = table->n-1;
+    while (hi - lo > 1) {
+      mid = (lo+hi)/2;
+      if (table->q[mid] > q) hi = mid; else lo = mid;
+    }
+    *value = table->iq[lo] + (table->iq[hi]-table->iq[lo])
+                            *(q-table->q[lo])/(table->q[hi]-table->q[lo]);
+    return(1);
+  }
+  if (table->dims == 2) {
+    x = (qx + table->qmax)/table->step;
+    y = (qy + table->qmax)/table->step;
+    if (x < 0 || y < 0 || x > table->n-1 || y > table->n-1) return(0);
+    i = (long)x; if (i > table->n-2) i = table->n-2;
+    j = (long)y; if (j > table->n-2) j = table->n-2;
+    x -= i; y -= j;
+    g  = table->iq + i*table->n + j;
+    *value = (1-x)*((1-y)*g[0]         + y*g[1])
+           +    x *((1-y)*g[table->n] + y*g[table->n+1]);
+    return(1);
+  }
+  return(0);
+} /* sasview_table_interpolate */
+
+/*****************************************************************************
+ * sasview_table_free: frees the table, which then evaluates the kernel
+ ****************************************************************************/
+void sasview_table_free(struct sasview_table *table)
+{
+  if (table->q)  free(table->q);
+  if (table->iq) free(table->iq);
+  table->q    = table->iq = NULL;
+  table->dims = 0;
+  table->n    = 0;
+} /* sasview_table_free */
+
+/* end of sasview_table-lib.c */
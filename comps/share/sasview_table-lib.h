@@ -0,0 +1,70 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/sasview_table-lib.h
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the SasView_model component.
+* It tabulates the scattering kernel getIq() of the selected SasView model
+* in INITIALIZE, as the sample parameters are fixed for the run, so that
+* TRACE only interpolates the table:
+*   - models depending on |q| only get a 1D table I(q) on [qmax/1024,qmax],
+*     refined by interval bisection until the linear interpolation matches
+*     the kernel within the requested relative tolerance,
+*   - oriented models depending on (qx,qy) get a regular 2D grid on
+*     [-qmax,qmax]^2, doubled until the bilinear interpolation matches the
+*     kernel at the new grid points within the tolerance, relative to the
+*     largest value of their cell.
+* Outside of the tabulated range, the kernel is evaluated directly.
+* Tables are CPU only: on GPU the kernel is always evaluated.
+*
+* Usage: within SHARE, after sasview_proxy.c
+* %include "sasview_table-lib"
+*
+*******************************************************************************/
+
+#ifndef SASVIEW_TABLE_LIB_H
+#define SASVIEW_TABLE_LIB_H "$Revision$"
+
+/* largest number of points of a table (1D), or of a grid (2D) */
+#ifndef SASVIEW_TABLE_MAXPOINTS
+#define SASVIEW_TABLE_MAXPOINTS 1048576
+#endif
+/* largest number of bisections of an initial 1D interval */
+#ifndef SASVIEW_TABLE_MAXDEPTH
+#define SASVIEW_TABLE_MAXDEPTH  16
+#endif
+
+/* the SasView kernel, e.g. getIq from sasview_proxy.c */
+typedef float (*sasview_iq_function)(float q, float qx, float qy, double pars[15]);
+
+struct sasview_table
+{
+  int     dims;   /* 0: no table, 1: I(q), 2: I(qx,qy) */
+  long    n;      /* 1D: number of q values, 2D: number of points per axis */
+  double  qmax;   /* 1D: q in [0,qmax], 2D: qx and qy in [-qmax,qmax] */
+  double  step;   /* 2D: grid step */
+  double *q;      /* 1D: increasing q values */
+  double *iq;     /* 1D: I(q[i]), 2D: I(qx_i,qy_j) stored at [i*n+j] */
+};
+
+int  sasview_table_init(struct sasview_table *table, sasview_iq_function iq,
+                        double *pars, double qmax, double tolerance, char *name);
+#pragma acc routine seq
+int  sasview_table_interpolate(struct sasview_table *table,
+                               double q, double qx, double qy, double *value);
+void sasview_table_free(struct sasview_table *table);
+
+#endif
+
+/* end of sasview_table-lib.h */
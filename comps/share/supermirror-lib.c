@@ -1403,7 +1403,7 @@ int add_neutron_record(double w, double t, Coords p, Coords v, Coords s, Supermi
 
 	//save data
 	nr = &((proc->nr)[i_nr]);
-	nr->nr_n = mcrun_num;
+	nr->nr_n = mcget_run_num();
 	nr->nr_w = w;
 	nr->nr_t = t;
 	nr->nr_p = p;
@@ -3784,7 +3784,7 @@ int StdSupermirrorFlat(
 	SimState state;
 	sm_initialise_state(&state);
 	
-	state.ray_count = mcrun_num;
+	state.ray_count = mcget_run_num();
 	
 	state.w = *w_sm; 
 	state.t = *t_sm; 
@@ -0,0 +1,223 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/sx_refl-lib.c
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the Single_crystal related components.
+* See sx_refl-lib.h.
+*
+* Usage: within SHARE
+* %include "sx_refl-lib"
+*
+*******************************************************************************/
+
+#ifndef SX_REFL_LIB_H
+#error McStas : please import this library with %include "sx_refl-lib"
+#endif
+
+/* ------------------------------------------------------------------------ */
+/* sx_refl_soa_alloc: allocate the arrays of a SoA reflection list.
+   returns count, or 0 when out of memory (the list is then left empty) */
+int sx_refl_soa_alloc(struct sx_refl_soa *s, int count)
+{
+  double *block;
+  int     n = (count > 0 ? count : 1);
+
+  /* a single block holds all 19 arrays */
+  block = (double*)malloc(19*n*sizeof(double));
+  s->count = 0;
+  s->tau_x = block;
+  if (!block) return 0;
+  s->tau_y  = block +  1*n; s->tau_z = block +  2*n; s->tau = block +  3*n;
+  s->u1x    = block +  4*n; s->u1y   = block +  5*n; s->u1z = block +  6*n;
+  s->u2x    = block +  7*n; s->u2y   = block +  8*n; s->u2z = block +  9*n;
+  s->u3x    = block + 10*n; s->u3y   = block + 11*n; s->u3z = block + 12*n;
+  s->m1     = block + 13*n; s->m2    = block + 14*n; s->m3  = block + 15*n;
+  s->sig123 = block + 16*n; s->F2    = block + 17*n; s->cutoff = block + 18*n;
+  s->count  = count;
+  return count;
+} /* sx_refl_soa_alloc */
+
+/* ------------------------------------------------------------------------ */
+/* sx_refl_soa_free: release the arrays of a SoA reflection list */
+void sx_refl_soa_free(struct sx_refl_soa *s)
+{
+  if (s->tau_x) free(s->tau_x);
+  s->tau_x = NULL;
+  s->count = 0;
+} /* sx_refl_soa_free */
+
+/* ------------------------------------------------------------------------ */
+/* sx_exp: exp(x) with a branch-free range reduction and polynomial, so that
+   the lane loops in sx_refl_eval vectorise. Relative error is below 1e-15. */
+static inline double sx_exp(double x)
+{
+  union { double d; long long i; } scale;
+  double k, r, p;
+
+  if (x < -708) x = -708;
+  if (x >  709) x =  709;
+  /* x = k*ln2 + r, |r| <= ln2/2 */
+  k = floor(x*1.4426950408889634 + 0.5);
+  r = x - k*6.93147180369123816490e-01 - k*1.90821492927058770002e-10;
+  /* Taylor series up to r^12 */
+  p = 1.0/479001600;
+  p = p*r + 1.0/39916800;
+  p = p*r + 1.0/3628800;
+  p = p*r + 1.0/362880;
+  p = p*r + 1.0/40320;
+  p = p*r + 1.0/5040;
+  p = p*r + 1.0/720;
+  p = p*r + 1.0/120;
+  p = p*r + 1.0/24;
+  p = p*r + 1.0/6;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+  /* 2^k assembled in the exponent bits */
+  scale.i = ((long long)k + 1023) << 52;
+  return p*scale.d;
+} /* sx_exp */
+
+/* ------------------------------------------------------------------------ */
+/* sx_refl_filter
+  test the candidates [*pos, last) against the Ewald sphere of ki.
+  Candidate k is reflection idx[k], or k itself when idx is NULL.
+  Reflections within their Gaussian cutoff and with tau <= tau_max are
+  appended to hits, up to max_hits; *pos is advanced past the last tested
+  candidate so that the scan can be resumed.
+  returns the number of hits.
+ */
+int sx_refl_filter(struct sx_refl_soa *s, const int *idx, int *pos, int last,
+       double kix, double kiy, double kiz, double ki, double tau_max,
+       int *hits, int max_hits)
+{
+  int k = *pos, nh = 0;
+
+  while (k < last && nh < max_hits) {
+    int  lane, width = (last - k < SX_SIMD_WIDTH ? last - k : SX_SIMD_WIDTH);
+    char keep[SX_SIMD_WIDTH];
+
+    if (idx) {
+      #pragma omp simd
+      for (lane = 0; lane < width; lane++) {
+        int    i = idx[k+lane];
+        double rho_x = kix - s->tau_x[i];
+        double rho_y = kiy - s->tau_y[i];
+        double rho_z = kiz - s->tau_z[i];
+        double rho   = sqrt(rho_x*rho_x + rho_y*rho_y + rho_z*rho_z);
+        keep[lane] = (fabs(rho - ki) <= s->cutoff[i]) & (s->tau[i] <= tau_max);
+      }
+    } else {
+      /* contiguous candidates: unit-stride loads */
+      #pragma omp simd
+      for (lane = 0; lane < width; lane++) {
+        double rho_x = kix - s->tau_x[k+lane];
+        double rho_y = kiy - s->tau_y[k+lane];
+        double rho_z = kiz - s->tau_z[k+lane];
+        double rho   = sqrt(rho_x*rho_x + rho_y*rho_y + rho_z*rho_z);
+        keep[lane] = (fabs(rho - ki) <= s->cutoff[k+lane]) & (s->tau[k+lane] <= tau_max);
+      }
+    }
+    for (lane = 0; lane < width; lane++) {
+      if (keep[lane]) {
+        hits[nh++] = (idx ? idx[k+lane] : k+lane);
+        if (nh == max_hits) { lane++; break; }
+      }
+    }
+    k += lane;
+  }
+  *pos = k;
+  return nh;
+} /* sx_refl_filter */
+
+/* ------------------------------------------------------------------------ */
+/* sx_refl_eval
+  compute the tangent plane, 2D Gauss projection and scattering intensity for
+  n <= SX_SIMD_WIDTH reflections already accepted by sx_refl_filter. This is
+  the per-reflection body of hkl_search, with normal_vec made branch-free.
+ */
+void sx_refl_eval(struct sx_refl_soa *s, const int *hits, int n,
+       double kix, double kiy, double kiz, double ki, double xsect_factor,
+       struct sx_tau_lanes *out)
+{
+  int m;
+
+  #pragma omp simd
+  for (m = 0; m < n; m++) {
+    int    i = hits[m];
+    double m1 = s->m1[i], m2 = s->m2[i], m3 = s->m3[i];
+    double rho_x, rho_y, rho_z, rho, nx, ny, nz, ax, ay, az;
+    double ox, oy, oz, b1x, b1y, b1z, b2x, b2y, b2z, l;
+    double n11, n12, n22, det_N, inv_n11, inv_n12, inv_n22;
+    double l11, l12, l22, Bt_D_O_x, Bt_D_O_y, y0x, y0y, alpha;
+    int    use_x, use_y;
+
+    rho_x = kix - s->tau_x[i];
+    rho_y = kiy - s->tau_y[i];
+    rho_z = kiz - s->tau_z[i];
+    rho   = sqrt(rho_x*rho_x + rho_y*rho_y + rho_z*rho_z);
+    /* ki vector in local coordinates */
+    rho_x = kix*s->u1x[i] + kiy*s->u1y[i] + kiz*s->u1z[i] - s->tau[i];
+    rho_y = kix*s->u2x[i] + kiy*s->u2y[i] + kiz*s->u2z[i];
+    rho_z = kix*s->u3x[i] + kiy*s->u3y[i] + kiz*s->u3z[i];
+    /* tangent plane of the Ewald sphere */
+    nx = rho_x/rho; ny = rho_y/rho; nz = rho_z/rho;
+    ox = (ki - rho)*nx; oy = (ki - rho)*ny; oz = (ki - rho)*nz;
+    /* b1 = normal_vec(n): drop the smallest component of n */
+    ax = fabs(nx); ay = fabs(ny); az = fabs(nz);
+    use_x = (ax < ay) & (ax < az);
+    use_y = !(ax < ay) & (ay < az);
+    b1x = (use_x ? 0   : (use_y ? nz  : ny));
+    b1y = (use_x ? nz  : (use_y ? 0   : -nx));
+    b1z = (use_x ? -ny : (use_y ? -nx : 0));
+    l   = sqrt(b1x*b1x + b1y*b1y + b1z*b1z);
+    b1x /= l; b1y /= l; b1z /= l;
+    /* b2 = n x b1 */
+    b2x = ny*b1z - nz*b1y;
+    b2y = nz*b1x - nx*b1z;
+    b2z = nx*b1y - ny*b1x;
+    /* 2D projection N of the 3D Gauss, its inverse and Cholesky factor */
+    n11 = m1*b1x*b1x + m2*b1y*b1y + m3*b1z*b1z;
+    n12 = m1*b1x*b2x + m2*b1y*b2y + m3*b1z*b2z;
+    n22 = m1*b2x*b2x + m2*b2y*b2y + m3*b2z*b2z;
+    det_N   = n11*n22 - n12*n12;
+    inv_n11 = n22/det_N;
+    inv_n12 = -n12/det_N;
+    inv_n22 = n11/det_N;
+    l11 = sqrt(inv_n11/2);
+    l12 = inv_n12/(2*l11);
+    l22 = sqrt(inv_n22/2 - l12*l12);
+    /* center of the 2D Gauss and its distance factor alpha */
+    Bt_D_O_x = b1x*m1*ox + b1y*m2*oy + b1z*m3*oz;
+    Bt_D_O_y = b2x*m1*ox + b2y*m2*oy + b2z*m3*oz;
+    y0x = -(Bt_D_O_x*inv_n11 + Bt_D_O_y*inv_n12);
+    y0y = -(Bt_D_O_x*inv_n12 + Bt_D_O_y*inv_n22);
+    alpha = m1*ox*ox + m2*oy*oy + m3*oz*oz -
+            (y0x*y0x*n11 + y0y*y0y*n22 + 2*y0x*y0y*n12);
+
+    out->index[m] = i;
+    out->rho_x[m] = rho_x; out->rho_y[m] = rho_y; out->rho_z[m] = rho_z;
+    out->rho[m]   = rho;
+    out->ox[m]  = ox;  out->oy[m]  = oy;  out->oz[m]  = oz;
+    out->b1x[m] = b1x; out->b1y[m] = b1y; out->b1z[m] = b1z;
+    out->b2x[m] = b2x; out->b2y[m] = b2y; out->b2z[m] = b2z;
+    out->l11[m] = l11; out->l12[m] = l12; out->l22[m] = l22;
+    out->y0x[m] = y0x; out->y0y[m] = y0y;
+    out->refl[m]  = xsect_factor*l11*l22*sx_exp(-alpha)/s->sig123[i];
+    out->xsect[m] = out->refl[m]*s->F2[i];
+  }
+} /* sx_refl_eval */
+
+/* end of sx_refl-lib.c */
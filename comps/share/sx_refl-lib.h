@@ -0,0 +1,95 @@
+/*******************************************************************************
+*
+* McStas, neutron ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Library: share/sx_refl-lib.h
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: McStas 3.x
+* Version: $Revision$
+*
+* This file is to be imported by the Single_crystal related components.
+* It holds a structure-of-arrays copy of the reflection list and a kernel
+* evaluating the Ewald sphere intersection of SX_SIMD_WIDTH reflections at
+* once, written so that the compiler can vectorise the lane loops.
+*
+* Usage: within SHARE
+* %include "sx_refl-lib"
+*
+*******************************************************************************/
+
+#ifndef SX_REFL_LIB_H
+#define SX_REFL_LIB_H "$Revision$"
+
+/* number of reflections evaluated together by sx_refl_eval */
+#ifndef SX_SIMD_WIDTH
+#define SX_SIMD_WIDTH 8
+#endif
+
+/* Reflection list as arrays, one per field of struct hkl_data. */
+struct sx_refl_soa
+  {
+    int     count;
+    double *tau_x, *tau_y, *tau_z, *tau;
+    double *u1x, *u1y, *u1z;
+    double *u2x, *u2y, *u2z;
+    double *u3x, *u3y, *u3z;
+    double *m1, *m2, *m3;
+    double *sig123, *F2, *cutoff;
+  };
+
+/* Output of sx_refl_eval, one lane per accepted reflection. Field names
+   follow struct tau_data so that SX_TAU_STORE can copy them by name. */
+struct sx_tau_lanes
+  {
+    int    index[SX_SIMD_WIDTH];
+    double refl[SX_SIMD_WIDTH], xsect[SX_SIMD_WIDTH];
+    double rho_x[SX_SIMD_WIDTH], rho_y[SX_SIMD_WIDTH], rho_z[SX_SIMD_WIDTH], rho[SX_SIMD_WIDTH];
+    double ox[SX_SIMD_WIDTH], oy[SX_SIMD_WIDTH], oz[SX_SIMD_WIDTH];
+    double b1x[SX_SIMD_WIDTH], b1y[SX_SIMD_WIDTH], b1z[SX_SIMD_WIDTH];
+    double b2x[SX_SIMD_WIDTH], b2y[SX_SIMD_WIDTH], b2z[SX_SIMD_WIDTH];
+    double l11[SX_SIMD_WIDTH], l12[SX_SIMD_WIDTH], l22[SX_SIMD_WIDTH];
+    double y0x[SX_SIMD_WIDTH], y0y[SX_SIMD_WIDTH];
+  };
+
+/* copy entry i of any hkl_data-like structure into the SoA list */
+#define SX_REFL_SOA_SET(s, i, L) do { \
+    (s)->tau_x[i] = (L).tau_x; (s)->tau_y[i] = (L).tau_y; (s)->tau_z[i] = (L).tau_z; \
+    (s)->tau[i]   = (L).tau; \
+    (s)->u1x[i] = (L).u1x; (s)->u1y[i] = (L).u1y; (s)->u1z[i] = (L).u1z; \
+    (s)->u2x[i] = (L).u2x; (s)->u2y[i] = (L).u2y; (s)->u2z[i] = (L).u2z; \
+    (s)->u3x[i] = (L).u3x; (s)->u3y[i] = (L).u3y; (s)->u3z[i] = (L).u3z; \
+    (s)->m1[i] = (L).m1; (s)->m2[i] = (L).m2; (s)->m3[i] = (L).m3; \
+    (s)->sig123[i] = (L).sig123; (s)->F2[i] = (L).F2; (s)->cutoff[i] = (L).cutoff; \
+  } while (0)
+
+/* copy lane m of a sx_tau_lanes into any tau_data-like structure */
+#define SX_TAU_STORE(T, s, m) do { \
+    (T).index = (s)->index[m]; (T).refl = (s)->refl[m]; (T).xsect = (s)->xsect[m]; \
+    (T).rho_x = (s)->rho_x[m]; (T).rho_y = (s)->rho_y[m]; (T).rho_z = (s)->rho_z[m]; \
+    (T).rho = (s)->rho[m]; \
+    (T).ox = (s)->ox[m]; (T).oy = (s)->oy[m]; (T).oz = (s)->oz[m]; \
+    (T).b1x = (s)->b1x[m]; (T).b1y = (s)->b1y[m]; (T).b1z = (s)->b1z[m]; \
+    (T).b2x = (s)->b2x[m]; (T).b2y = (s)->b2y[m]; (T).b2z = (s)->b2z[m]; \
+    (T).l11 = (s)->l11[m]; (T).l12 = (s)->l12[m]; (T).l22 = (s)->l22[m]; \
+    (T).y0x = (s)->y0x[m]; (T).y0y = (s)->y0y[m]; \
+  } while (0)
+
+int  sx_refl_soa_alloc(struct sx_refl_soa *s, int count);
+void sx_refl_soa_free(struct sx_refl_soa *s);
+int  sx_refl_filter(struct sx_refl_soa *s, const int *idx, int *pos, int last,
+       double kix, double kiy, double kiz, double ki, double tau_max,
+       int *hits, int max_hits);
+void sx_refl_eval(struct sx_refl_soa *s, const int *hits, int n,
+       double kix, double kiy, double kiz, double ki, double xsect_factor,
+       struct sx_tau_lanes *out);
+
+#endif
+
+/* end of sx_refl-lib.h */
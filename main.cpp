@@ -5,33 +5,14 @@
 #include "src/cogen/mccogen.h"
 #include "src/cogen/lex.yy.c"
 #include "src/cogen/instrument.tab.c"
+#include "src/cogen/mcbatch.h"
 
 
-int main (int argc, char **argv) {
+/* Parses instr_current_filename and writes the C code to output_filename */
+static int generate_instrument(void) {
     FILE *file;
     int err;
 
-    yydebug = 0;      // If 1, then bison gives verbose parser debug info.
-
-    instrument_definition = (instr_def*) palloc(instrument_definition); // Allocate instrument def. structure.
-    // init root instrument to NULL
-    instrument_definition->formals   = NULL;
-    instrument_definition->name      = NULL;
-    instrument_definition->decls     = NULL;
-    instrument_definition->inits     = NULL;
-    instrument_definition->saves     = NULL;
-    instrument_definition->finals    = NULL;
-    instrument_definition->compmap   = NULL;
-    instrument_definition->groupmap  = NULL;
-    instrument_definition->complist  = NULL;
-    instrument_definition->grouplist = NULL;
-    instrument_definition->metadata  = NULL;
-    instrument_definition->has_included_instr=0;
-    comp_instances      = NULL;
-    comp_instances_list = NULL;
-    group_instances     = NULL;
-    group_instances_list= NULL;
-    parse_command_line(argc, argv);
     if(!strcmp(instr_current_filename, "-"))
     {
         instrument_definition->source = str_dup((char*) "<stdin>");
@@ -89,4 +70,34 @@ int main (int argc, char **argv) {
         fprintf(stderr, "Generated          C code %s from %s\n", output_filename, instrument_definition->source);
     }
     fprintf(stderr, "CFLAGS=%s\n", instrument_definition->dependency);
+    return 0;
+}
+
+
+int main (int argc, char **argv) {
+    yydebug = 0;      // If 1, then bison gives verbose parser debug info.
+
+    instrument_definition = (instr_def*) palloc(instrument_definition); // Allocate instrument def. structure.
+    // init root instrument to NULL
+    instrument_definition->formals   = NULL;
+    instrument_definition->name      = NULL;
+    instrument_definition->decls     = NULL;
+    instrument_definition->inits     = NULL;
+    instrument_definition->saves     = NULL;
+    instrument_definition->finals    = NULL;
+    instrument_definition->compmap   = NULL;
+    instrument_definition->groupmap  = NULL;
+    instrument_definition->complist  = NULL;
+    instrument_definition->grouplist = NULL;
+    instrument_definition->metadata  = NULL;
+    instrument_definition->has_included_instr=0;
+    comp_instances      = NULL;
+    comp_instances_list = NULL;
+    group_instances     = NULL;
+    group_instances_list= NULL;
+    parse_command_line(argc, argv);
+    if (batch_files) {
+        return batch_run(generate_instrument);
+    }
+    return generate_instrument();
 }
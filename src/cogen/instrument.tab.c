@@ -1504,6 +1504,7 @@ yyreduce:
         check_comp_formals(c->def_par, c->set_par, c->name);
         /* Put component definition in table. */
         symtab_add(read_components, c->name, c);
+        cache_compdef();
         if (verbose) fprintf(stderr, "Embedding component %s from file %s\n", c->name, c->source);
       }
 //#line 1510 "instrument.tab.c"
@@ -1515,6 +1516,7 @@ yyreduce:
         /* create a copy of a comp, and initiate it with given blocks */
         /* all redefined blocks override */
         struct comp_def *def;
+        cache_uncacheable();
         def = read_component((yyvsp[-14].string));
         if (def) {
           struct comp_def *c;
@@ -3344,6 +3346,7 @@ yyreduce:
 //#line 1666 "instrument.y"
     {
       printf("Executing: %s ... ",(yyvsp[0].string));
+      cache_uncacheable();
       int ret_val = system((yyvsp[0].string));
       if (ret_val != 0) {
 	printf("FAILED!\n");
@@ -3405,6 +3408,7 @@ yyreduce:
 	strncat(instrument_definition->dependency, " ", 1024);
 	strncat(instrument_definition->dependency, (yyvsp[0].string), 1023); // 1023 because we already appended a space
       }
+      cache_dependency((yyvsp[0].string));
     }
 //#line 3406 "instrument.tab.c"
     break;
@@ -3680,6 +3684,7 @@ yyreduce:
         (yyvsp[-1].ccode)->filename = instr_current_filename;
         (yyvsp[-1].ccode)->quoted_filename = str_quote(instr_current_filename);
         (yyvsp[-1].ccode)->linenum = (yyvsp[-2].linenum);
+        cache_codeblock((yyvsp[-1].ccode));
         (yyval.ccode) = (yyvsp[-1].ccode);
       }
 //#line 3682 "instrument.tab.c"
@@ -3970,6 +3975,11 @@ char verbose = 0;
 /* include instrument source code in executable ? */
 char embed_instrument_file = 0;
 
+/* Instrument files of a batch (--batch), NULL for a single instrument */
+List batch_files = NULL;
+/* Number of instruments generated in parallel in a batch, 0 for all processors */
+int  batch_jobs  = 0;
+
 /* Map of already-read components. */
 Symtab read_components = NULL;
 
@@ -3984,13 +3994,19 @@ print_usage(void)
   fprintf(stderr, "Compiler of the " MCCODE_NAME " ray-trace simulation package\n");
   fprintf(stderr, "Usage:\n"
     "  %s [-o file] [-I dir1 ...] [-t] [-p] [-v] "
-    "[--no-main] [--no-runtime] [--verbose] file\n", executable_name);
+    "[--no-main] [--no-runtime] [--no-fold] [--profile] [--cache-dir=DIR] [--verbose] file\n"
+    "  %s --batch [-j N] [options] file1 file2 ...\n", executable_name, executable_name);
   fprintf(stderr, "      -o FILE --output-file=FILE Place C output in file FILE.\n");
   fprintf(stderr, "      -I DIR  --search-dir=DIR   Append DIR to the component search list. \n");
   fprintf(stderr, "      -t      --trace            Enable 'trace' mode for instrument display.\n");
   fprintf(stderr, "      -v      --version          Prints " MCCODE_NAME " version.\n");
   fprintf(stderr, "      --no-main                  Do not create main(), for external embedding.\n");
-  fprintf(stderr, "      --no-runtime               Do not embed run-time libraries.\n");
+  fprintf(stderr, "      --no-runtime               Link with the run-time library instead of embedding it.\n");
+  fprintf(stderr, "      --no-fold                  Keep literal component parameters as variables.\n");
+  fprintf(stderr, "      --profile                  Time and count TRACE calls per component, table in SAVE.\n");
+  fprintf(stderr, "      --cache-dir=DIR            Cache parsed component definitions in DIR (default $" FLAVOR_UPPER "_CACHE).\n");
+  fprintf(stderr, "      --batch                    Generate each instrument file next to it, in parallel.\n");
+  fprintf(stderr, "      -j N    --jobs=N           Number of parallel instruments in a batch (default all processors).\n");
   fprintf(stderr, "      --verbose                  Display compilation process steps.\n");
   fprintf(stderr, "      --source                   Embed the instrument source code in executable.\n");
   fprintf(stderr, "  The instrument description file will be processed and translated into a C code program.\n");
@@ -4077,7 +4093,7 @@ set_output_filename(char *name)
 static void
 parse_command_line(int argc, char *argv[])
 {
-  int i;
+  int i, batch = 0;
 
   output_filename                        = NULL;
   verbose                                = 0;
@@ -4085,9 +4101,12 @@ parse_command_line(int argc, char *argv[])
   instrument_definition->use_default_main= 1;
   instrument_definition->include_runtime = 1;
   instrument_definition->enable_trace    = 0;
+  instrument_definition->enable_profile  = 0;
+  instrument_definition->fold_parameters = 1;
   instrument_definition->portable        = 0;
   strcmp(instrument_definition->dependency, "-lm");
   executable_name                        = argv[0];
+  cache_dir                              = getenv(FLAVOR_UPPER "_CACHE");
   for(i = 1; i < argc; i++)
   {
     if(!strcmp("-o", argv[i]) && (i + 1) < argc)
@@ -4130,6 +4149,23 @@ parse_command_line(int argc, char *argv[])
       instrument_definition->use_default_main = 0;
     else if(!strcmp("--no-runtime", argv[i]))
       instrument_definition->include_runtime = 0;
+    else if(!strcmp("--profile", argv[i]))
+      instrument_definition->enable_profile = 1;
+    else if(!strcmp("--no-fold", argv[i]))
+      instrument_definition->fold_parameters = 0;
+    else if(!strncmp("--cache-dir=", argv[i], 12))
+      cache_dir = &argv[i][12];
+    else if(!strcmp("--batch", argv[i]))
+      batch = 1;
+    else if(!strcmp("-j", argv[i]) && (i + 1) < argc)
+      batch_jobs = atoi(argv[++i]);
+    else if(!strncmp("--jobs=", argv[i], 7))
+      batch_jobs = atoi(&argv[i][7]);
+    else if(argv[i][0] != '-' && batch)
+    {
+      if(batch_files == NULL) batch_files = list_create();
+      list_add(batch_files, argv[i]);
+    }
     else if(argv[i][0] != '-')
     {
       if(instr_current_filename != NULL)
@@ -4140,12 +4176,21 @@ parse_command_line(int argc, char *argv[])
       print_usage_error();
   }
 
+  /* A batch writes each instrument to its own file, next to it */
+  if(batch)
+  {
+    if(batch_files == NULL || instr_current_filename != NULL || output_filename != NULL)
+      print_usage_error();
+    cache_init(cache_dir);
+    return;
+  }
   /* Instrument filename must be given. */
   if(instr_current_filename == NULL)
     print_usage_error();
   /* If no '-o' option was given for INSTR.instr, default to INSTR.c  */
   if(output_filename == NULL)
     output_filename = make_output_filename(instr_current_filename);
+  cache_init(cache_dir);
 }
 
 
@@ -4485,6 +4530,7 @@ read_component(char *name)
   {
     FILE *file;
     int err;
+    struct comp_def *def;
 
     /* Attempt to read definition from file components/<name>.com. */
     file = open_component_search(name);
@@ -4496,6 +4542,13 @@ read_component(char *name)
         "  or copy the component definition file locally.\n  Current library search path: %s\n", name, get_sys_dir());
       return NULL;
     }
+    /* Use the definition parsed by a previous run when still up to date. */
+    if((def = cache_read_component(name)) != NULL)
+    {
+      fclose(file);
+      return def;
+    }
+    cache_record_begin(name);
     push_autoload(file);
     /* Note: the str_dup copy of the file name is stored in codeblocks, and
        must not be freed. */
@@ -4508,6 +4561,7 @@ read_component(char *name)
     fclose(file);
     /* Now check if the file contained the required component definition. */
     entry = symtab_lookup(read_components, name);
+    cache_record_end(entry ? (comp_def*) entry->val : NULL);
     if(entry != NULL)
     {
       return (comp_def*) entry->val;
@@ -232,6 +232,7 @@ compdef:    "DEFINE" "COMPONENT" TOK_ID parameters metadata shell dependency noa
         check_comp_formals(c->def_par, c->set_par, c->name);
         /* Put component definition in table. */
         symtab_add(read_components, c->name, c);
+        cache_compdef();
         if (verbose) fprintf(stderr, "Embedding component %s from file %s\n", c->name, c->source);
       }
 // $1       $2         $3     $4     $5     $6         $7       $8    $9        $10    $11   $12      $13     $14        $15   $16  $17     $18     $19
@@ -240,6 +241,7 @@ compdef:    "DEFINE" "COMPONENT" TOK_ID parameters metadata shell dependency noa
         /* create a copy of a comp, and initiate it with given blocks */
         /* all redefined blocks override */
         struct comp_def *def;
+        cache_uncacheable();
         def = read_component($5);
         if (def) {
           struct comp_def *c;
@@ -1667,6 +1669,7 @@ shell:
   | "SHELL" TOK_STRING
     {
       printf("Executing: %s ... ",$2);
+      cache_uncacheable();
       int ret_val = system($2);
       if (ret_val != 0) {
 	printf("FAILED!\n");
@@ -1715,6 +1718,7 @@ dependency:
 	strncat(instrument_definition->dependency, " ", 1024);
 	strncat(instrument_definition->dependency, $2, 1023); // 1023 because we already appended a space
       }
+      cache_dependency($2);
     }
 
 noacc:
@@ -1904,6 +1908,7 @@ codeblock:    TOK_CODE_START code TOK_CODE_END
         $2->filename = instr_current_filename;
         $2->quoted_filename = str_quote(instr_current_filename);
         $2->linenum = $1;
+        cache_codeblock($2);
         $$ = $2;
       }
 ;
@@ -1993,6 +1998,11 @@ char verbose = 0;
 /* include instrument source code in executable ? */
 char embed_instrument_file = 0;
 
+/* Instrument files of a batch (--batch), NULL for a single instrument */
+List batch_files = NULL;
+/* Number of instruments generated in parallel in a batch, 0 for all processors */
+int  batch_jobs  = 0;
+
 /* Map of already-read components. */
 Symtab read_components = NULL;
 
@@ -2007,13 +2017,19 @@ print_usage(void)
   fprintf(stderr, "Compiler of the " MCCODE_NAME " ray-trace simulation package\n");
   fprintf(stderr, "Usage:\n"
     "  %s [-o file] [-I dir1 ...] [-t] [-p] [-v] "
-    "[--no-main] [--no-runtime] [--verbose] file\n", executable_name);
+    "[--no-main] [--no-runtime] [--no-fold] [--profile] [--cache-dir=DIR] [--verbose] file\n"
+    "  %s --batch [-j N] [options] file1 file2 ...\n", executable_name, executable_name);
   fprintf(stderr, "      -o FILE --output-file=FILE Place C output in file FILE.\n");
   fprintf(stderr, "      -I DIR  --search-dir=DIR   Append DIR to the component search list. \n");
   fprintf(stderr, "      -t      --trace            Enable 'trace' mode for instrument display.\n");
   fprintf(stderr, "      -v      --version          Prints " MCCODE_NAME " version.\n");
   fprintf(stderr, "      --no-main                  Do not create main(), for external embedding.\n");
-  fprintf(stderr, "      --no-runtime               Do not embed run-time libraries.\n");
+  fprintf(stderr, "      --no-runtime               Link with the run-time library instead of embedding it.\n");
+  fprintf(stderr, "      --no-fold                  Keep literal component parameters as variables.\n");
+  fprintf(stderr, "      --profile                  Time and count TRACE calls per component, table in SAVE.\n");
+  fprintf(stderr, "      --cache-dir=DIR            Cache parsed component definitions in DIR (default $" FLAVOR_UPPER "_CACHE).\n");
+  fprintf(stderr, "      --batch                    Generate each instrument file next to it, in parallel.\n");
+  fprintf(stderr, "      -j N    --jobs=N           Number of parallel instruments in a batch (default all processors).\n");
   fprintf(stderr, "      --verbose                  Display compilation process steps.\n");
   fprintf(stderr, "      --source                   Embed the instrument source code in executable.\n");
   fprintf(stderr, "  The instrument description file will be processed and translated into a C code program.\n");
@@ -2100,7 +2116,7 @@ set_output_filename(char *name)
 static void
 parse_command_line(int argc, char *argv[])
 {
-  int i;
+  int i, batch = 0;
 
   output_filename                        = NULL;
   verbose                                = 0;
@@ -2108,9 +2124,12 @@ parse_command_line(int argc, char *argv[])
   instrument_definition->use_default_main= 1;
   instrument_definition->include_runtime = 1;
   instrument_definition->enable_trace    = 0;
+  instrument_definition->enable_profile  = 0;
+  instrument_definition->fold_parameters = 1;
   instrument_definition->portable        = 0;
   strcmp(instrument_definition->dependency, "-lm");
   executable_name                        = argv[0];
+  cache_dir                              = getenv(FLAVOR_UPPER "_CACHE");
   for(i = 1; i < argc; i++)
   {
     if(!strcmp("-o", argv[i]) && (i + 1) < argc)
@@ -2153,6 +2172,23 @@ parse_command_line(int argc, char *argv[])
       instrument_definition->use_default_main = 0;
     else if(!strcmp("--no-runtime", argv[i]))
       instrument_definition->include_runtime = 0;
+    else if(!strcmp("--profile", argv[i]))
+      instrument_definition->enable_profile = 1;
+    else if(!strcmp("--no-fold", argv[i]))
+      instrument_definition->fold_parameters = 0;
+    else if(!strncmp("--cache-dir=", argv[i], 12))
+      cache_dir = &argv[i][12];
+    else if(!strcmp("--batch", argv[i]))
+      batch = 1;
+    else if(!strcmp("-j", argv[i]) && (i + 1) < argc)
+      batch_jobs = atoi(argv[++i]);
+    else if(!strncmp("--jobs=", argv[i], 7))
+      batch_jobs = atoi(&argv[i][7]);
+    else if(argv[i][0] != '-' && batch)
+    {
+      if(batch_files == NULL) batch_files = list_create();
+      list_add(batch_files, argv[i]);
+    }
     else if(argv[i][0] != '-')
     {
       if(instr_current_filename != NULL)
@@ -2163,12 +2199,21 @@ parse_command_line(int argc, char *argv[])
       print_usage_error();
   }
 
+  /* A batch writes each instrument to its own file, next to it */
+  if(batch)
+  {
+    if(batch_files == NULL || instr_current_filename != NULL || output_filename != NULL)
+      print_usage_error();
+    cache_init(cache_dir);
+    return;
+  }
   /* Instrument filename must be given. */
   if(instr_current_filename == NULL)
     print_usage_error();
   /* If no '-o' option was given for INSTR.instr, default to INSTR.c  */
   if(output_filename == NULL)
     output_filename = make_output_filename(instr_current_filename);
+  cache_init(cache_dir);
 }
 
 
@@ -2508,6 +2553,7 @@ read_component(char *name)
   {
     FILE *file;
     int err;
+    struct comp_def *def;
 
     /* Attempt to read definition from file components/<name>.com. */
     file = open_component_search(name);
@@ -2519,6 +2565,13 @@ read_component(char *name)
         "  or copy the component definition file locally.\n  Current library search path: %s\n", name, get_sys_dir());
       return NULL;
     }
+    /* Use the definition parsed by a previous run when still up to date. */
+    if((def = cache_read_component(name)) != NULL)
+    {
+      fclose(file);
+      return def;
+    }
+    cache_record_begin(name);
     push_autoload(file);
     /* Note: the str_dup copy of the file name is stored in codeblocks, and
        must not be freed. */
@@ -2531,6 +2584,7 @@ read_component(char *name)
     fclose(file);
     /* Now check if the file contained the required component definition. */
     entry = symtab_lookup(read_components, name);
+    cache_record_end(entry ? (comp_def*) entry->val : NULL);
     if(entry != NULL)
     {
       return (comp_def*) entry->val;
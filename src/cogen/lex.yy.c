@@ -1417,6 +1417,7 @@ YY_RULE_SETUP
       yylval.linenum = instr_current_line;
       instr_current_line++;
       BEGIN(ccode);
+      cache_code_start(file_stack_ptr);
       return TOK_CODE_START;
     }
 	YY_BREAK
@@ -1470,6 +1471,7 @@ YY_RULE_SETUP
 {
         instr_current_line++;
         yylval.string = str_dup(yytext);
+        cache_code_line(yylval.string);
         return TOK_CODE_LINE;
       }
 	YY_BREAK
@@ -1568,8 +1570,7 @@ YY_RULE_SETUP
       }
 	YY_BREAK
 /* name ends with a quote char, but no ext -> include as ccode state
-   * this occurs when importing a library .h/.c The .c is only included
-   * when instr->runtime option is true
+   * this occurs when importing a library .h/.c
    */
 case 66:
 YY_RULE_SETUP
@@ -1581,16 +1582,13 @@ YY_RULE_SETUP
         if (!symtab_lookup(lib_instances, tmp0))
         {
           tmp1 = str_cat(tmp0, ".h", NULL);
-          if (instrument_definition->include_runtime)
-          {
-            switch_line = str_cat(tmp0, ".c", NULL);
-          }
-          else
-            fprintf(stderr,"Dependency: %s.o\n", tmp0);
+          /* also with --no-runtime: libraries are not in mccode_runtime */
+          switch_line = str_cat(tmp0, ".c", NULL);
 
           BEGIN(ccode);
           if (verbose) fprintf(stderr, "Embedding library   %s\n", tmp1);
 
+          cache_lib_include(tmp0, 1, file_stack_ptr);
           push_include(tmp1);
           symtab_add(lib_instances, tmp0, NULL);
           str_free(tmp1);
@@ -1599,6 +1597,7 @@ YY_RULE_SETUP
         {
           BEGIN(ccode);
           instr_current_line++;  /* library was previously embedded */
+          cache_lib_include(tmp0, 0, file_stack_ptr);
         }
         str_free(tmp0);
       }
@@ -1699,6 +1698,7 @@ case YY_STATE_EOF(ccode):
         }
         else
         {
+          cache_lib_end(file_stack_ptr);
           BEGIN(file_stack[file_stack_ptr].oldstate);
           if(file_stack[file_stack_ptr].visible_eof)
             yyterminate();
@@ -2783,6 +2783,7 @@ push_include(char *name)
     fatal_error("Cannot open include file '%s' "
                 "on line %d of file '%s'.\n",
               name, instr_current_line, instr_current_filename);
+  cache_file_opened(name, file_pathname);
   push_file(file, FALSE, FALSE);
   instr_current_filename = name;
   instr_current_line = 1;
@@ -0,0 +1,222 @@
+#ifndef __MC_BATCH_H__
+#define __MC_BATCH_H__
+
+
+/*******************************************************************************
+*
+* McCode, neutron/xray ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Kernel: mcbatch.h
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: @MCCODE_STRING@
+* Version: $Revision$
+*
+* Code generation of a batch of instruments in one command (--batch).
+*
+* The lexer, the parser and the code generator keep the instrument being
+* processed in global variables, so each instrument is generated by a worker
+* process of its own, forked from the command. Up to --jobs workers run in
+* parallel. A worker generates its instrument as 'cd DIR; mcstas FILE.instr'
+* would, next to the instrument file, and its messages are printed once it
+* has ended, so that they do not mix with those of the other instruments.
+*
+* The instruments of a batch share:
+*   - the run-time files embedded in the generated code, read once before the
+*     workers are started,
+*   - the parsed component definitions and libraries, through the cache of
+*     component definitions (mccache.h). Without --cache-dir, a temporary cache
+*     directory is used for the batch.
+*
+* Batches are not available where processes can not be forked (Windows).
+*
+*******************************************************************************/
+
+#ifndef _MSC_EXTENSIONS
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#endif
+
+/* Worker generating one instrument of the batch */
+struct batch_worker
+{
+  pid_t pid;
+  char *file;   /* instrument file */
+  FILE *log;    /* messages of the worker */
+};
+
+/* Run-time files embedded in every generated instrument */
+static char *batch_runtime[] = {
+  (char*) "mccode-r.h", (char*) "mccode-r.c",
+#if MCCODE_PROJECT == 1     /* neutron */
+  (char*) "mcstas-r.h", (char*) "mcstas-r.c",
+#elif MCCODE_PROJECT == 2   /* xray */
+  (char*) "mcxtrace-r.h", (char*) "mcxtrace-r.c",
+#endif
+  (char*) "metadata-r.c", (char*) "mccode_main.c" };
+
+#ifndef _MSC_EXTENSIONS
+/* Absolute path of a relative directory, as workers change directory */
+static char *
+batch_absolute(char *dir)
+{
+  char path[PATH_MAX];
+
+  if (!dir || dir[0] == '/' || !realpath(dir, path)) return dir;
+  return str_dup(path);
+}
+
+/* Removes the temporary cache directory of the batch */
+static void
+batch_remove_dir(char *dir)
+{
+  DIR *dfd;
+  struct dirent *dp;
+  char *path;
+
+  if ((dfd = opendir(dir)) == NULL) return;
+  while ((dp = readdir(dfd)) != NULL) {
+    if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) continue;
+    path = str_cat(dir, MC_PATHSEP_S, dp->d_name, NULL);
+    remove(path);
+    str_free(path);
+  }
+  closedir(dfd);
+  rmdir(dir);
+}
+
+/* Starts the worker generating file, in the directory of the file */
+static void
+batch_start(struct batch_worker *worker, char *file, int (*generate)(void))
+{
+  char *dir, *base;
+
+  worker->file = file;
+  worker->log  = tmpfile();
+  if (!worker->log) fatal_error("Can not create a temporary file (batch_start).\n");
+  fflush(NULL);
+  worker->pid = fork();
+  if (worker->pid < 0) fatal_error("Can not start a process for %s (batch_start).\n", file);
+  if (worker->pid > 0) return;
+
+  /* worker: messages go to the log, the instrument is processed in its directory */
+  dup2(fileno(worker->log), 1);
+  dup2(fileno(worker->log), 2);
+  base = strrchr(file, '/');
+  if (base) {
+    dir = str_dup_n(file, base - file);
+    if (*dir && chdir(dir))
+      fatal_error("Can not change to directory %s of %s.\n", dir, file);
+    base++;
+  } else
+    base = file;
+  instr_current_filename = str_dup(base);
+  output_filename        = make_output_filename(base);
+  exit(generate());
+}
+
+/* Prints the messages of an ended worker */
+static int
+batch_end(struct batch_worker *worker, int status)
+{
+  char buf[4096];
+  size_t n;
+  int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+  fprintf(stderr, "%s %s\n", ok ? "Generated" : "Failed to generate", worker->file);
+  fseek(worker->log, 0, SEEK_SET);
+  while ((n = fread(buf, 1, sizeof(buf), worker->log)) > 0)
+    fwrite(buf, 1, n, stderr);
+  if (WIFSIGNALED(status))
+    fprintf(stderr, "%s: terminated by signal %i\n", worker->file, WTERMSIG(status));
+  fclose(worker->log);
+  worker->pid = 0;
+  return ok;
+}
+#endif
+
+/*******************************************************************************
+* batch_run: generates the instruments of batch_files with generate(), which
+* processes instr_current_filename into output_filename. Returns the exit
+* status of the command: 0 when all instruments were generated.
+*******************************************************************************/
+int
+batch_run(int (*generate)(void))
+{
+#ifdef _MSC_EXTENSIONS
+  fatal_error("--batch is not available on this platform.\n");
+  return 1;
+#else
+  struct batch_worker *workers;
+  List_handle liter;
+  List   dirs;
+  char  *file, *dir, *temp_dir = NULL, *sys_dir;
+  int    i, jobs, running = 0, done = 0, failed = 0, status;
+  pid_t  pid;
+
+  jobs = batch_jobs > 0 ? batch_jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs < 1) jobs = 1;
+  workers = (batch_worker*) mem(jobs*sizeof(*workers));
+  for (i = 0; i < jobs; i++) workers[i].pid = 0;
+
+  /* paths given relative to the current directory */
+  sys_dir = getenv(FLAVOR_UPPER);
+  if (sys_dir && sys_dir[0] != '/') setenv(FLAVOR_UPPER, batch_absolute(sys_dir), 1);
+  if (search_list) {
+    dirs = list_create();
+    liter = list_iterate(search_list);
+    while ((dir = (char*) list_next(liter))) list_add(dirs, batch_absolute(dir));
+    list_iterate_end(liter);
+    search_list = dirs;
+  }
+  if (cache_dir)
+    cache_init(batch_absolute(cache_dir));
+  else {
+    temp_dir = str_cat(getenv("TMPDIR") ? getenv("TMPDIR") : (char*) "/tmp",
+                       MC_PATHSEP_S, MCCODE_NAME "_cache_XXXXXX", NULL);
+    if (mkdtemp(temp_dir)) cache_init(temp_dir);
+    else { str_free(temp_dir); temp_dir = NULL; }
+  }
+
+  /* shared by the workers */
+  for (i = 0; i < sizeof(batch_runtime)/sizeof(*batch_runtime); i++)
+    embed_file_text(batch_runtime[i]);
+
+  liter = list_iterate(batch_files);
+  file  = (char*) list_next(liter);
+  while (file || running) {
+    for (i = 0; i < jobs && file; i++)
+      if (!workers[i].pid) {
+        batch_start(&workers[i], file, generate);
+        running++;
+        file = (char*) list_next(liter);
+      }
+    pid = wait(&status);
+    if (pid < 0) break;
+    for (i = 0; i < jobs; i++)
+      if (workers[i].pid == pid) {
+        if (!batch_end(&workers[i], status)) failed++;
+        running--;
+        done++;
+      }
+  }
+  list_iterate_end(liter);
+  memfree(workers);
+  if (temp_dir) batch_remove_dir(temp_dir);
+
+  fprintf(stderr, "Generated %i of %i instruments (%i jobs).\n",
+    done - failed, list_len(batch_files), jobs);
+  return failed || done < list_len(batch_files) ? 1 : 0;
+#endif
+}
+
+#endif
@@ -0,0 +1,786 @@
+#ifndef __MC_CACHE_H__
+#define __MC_CACHE_H__
+
+
+/*******************************************************************************
+*
+* McCode, neutron/xray ray-tracing package
+*         Copyright 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Kernel: mccache.h
+*
+* %Identification
+* Written by: McCode developers
+* Date: 2024
+* Origin: DTU Physics
+* Release: @MCCODE_STRING@
+* Version: $Revision$
+*
+* Persistent cache of parsed component definitions.
+*
+* With --cache-dir=DIR (or $TT_CACHE), each component definition parsed from a
+* file is written to DIR as <name>-<hash>.cdef, and read back by later code
+* generations instead of lexing and parsing the component file again. A cache
+* file is only used while the component file and every file it includes are
+* found at the same path, with the same modification time and size.
+*
+* Libraries imported with %include "name" in C code blocks are embedded once
+* per instrument, so the text of a component depends on the components read
+* before it. The lexer thus records the text of every library it embeds, and
+* a cached definition stores a reference to the library at the place of the
+* %include, expanded against the libraries already embedded in the instrument
+* when the cache file is read. The library texts used by a component are stored
+* in its cache file.
+*
+* Components defined with COPY, executing SHELL commands, defined together with
+* other components in one file, or with parse errors are not cached, and a
+* component read while parsing another one is always parsed. The directory is
+* created when missing.
+*
+*******************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _MSC_EXTENSIONS
+#include <unistd.h>
+#else
+#include <process.h>
+#include <direct.h>
+#define getpid _getpid
+#define mkdir(dir, mode) _mkdir(dir)
+#endif
+
+#define CACHE_MAGIC    "McCode comp_def cache 1"
+#define CACHE_MAXDEPTH 256
+
+/* A file a cached definition depends on, found by name in the search path */
+struct cache_dep
+{
+  char      type;     /* 'c': component, 'f': included file */
+  char     *name;     /* name searched for */
+  char     *path;     /* path found */
+  long long mtime;
+  long long size;
+};
+
+/* An item of cached code: either a line or a library %include */
+struct cache_item
+{
+  char *line;
+  char *lib;
+};
+
+/* Library being (or once) embedded, with nested library %includes as items */
+struct cache_lib
+{
+  char *name;
+  List  items;
+  List  deps;
+  int   depth;                /* lexer include depth of the %include */
+  struct cache_event *event;  /* top-level %include in a component, or NULL */
+};
+
+/* Library %include at the top level of a component code block */
+struct cache_event
+{
+  char *lib;
+  long  block;    /* code block counter at the %include */
+  long  first;    /* code line counter at the %include... */
+  long  last;     /* ...and at the end of the library */
+  int   embedded; /* 0 when the library was already embedded */
+};
+
+/* Code block of a component being parsed */
+struct cache_block
+{
+  struct code_block *code;
+  long  block;    /* code block counter */
+  long  first;    /* code line counter at the first line */
+};
+
+/* State of a component being parsed */
+struct cache_record
+{
+  List  deps;
+  List  events;
+  List  blocks;
+  List  dependency;           /* DEPENDENCY strings */
+  int   compdefs;             /* number of definitions in the file */
+  int   uncacheable;
+  int   errors;               /* error_encountered when parsing started */
+  int   depth;                /* lexer include depth of the code blocks */
+  char *path;                 /* component file */
+  struct cache_record *outer; /* component being parsed when this one was read */
+};
+
+/* Directory of the cache, NULL when disabled */
+char *cache_dir = NULL;
+/* TOK_CODE_START and TOK_CODE_LINE counters */
+long cache_code_blocks = 0;
+long cache_code_lines  = 0;
+/* Texts of the libraries embedded so far, by name */
+static Symtab cache_libs = NULL;
+/* Libraries being embedded, innermost last */
+static struct cache_lib *cache_open_libs[CACHE_MAXDEPTH];
+static int cache_open_count = 0;
+/* Component being parsed */
+static struct cache_record *cache_current = NULL;
+/* Set when a cache file is truncated or malformed */
+static int cache_bad = 0;
+
+
+/*******************************************************************************
+* cache_init: enables the cache in directory dir
+*******************************************************************************/
+void
+cache_init(char *dir)
+{
+  struct stat st;
+
+  cache_dir  = (dir && *dir) ? str_dup(dir) : NULL;
+  if (!cache_dir) return;
+  if (stat(cache_dir, &st) && mkdir(cache_dir, 0777))
+    fprintf(stderr, "Warning: can not create cache directory %s\n", cache_dir);
+  if (!cache_libs) cache_libs = symtab_create();
+}
+
+static struct cache_item *
+cache_item_new(char *line, char *lib)
+{
+  struct cache_item *item;
+  item = (cache_item*) palloc(item);
+  item->line = line;
+  item->lib  = lib;
+  return item;
+}
+
+static void
+cache_dep_add(List deps, char type, char *name, char *path)
+{
+  struct cache_dep *dep;
+  struct stat st;
+
+  if (!path || stat(path, &st)) return;
+  dep = (cache_dep*) palloc(dep);
+  dep->type  = type;
+  dep->name  = str_dup(name);
+  dep->path  = str_dup(path);
+  dep->mtime = (long long) st.st_mtime;
+  dep->size  = (long long) st.st_size;
+  list_add(deps, dep);
+}
+
+/*******************************************************************************
+* Lexer hooks: record code blocks, code lines, and embedded libraries
+*******************************************************************************/
+void
+cache_code_start(int depth)
+{
+  cache_code_blocks++;
+  if (cache_current && cache_current->depth < 0) cache_current->depth = depth;
+}
+
+void
+cache_code_line(char *line)
+{
+  cache_code_lines++;
+  if (cache_dir && cache_open_count)
+    list_add(cache_open_libs[cache_open_count-1]->items, cache_item_new(line, NULL));
+}
+
+/* Library %include: embedded is 0 when the library was already embedded */
+void
+cache_lib_include(char *name, int embedded, int depth)
+{
+  struct cache_event *event = NULL;
+  struct cache_lib   *lib;
+
+  if (!cache_dir) return;
+  if (cache_open_count)
+    list_add(cache_open_libs[cache_open_count-1]->items, cache_item_new(NULL, str_dup(name)));
+  else if (cache_current) {
+    event = (cache_event*) palloc(event);
+    event->lib   = str_dup(name);
+    event->block = cache_code_blocks;
+    event->first = event->last = cache_code_lines;
+    event->embedded = embedded;
+    list_add(cache_current->events, event);
+    /* the lexer counts the lines of the component file differently when the
+       library was already embedded: only follow those of the component file */
+    if (depth != cache_current->depth) cache_current->uncacheable = 1;
+  }
+  if (!embedded) return;
+  if (cache_open_count >= CACHE_MAXDEPTH)
+    fatal_error("Too deeply nested library includes (cache_lib_include).\n");
+  lib = (cache_lib*) palloc(lib);
+  lib->name  = str_dup(name);
+  lib->items = list_create();
+  lib->deps  = list_create();
+  lib->depth = depth;
+  lib->event = event;
+  cache_open_libs[cache_open_count++] = lib;
+}
+
+/* End of an included file, back at include depth */
+void
+cache_lib_end(int depth)
+{
+  struct cache_lib *lib;
+
+  if (!cache_dir || !cache_open_count || cache_open_libs[cache_open_count-1]->depth != depth)
+    return;
+  lib = cache_open_libs[--cache_open_count];
+  if (lib->event) lib->event->last = cache_code_lines;
+  if (!symtab_lookup(cache_libs, lib->name))
+    symtab_add(cache_libs, lib->name, lib);
+}
+
+/* File found by name in the search path and opened by the lexer */
+void
+cache_file_opened(char *name, char *path)
+{
+  if (!cache_dir) return;
+  if (cache_open_count)
+    cache_dep_add(cache_open_libs[cache_open_count-1]->deps, 'f', name, path);
+  else if (cache_current)
+    cache_dep_add(cache_current->deps, 'f', name, path);
+}
+
+/*******************************************************************************
+* Parser hooks
+*******************************************************************************/
+void
+cache_codeblock(struct code_block *code)
+{
+  struct cache_block *block;
+
+  if (!cache_current) return;
+  block = (cache_block*) palloc(block);
+  block->code  = code;
+  block->block = cache_code_blocks;
+  block->first = cache_code_lines - list_len(code->lines);
+  list_add(cache_current->blocks, block);
+}
+
+void
+cache_compdef(void)
+{
+  if (cache_current) cache_current->compdefs++;
+}
+
+void
+cache_dependency(char *dependency)
+{
+  if (cache_current) list_add(cache_current->dependency, str_dup(dependency));
+}
+
+void
+cache_uncacheable(void)
+{
+  if (cache_current) cache_current->uncacheable = 1;
+}
+
+/* Same as the grammar for DEPENDENCY and NOACC */
+static void
+cache_add_dependency(char *dependency)
+{
+  if (strstr(instrument_definition->dependency, dependency) == NULL) {
+    strncat(instrument_definition->dependency, " ", 1024);
+    strncat(instrument_definition->dependency, dependency, 1023);
+  }
+}
+
+/*******************************************************************************
+* cache_filename: cache file of component name found at path
+*******************************************************************************/
+static char *
+cache_filename(char *name, char *path)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  char  key[32];
+  char *c;
+
+  for (c = path; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  sprintf(key, "-%016llx.cdef", hash);
+  return str_cat(cache_dir, MC_PATHSEP_S, name, key, NULL);
+}
+
+/*******************************************************************************
+* Serialisation: integers on a line, strings as their length on a line followed
+* by the characters and a new line.
+*******************************************************************************/
+static void
+cache_put_int(FILE *f, long long value)
+{
+  fprintf(f, "%lld\n", value);
+}
+
+static void
+cache_put_str(FILE *f, char *s)
+{
+  if (!s) { cache_put_int(f, -1); return; }
+  cache_put_int(f, (long long) strlen(s));
+  fwrite(s, 1, strlen(s), f);
+  fputc('\n', f);
+}
+
+static long long
+cache_get_int(FILE *f)
+{
+  long long value = 0;
+  if (cache_bad || fscanf(f, "%lld", &value) != 1) cache_bad = 1;
+  return value;
+}
+
+static char *
+cache_get_str(FILE *f)
+{
+  long long len = cache_get_int(f);
+  char *s;
+
+  if (cache_bad || len < 0) return NULL;
+  if (fgetc(f) != '\n') { cache_bad = 1; return NULL; }
+  s = (char*) mem(len + 1);
+  if (fread(s, 1, len, f) != (size_t) len || fgetc(f) != '\n') {
+    cache_bad = 1;
+    memfree(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+static void
+cache_put_items(FILE *f, List items)
+{
+  List_handle liter;
+  struct cache_item *item;
+
+  cache_put_int(f, list_len(items));
+  liter = list_iterate(items);
+  while ((item = (cache_item*) list_next(liter))) {
+    cache_put_int(f, item->lib ? 1 : 0);
+    cache_put_str(f, item->lib ? item->lib : item->line);
+  }
+  list_iterate_end(liter);
+}
+
+static List
+cache_get_items(FILE *f)
+{
+  List items = list_create();
+  long long n = cache_get_int(f);
+  int  is_lib;
+  char *s;
+
+  while (!cache_bad && n-- > 0) {
+    is_lib = (int) cache_get_int(f);
+    s      = cache_get_str(f);
+    if (!s) cache_bad = 1;
+    else list_add(items, cache_item_new(is_lib ? NULL : s, is_lib ? s : NULL));
+  }
+  return items;
+}
+
+static void
+cache_put_formals(FILE *f, List formals)
+{
+  List_handle liter;
+  struct comp_iformal *formal;
+
+  cache_put_int(f, list_len(formals));
+  liter = list_iterate(formals);
+  while ((formal = (comp_iformal*) list_next(liter))) {
+    cache_put_int(f, formal->type);
+    cache_put_str(f, formal->id);
+    cache_put_str(f, formal->type_custom);
+    cache_put_int(f, formal->isoptional);
+    cache_put_int(f, formal->default_value != NULL);
+    if (formal->default_value) {
+      cache_put_str(f, formal->default_value->s);
+      cache_put_int(f, formal->default_value->isvalue);
+      cache_put_int(f, formal->default_value->lineno);
+    }
+  }
+  list_iterate_end(liter);
+}
+
+static List
+cache_get_formals(FILE *f)
+{
+  List formals = list_create();
+  long long n = cache_get_int(f);
+  struct comp_iformal *formal;
+  CExp e;
+
+  while (!cache_bad && n-- > 0) {
+    formal = (comp_iformal*) palloc(formal);
+    formal->type        = (enum instr_formal_types) cache_get_int(f);
+    formal->id          = cache_get_str(f);
+    formal->type_custom = cache_get_str(f);
+    formal->isoptional  = (int) cache_get_int(f);
+    if (cache_get_int(f)) {
+      e = (CExp) palloc(e);
+      e->s       = cache_get_str(f);
+      e->isvalue = (int) cache_get_int(f);
+      e->lineno  = (int) cache_get_int(f);
+      if (!e->s) cache_bad = 1;
+      formal->default_value = e;
+    }
+    if (!formal->id) cache_bad = 1;
+    list_add(formals, formal);
+  }
+  return formals;
+}
+
+/* Items of a code block: its lines, with the lines of libraries embedded at
+   the top level replaced by a library item. Returns NULL when the block was
+   not recorded. */
+static List
+cache_block_items(struct cache_record *rec, struct code_block *code)
+{
+  List items = list_create();
+  List_handle liter;
+  struct cache_block *block, *found = NULL;
+  struct cache_event *event;
+  long i = 0, len = list_len(code->lines);
+
+  if (!len && !code->filename) return items; /* absent block */
+  liter = list_iterate(rec->blocks);
+  while ((block = (cache_block*) list_next(liter)))
+    if (block->code == code) found = block;
+  list_iterate_end(liter);
+  if (!found) return NULL;
+
+  liter = list_iterate(rec->events);
+  while ((event = (cache_event*) list_next(liter))) {
+    if (event->block != found->block) continue;
+    for (; i < event->first - found->first && i < len; i++)
+      list_add(items, cache_item_new((char*) list_access(code->lines, i), NULL));
+    list_add(items, cache_item_new(NULL, event->lib));
+    i += event->last - event->first;
+  }
+  list_iterate_end(liter);
+  for (; i < len; i++)
+    list_add(items, cache_item_new((char*) list_access(code->lines, i), NULL));
+  return items;
+}
+
+/* Number of libraries already embedded at a %include before the code block.
+   The lexer counts one more line for each of them, so that the line number of
+   the block is stored as if they had all been embedded by the component. */
+static int
+cache_block_shift(struct cache_record *rec, struct code_block *code)
+{
+  List_handle liter;
+  struct cache_block *block;
+  struct cache_event *event;
+  long found = -1;
+  int  shift = 0;
+
+  liter = list_iterate(rec->blocks);
+  while ((block = (cache_block*) list_next(liter)))
+    if (block->code == code) found = block->block;
+  list_iterate_end(liter);
+  if (found < 0) return 0;
+  liter = list_iterate(rec->events);
+  while ((event = (cache_event*) list_next(liter)))
+    if (event->block < found && !event->embedded) shift++;
+  list_iterate_end(liter);
+  return shift;
+}
+
+/* Adds lib, and the libraries it includes, to libs. Returns 0 when a library
+   text is not known. */
+static int
+cache_collect_libs(List libs, Symtab seen, List items)
+{
+  List_handle liter;
+  struct cache_item *item;
+  struct Symtab_entry *entry;
+  int ok = 1;
+
+  liter = list_iterate(items);
+  while ((item = (cache_item*) list_next(liter))) {
+    if (!item->lib || symtab_lookup(seen, item->lib)) continue;
+    symtab_add(seen, item->lib, NULL);
+    entry = symtab_lookup(cache_libs, item->lib);
+    if (!entry) { ok = 0; continue; }
+    list_add(libs, entry->val);
+    ok = cache_collect_libs(libs, seen, ((struct cache_lib*) entry->val)->items) && ok;
+  }
+  list_iterate_end(liter);
+  return ok;
+}
+
+/*******************************************************************************
+* cache_write_component: writes the definition c parsed with record rec
+*******************************************************************************/
+static void
+cache_write_component(struct cache_record *rec, struct comp_def *c)
+{
+  struct code_block *codes[8] = { c->share_code, c->uservar_code, c->decl_code,
+    c->init_code, c->trace_code, c->save_code, c->finally_code, c->display_code };
+  List   blocks[8];
+  List   libs = list_create(), deps = list_create();
+  Symtab seen = symtab_create();
+  List_handle liter;
+  struct cache_lib *lib;
+  struct cache_dep *dep;
+  char  *filename, *tmpname, *dependency, suffix[32];
+  FILE  *f;
+  int    i, ok = 1;
+
+  for (i = 0; i < 8 && ok; i++) {
+    blocks[i] = cache_block_items(rec, codes[i]);
+    ok = blocks[i] && cache_collect_libs(libs, seen, blocks[i]);
+  }
+  symtab_free(seen, NULL);
+  if (!ok) {
+    if (verbose) fprintf(stderr, "Component %s can not be cached\n", c->name);
+    return;
+  }
+  list_cat(deps, rec->deps);
+  liter = list_iterate(libs);
+  while ((lib = (cache_lib*) list_next(liter))) list_cat(deps, lib->deps);
+  list_iterate_end(liter);
+
+  /* write to a temporary file renamed once complete, for concurrent runs */
+  filename = cache_filename(c->name, rec->path);
+  sprintf(suffix, ".%ld.tmp", (long) getpid());
+  tmpname  = str_cat(filename, suffix, NULL);
+  f = fopen(tmpname, "wb");
+  if (!f) {
+    if (verbose) fprintf(stderr, "Can not write cache file %s\n", tmpname);
+    str_free(tmpname); str_free(filename);
+    return;
+  }
+  fprintf(f, "%s\n", CACHE_MAGIC);
+  cache_put_str(f, (char*) MCCODE_VERSION);
+  cache_put_int(f, list_len(deps));
+  liter = list_iterate(deps);
+  while ((dep = (cache_dep*) list_next(liter))) {
+    cache_put_int(f, dep->type);
+    cache_put_str(f, dep->name);
+    cache_put_str(f, dep->path);
+    cache_put_int(f, dep->mtime);
+    cache_put_int(f, dep->size);
+  }
+  list_iterate_end(liter);
+  cache_put_str(f, c->name);
+  cache_put_str(f, c->source);
+  cache_put_int(f, c->flag_noacc);
+  cache_put_int(f, list_len(rec->dependency));
+  liter = list_iterate(rec->dependency);
+  while ((dependency = (char*) list_next(liter))) cache_put_str(f, dependency);
+  list_iterate_end(liter);
+  cache_put_formals(f, c->def_par);
+  cache_put_formals(f, c->set_par);
+  cache_put_formals(f, c->out_par);
+  for (i = 0; i < 8; i++) {
+    cache_put_str(f, codes[i]->filename);
+    cache_put_int(f, codes[i]->linenum - cache_block_shift(rec, codes[i]));
+    cache_put_items(f, blocks[i]);
+  }
+  cache_put_int(f, list_len(libs));
+  liter = list_iterate(libs);
+  while ((lib = (cache_lib*) list_next(liter))) {
+    cache_put_str(f, lib->name);
+    cache_put_items(f, lib->items);
+  }
+  list_iterate_end(liter);
+  if (fclose(f) || rename(tmpname, filename)) {
+    if (verbose) fprintf(stderr, "Can not write cache file %s\n", filename);
+    remove(tmpname);
+  } else if (verbose)
+    fprintf(stderr, "Cached component %s in %s\n", c->name, filename);
+  str_free(tmpname);
+  str_free(filename);
+}
+
+/* Checks that the file name is still found at path, unchanged */
+static int
+cache_dep_valid(char type, char *name, char *path, long long mtime, long long size)
+{
+  struct stat st;
+  FILE *f;
+
+  if (!name || !path) return 0;
+  if (type == 'f') {
+    /* the file found first in the search path may have changed */
+    f = open_file_search(name);
+    if (!f) return 0;
+    fclose(f);
+    if (!file_pathname || strcmp(file_pathname, path)) return 0;
+  } else if (strcmp(component_pathname, path))
+    return 0;
+  return !stat(path, &st) && (long long) st.st_mtime == mtime && (long long) st.st_size == size;
+}
+
+/* Appends items to lines, embedding the libraries not yet in the instrument.
+   Returns the number of libraries already embedded. */
+static int
+cache_expand(List lines, List items)
+{
+  List_handle liter;
+  struct cache_item *item;
+  struct Symtab_entry *entry;
+  int shift = 0;
+
+  liter = list_iterate(items);
+  while ((item = (cache_item*) list_next(liter))) {
+    if (!item->lib) { list_add(lines, item->line); continue; }
+    if (symtab_lookup(lib_instances, item->lib)) { shift++; continue; }
+    if (verbose) fprintf(stderr, "Embedding library   %s.h (cached)\n", item->lib);
+    symtab_add(lib_instances, item->lib, NULL);
+    entry = symtab_lookup(cache_libs, item->lib);
+    if (entry) cache_expand(lines, ((struct cache_lib*) entry->val)->items);
+  }
+  list_iterate_end(liter);
+  return shift;
+}
+
+/*******************************************************************************
+* cache_read_component: reads the definition of component name, found at
+* component_pathname, from the cache. Returns NULL when it is not cached or
+* out of date.
+*******************************************************************************/
+struct comp_def *
+cache_read_component(char *name)
+{
+  struct comp_def *c;
+  struct code_block **codes[8];
+  List   items[8], dependency;
+  struct cache_lib *lib;
+  char  *filename, *version, *dep_name, *dep_path, line[64];
+  long long n, mtime, size;
+  char   type;
+  FILE  *f;
+  int    i, shift, valid = 1;
+
+  /* a component read while parsing another one (COPY) is parsed as well, as
+     the lexer state of the outer component depends on it */
+  if (!cache_dir || cache_current) return NULL;
+  filename = cache_filename(name, component_pathname);
+  f = fopen(filename, "rb");
+  str_free(filename);
+  if (!f) return NULL;
+  cache_bad = 0;
+  if (!fgets(line, sizeof(line), f) || strncmp(line, CACHE_MAGIC "\n", sizeof(line))) {
+    fclose(f);
+    return NULL;
+  }
+  version = cache_get_str(f);
+  if (!version || strcmp(version, MCCODE_VERSION)) valid = 0;
+  n = cache_get_int(f);
+  while (valid && !cache_bad && n-- > 0) {
+    type     = (char) cache_get_int(f);
+    dep_name = cache_get_str(f);
+    dep_path = cache_get_str(f);
+    mtime    = cache_get_int(f);
+    size     = cache_get_int(f);
+    valid    = !cache_bad && cache_dep_valid(type, dep_name, dep_path, mtime, size);
+  }
+  if (!valid || cache_bad) {
+    fclose(f);
+    if (verbose) fprintf(stderr, "Component %s: cache is out of date\n", name);
+    return NULL;
+  }
+
+  c = (comp_def*) palloc(c);
+  c->name       = cache_get_str(f);
+  c->source     = cache_get_str(f);
+  c->flag_noacc = (int) cache_get_int(f);
+  dependency    = list_create();
+  n = cache_get_int(f);
+  while (!cache_bad && n-- > 0) list_add(dependency, cache_get_str(f));
+  c->def_par  = cache_get_formals(f);
+  c->set_par  = cache_get_formals(f);
+  c->out_par  = cache_get_formals(f);
+  c->metadata = list_create();
+  codes[0] = &c->share_code;   codes[1] = &c->uservar_code;
+  codes[2] = &c->decl_code;    codes[3] = &c->init_code;
+  codes[4] = &c->trace_code;   codes[5] = &c->save_code;
+  codes[6] = &c->finally_code; codes[7] = &c->display_code;
+  for (i = 0; i < 8; i++) {
+    *codes[i] = codeblock_new();
+    (*codes[i])->filename = cache_get_str(f);
+    if ((*codes[i])->filename)
+      (*codes[i])->quoted_filename = str_quote((*codes[i])->filename);
+    (*codes[i])->linenum = (int) cache_get_int(f);
+    items[i] = cache_get_items(f);
+  }
+  n = cache_get_int(f);
+  while (!cache_bad && n-- > 0) {
+    lib = (cache_lib*) palloc(lib);
+    lib->name  = cache_get_str(f);
+    lib->items = cache_get_items(f);
+    lib->deps  = list_create();
+    if (lib->name && !symtab_lookup(cache_libs, lib->name))
+      symtab_add(cache_libs, lib->name, lib);
+  }
+  fclose(f);
+  if (cache_bad || !c->name || strcmp(c->name, name) || symtab_lookup(read_components, name)) {
+    if (verbose) fprintf(stderr, "Component %s: invalid cache file\n", name);
+    return NULL;
+  }
+
+  /* same as when the definition is parsed */
+  for (i = 0, shift = 0; i < 8; i++) {
+    if ((*codes[i])->filename) (*codes[i])->linenum += shift;
+    shift += cache_expand((*codes[i])->lines, items[i]);
+  }
+  for (i = 0; i < list_len(dependency); i++)
+    cache_add_dependency((char*) list_access(dependency, i));
+  if (c->flag_noacc && strstr(instrument_definition->dependency, " -DFUNNEL ") == NULL)
+    strncat(instrument_definition->dependency, " -DFUNNEL ", 1024);
+  symtab_add(read_components, c->name, c);
+  if (verbose) fprintf(stderr, "Embedding component %s from file %s (cached)\n", c->name, c->source);
+  return c;
+}
+
+/*******************************************************************************
+* cache_record_begin: starts recording the parse of component name, found at
+* component_pathname.
+*******************************************************************************/
+void
+cache_record_begin(char *name)
+{
+  struct cache_record *rec;
+
+  if (!cache_dir) return;
+  rec = (cache_record*) palloc(rec);
+  rec->deps       = list_create();
+  rec->events     = list_create();
+  rec->blocks     = list_create();
+  rec->dependency = list_create();
+  rec->errors     = error_encountered;
+  rec->depth      = -1;
+  rec->outer      = cache_current;
+  /* a component read while parsing another one (COPY) */
+  if (cache_current) cache_current->uncacheable = 1;
+  rec->path       = str_dup(component_pathname);
+  cache_dep_add(rec->deps, 'c', name, rec->path);
+  cache_current = rec;
+}
+
+/*******************************************************************************
+* cache_record_end: writes the definition c of the component being parsed to
+* the cache.
+*******************************************************************************/
+void
+cache_record_end(struct comp_def *c)
+{
+  struct cache_record *rec = cache_current;
+
+  if (!rec) return;
+  cache_current = rec->outer;
+  if (c && !rec->uncacheable && rec->compdefs == 1 && rec->errors == error_encountered)
+    cache_write_component(rec, c);
+  else if (verbose && c)
+    fprintf(stderr, "Component %s can not be cached\n", c->name);
+}
+
+#endif
@@ -179,6 +179,9 @@ extern char verbose;
 extern char lint;
 /* Will store component instance for PREVIOUS reference */
 extern char embed_instrument_file;
+/* Instrument files of a batch (--batch), and number of parallel workers */
+extern List batch_files;
+extern int  batch_jobs;
 /* Will store component instance for PREVIOUS reference */
 extern struct comp_inst *previous_comp;
 extern struct comp_inst *myself_comp;
@@ -211,6 +214,7 @@ void push_autoload(FILE *file);
 *******************************************************************************/
 
 extern char *component_pathname;
+extern char *file_pathname;
 
 /* Open file, searching the full search path. */
 FILE *open_file_search(char *name);
@@ -224,6 +228,33 @@ void add_search_dir(char *name);
 char *get_sys_dir(void);
 
 
+/*******************************************************************************
+* Definitions in mccache.h
+*******************************************************************************/
+
+/* Directory of the component definition cache, NULL when disabled. */
+extern char *cache_dir;
+/* Enable the cache in directory dir. */
+void cache_init(char *dir);
+/* Lexer hooks: new code block and code line, library %include and end of
+   included file, file found in the search path. */
+void cache_code_start(int depth);
+void cache_code_line(char *line);
+void cache_lib_include(char *name, int embedded, int depth);
+void cache_lib_end(int depth);
+void cache_file_opened(char *name, char *path);
+/* Parser hooks: code block, component definition, DEPENDENCY, and
+   constructs which prevent caching. */
+void cache_codeblock(struct code_block *code);
+void cache_compdef(void);
+void cache_dependency(char *dependency);
+void cache_uncacheable(void);
+/* Read a component definition from the cache, or record its parse. */
+struct comp_def *cache_read_component(char *name);
+void cache_record_begin(char *name);
+void cache_record_end(struct comp_def *c);
+
+
 /*******************************************************************************
 * Definitions in re.c (added jg-20190312 via github.com/kokke)
 *******************************************************************************/
@@ -250,6 +281,8 @@ int  re_match(const char* pattern, const char* text);
 struct code_block *codeblock_new(void);
 /* Generate code for instrument definition. */
 void cogen(char *output_name, struct instr_def *instr);
+/* Lines of a file of the system directory, read once per process. */
+List embed_file_text(char *name);
 
 
 /*******************************************************************************
@@ -440,6 +473,8 @@ struct instr_def
     int use_default_main;     /* If set, output a main() function */
     int include_runtime;      /* If set, include runtime in output */
     int enable_trace;         /* If set, enable output of ray traces */
+    int enable_profile;       /* If set, time and count TRACE calls per component */
+    int fold_parameters;      /* If set, literal component parameters are constants */
     int portable;             /* If set, emit strictly portable ANSI C */
     int has_included_instr;   /* Flag set when instruments are %included in instr */
     char dependency[1024];    /* stores all dependencies needed to compile, from comps and instr */
@@ -487,4 +522,6 @@ struct metadata_struct * metadata_copy(struct metadata_struct *);
 List metadata_list_copy(List from);
 
 
+#include "mccache.h"
+
 #endif
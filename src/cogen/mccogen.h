@@ -291,6 +291,53 @@ codeblock_new(void)
   return cb;
 }
 
+/*******************************************************************************
+* Texts of the files embedded from the system directory, by name. They are read
+* once per process, so that the instruments of a batch (--batch) share them.
+*******************************************************************************/
+static Symtab embed_texts = NULL;
+
+/* Read a file into a list of lines, as output by embed_file() */
+static List
+embed_read_lines(FILE *f)
+{
+  char buf[4096];
+  List lines = list_create();
+  int last;
+
+  while(!feof(f))
+  {
+    if(fgets(buf, 4096, f) == NULL)
+      break;
+    last = strlen(buf) - 1;
+    if(last >= 0 && (buf[last] == '\n' || buf[last] == '\r'))
+      buf[last--] = '\0';
+    if(last >= 0 && (buf[last] == '\n' || buf[last] == '\r'))
+      buf[last--] = '\0';
+    list_add(lines, str_dup(buf));
+  }
+  return lines;
+}
+
+/* Lines of file name of the system directory, NULL when it is not there */
+List
+embed_file_text(char *name)
+{
+  struct Symtab_entry *entry;
+  List lines;
+  FILE *f;
+
+  if (!embed_texts) embed_texts = symtab_create();
+  entry = symtab_lookup(embed_texts, name);
+  if (entry) return (List) entry->val;
+  f = open_file_search_sys(name);
+  if (f == NULL) return NULL;
+  lines = embed_read_lines(f);
+  fclose(f);
+  symtab_add(embed_texts, name, lines);
+  return lines;
+}
+
 /*******************************************************************************
 * Read a file and output it to the generated simulation code. Uses a
 * fixed-size buffer, and will silently and arbitrarily break long lines.
@@ -298,40 +345,35 @@ codeblock_new(void)
 static void
 embed_file(char *name)
 {
-  char buf[4096];
+  List lines;
+  List_handle liter;
+  char *line;
   FILE *f;
-  int last;
 
   coutf( "/* embedding file \"%s\" */", name);
 
   if (!symtab_lookup(lib_instances, name))
   {
     /* First look in the system directory. */
-    f = open_file_search_sys(name);
+    lines = embed_file_text(name);
     /* If not found, look in the full search path. */
-    if(f == NULL) {
+    if(lines == NULL) {
       f = open_file_search(name);
       /* If still not found, abort. */
       if(f == NULL)
         fatal_error("Could not find file '%s'\n", name);
       else if (verbose) fprintf(stderr, "Embedding file      %s (user path)\n", name);
+      lines = embed_read_lines(f);
+      fclose(f);
     } else if (verbose) fprintf(stderr, "Embedding file      %s (%s)\n", name, get_sys_dir());
 
     coutf("");
     code_set_source(name, 1);
-    /* Now loop, reading lines and outputting them in the code. */
-    while(!feof(f))
-    {
-      if(fgets(buf, 4096, f) == NULL)
-        break;
-      last = strlen(buf) - 1;
-      if(last >= 0 && (buf[last] == '\n' || buf[last] == '\r'))
-        buf[last--] = '\0';
-      if(last >= 0 && (buf[last] == '\n' || buf[last] == '\r'))
-        buf[last--] = '\0';
-      cout(buf);
-    }
-    fclose(f);
+    /* Now loop, outputting the lines in the code. */
+    liter = list_iterate(lines);
+    while((line = (char*) list_next(liter)))
+      cout(line);
+    list_iterate_end(liter);
     coutf( "/* End of file \"%s\". */", name);
     coutf("");
     code_reset_source();
@@ -339,11 +381,304 @@ embed_file(char *name)
   } /* else file has already been embedded */
 } /* embed_file */
 
+/* *****************************************************************************
+* codeblock_modifies: returns 1 when the code may modify the variable id, i.e.
+* id is assigned, incremented/decremented, its address is taken, or it is on
+* the line of a run-time macro assigning its arguments.
+***************************************************************************** */
+static char *codeblock_output_macros[] = {
+  (char*) "NORM(", (char*) "vec_prod(", (char*) "rotate(", (char*) "mirror(" };
+
+static int
+codeblock_modifies(struct code_block *code, char *id)
+{
+  List_handle liter;
+  char *line, *pos, *next, *prev, *macro;
+  int len = strlen(id), found = 0, i;
+
+  if (!code || list_len(code->lines) <= 0) return 0;
+  liter = list_iterate(code->lines);
+  while(!found && (line = (char*) list_next(liter)))
+    for (pos = strstr(line, id); pos && !found; pos = strstr(pos + len, id)) {
+      if ((pos > line && (isalnum(pos[-1]) || pos[-1] == '_'))
+       || isalnum(pos[len]) || pos[len] == '_')
+        continue;             /* part of another identifier */
+      for (next = pos + len; *next == ' ' || *next == '\t'; next++);
+      for (prev = pos - 1; prev >= line && (*prev == ' ' || *prev == '\t'); prev--);
+      if ((next[0] == '=' && next[1] != '=')
+       || (strchr("+-*/%&|^", next[0]) && next[1] == '=')
+       || (next[0] == '<' && next[1] == '<' && next[2] == '=')
+       || (next[0] == '>' && next[1] == '>' && next[2] == '=')
+       || (next[0] == '+' && next[1] == '+') || (next[0] == '-' && next[1] == '-'))
+        found = 1;
+      else if (prev >= line && (
+          (*prev == '&' && (prev == line || prev[-1] != '&'))
+       || (prev > line && ((*prev == '+' && prev[-1] == '+') || (*prev == '-' && prev[-1] == '-')))))
+        found = 1;
+      else
+        for (i = 0; i < sizeof(codeblock_output_macros)/sizeof(*codeblock_output_macros); i++)
+          if ((macro = strstr(line, codeblock_output_macros[i])) && macro < pos
+            && (macro == line || !(isalnum(macro[-1]) || macro[-1] == '_')))
+            found = 1;
+    }
+  list_iterate_end(liter);
+  return found;
+} /* codeblock_modifies */
+
+/* *****************************************************************************
+* codeblock_writes: returns 1 when the code may write into the variable id:
+* codeblock_modifies, or id is indexed, dereferenced, a structure whose member
+* is accessed, or a function argument.
+***************************************************************************** */
+static int
+codeblock_writes(struct code_block *code, char *id)
+{
+  List_handle liter;
+  char *line, *pos, *next;
+  int len = strlen(id), found = 0;
+
+  if (!code || list_len(code->lines) <= 0) return 0;
+  if (codeblock_modifies(code, id)) return 1;
+  liter = list_iterate(code->lines);
+  while(!found && (line = (char*) list_next(liter)))
+    for (pos = strstr(line, id); pos && !found; pos = strstr(pos + len, id)) {
+      if ((pos > line && (isalnum(pos[-1]) || pos[-1] == '_'))
+       || isalnum(pos[len]) || pos[len] == '_')
+        continue;             /* part of another identifier */
+      for (next = pos + len; *next == ' ' || *next == '\t'; next++);
+      if (strchr("[.,)", next[0]) || (next[0] == '-' && next[1] == '>')
+       || (pos > line && pos[-1] == '*'))
+        found = 1;
+    }
+  list_iterate_end(liter);
+  return found;
+} /* codeblock_writes */
+
+/* *****************************************************************************
+* codeblock_uses: returns 1 when one of the words is in the code.
+***************************************************************************** */
+static int
+codeblock_uses(struct code_block *code, char **words, int n)
+{
+  List_handle liter;
+  char *line;
+  int found = 0, i;
+
+  if (!code || list_len(code->lines) <= 0) return 0;
+  liter = list_iterate(code->lines);
+  while(!found && (line = (char*) list_next(liter)))
+    for (i = 0; i < n && !found; i++)
+      found = strstr(line, words[i]) != NULL;
+  list_iterate_end(liter);
+  return found;
+} /* codeblock_uses */
+
+/* *****************************************************************************
+* codeblock_has: returns 1 when the identifier id is in the code.
+***************************************************************************** */
+static int
+codeblock_has(struct code_block *code, char *id)
+{
+  List_handle liter;
+  char *line, *pos;
+  int len = strlen(id), found = 0;
+
+  if (!code || list_len(code->lines) <= 0) return 0;
+  liter = list_iterate(code->lines);
+  while(!found && (line = (char*) list_next(liter)))
+    for (pos = strstr(line, id); pos && !found; pos = strstr(pos + len, id))
+      found = !((pos > line && (isalnum(pos[-1]) || pos[-1] == '_'))
+        || isalnum(pos[len]) || pos[len] == '_');
+  list_iterate_end(liter);
+  return found;
+} /* codeblock_has */
+
+/* *****************************************************************************
+* cogen_literal: returns 1 when the value val of a parameter of the given type
+* is a literal: a decimal number (an integer for int parameters), a string,
+* a {...} vector, or NULL.
+***************************************************************************** */
+static int
+cogen_literal(char *val, enum instr_formal_types type)
+{
+  char *end;
+
+  if (!val || !*val) return 0;
+  if (type == instr_type_string || type == instr_type_vector) {
+    if (!strcmp(val, "NULL") || !strcmp(val, "0")) return 1;
+    if (type == instr_type_vector) return val[0] == '{';
+    return val[0] == '"' && strchr(val + 1, '"') == val + strlen(val) - 1;
+  }
+  if (type == instr_type_int) strtol(val, &end, 10);
+  else if (type == instr_type_double) strtod(val, &end);
+  else return 0;
+  while (*end == ' ') end++;
+  return !*end && !strpbrk(val, "xXnN");
+} /* cogen_literal */
+
+/* *****************************************************************************
+* cogen_const_par: returns the literal value of the setting parameter c_formal
+* of the component type of comp when it is a constant of the class functions,
+* else NULL. The parameter must be a number with the same literal value in all
+* instances of the type, and never be modified by the component code or the
+* EXTEND blocks of its instances. Disabled with --no-fold.
+***************************************************************************** */
+static char *
+cogen_const_par(struct comp_inst *comp, struct comp_iformal *c_formal)
+{
+  List_handle liter;
+  struct comp_inst *inst;
+  struct comp_def *def = comp->def;
+  struct Symtab_entry *entry;
+  char *val, *literal = NULL;
+  double value = 0;
+  int constant = 1;
+
+  if (!instrument_definition->fold_parameters
+    || (c_formal->type != instr_type_double && c_formal->type != instr_type_int))
+    return NULL;
+  if (codeblock_modifies(def->init_code,    c_formal->id)
+   || codeblock_modifies(def->trace_code,   c_formal->id)
+   || codeblock_modifies(def->save_code,    c_formal->id)
+   || codeblock_modifies(def->finally_code, c_formal->id)
+   || codeblock_modifies(def->display_code, c_formal->id))
+    return NULL;
+
+  liter = list_iterate(instrument_definition->complist);
+  while(constant && (inst = (comp_inst*) list_next(liter))) {
+    if (strcmp(inst->def->name, def->name)) continue;
+    if (codeblock_modifies(inst->extend, c_formal->id)
+      || !(entry = symtab_lookup(inst->setpar, c_formal->id))) {
+      constant = 0; break;
+    }
+    val = exp_tostring((cexp*) entry->val);
+    if (!cogen_literal(val, c_formal->type)) constant = 0;
+    else if (!literal) { literal = val; value = strtod(val, NULL); continue; }
+    else if (strtod(val, NULL) != value) constant = 0;
+    str_free(val);
+  }
+  list_iterate_end(liter);
+  if (!constant && literal) { str_free(literal); literal = NULL; }
+  return literal;
+} /* cogen_const_par */
+
+/* *****************************************************************************
+* cogen_exp_params: appends to deps (" name name ") the instrument parameters
+* which the expression e refers to. Returns 0 when e may depend on any of them:
+* it uses an instrument DECLARE variable, which its INITIALIZE may compute, or
+* reads parameters through GETPAR.
+***************************************************************************** */
+static int
+cogen_exp_params(CExp e, char **deps)
+{
+  char *prefix = (char*) "_instrument_var._parameters.";
+  char *s, *p, *id, *word, *pad, *old;
+  int   len, plen = strlen(prefix), keep = 1;
+
+  if (!e) return 1;
+  s = exp_tostring(e);
+  for (p = s; keep && *p; p += len) {
+    len = 1;
+    if (*p == '"') {          /* skip string literals */
+      for (len = 1; p[len] && p[len] != '"'; len++)
+        if (p[len] == '\\' && p[len + 1]) len++;
+      if (p[len]) len++;
+      continue;
+    }
+    if (!(isalpha(*p) || *p == '_') || (p > s && (isalnum(p[-1]) || p[-1] == '_')))
+      continue;
+    if (!strncmp(p, prefix, plen)) {
+      id = p + plen;
+      for (len = 0; isalnum(id[len]) || id[len] == '_'; len++);
+      word = str_dup_n(id, len);
+      pad  = str_cat((char*) " ", word, (char*) " ", NULL);
+      if (!strstr(*deps, pad)) {
+        old = *deps;
+        *deps = str_cat(old, word, (char*) " ", NULL);
+        str_free(old);
+      }
+      str_free(pad);
+      str_free(word);
+      len += plen;
+      continue;
+    }
+    for (len = 0; isalnum(p[len]) || p[len] == '_'; len++);
+    if (p > s && (p[-1] == '.' || (p[-1] == '>' && p > s + 1 && p[-2] == '-')))
+      continue;               /* structure member */
+    word = str_dup_n(p, len);
+    if (strstr(word, "GETPAR") || !strcmp(word, "_instrument_var")
+     || codeblock_has(instrument_definition->decls, word))
+      keep = 0;
+    str_free(word);
+  }
+  str_free(s);
+  return keep;
+} /* cogen_exp_params */
+
+/* *****************************************************************************
+* cogen_scan_deps: returns the instrument parameters (as " name name ") which
+* the INITIALIZE of the component instance depends on, when it may be done
+* once for all the points of a --scan --scan-keep, else NULL. mcscan_keeps
+* then keeps it when the scan assigns none of them. These are the parameters
+* in its setting parameter values, and, when its INITIALIZE reads positions
+* (e.g. for a target_index), those in the AT and ROTATED of all instances.
+* Its INITIALIZE must not read other instrument data or random numbers, set
+* the ncount or write in the output directory, and it must have no SAVE
+* (detectors are initialised again at each point).
+* The _parameters after its INITIALIZE are restored at each point, which undoes
+* the changes of its TRACE and EXTEND, but not those of the data they point
+* to: tables read by INITIALIZE are shared by all points. Positions are set at
+* each point.
+***************************************************************************** */
+static char *cogen_scan_init_words[] = {
+  (char*) "_instrument_var", (char*) "instrument->", (char*) "GETPAR",
+  (char*) "rand", (char*) "mcset_ncount", (char*) "dirname" };
+static char *cogen_scan_pos_words[] = {
+  (char*) "POS_", (char*) "ROT_", (char*) "_position_", (char*) "_rotation_" };
+
+static char *
+cogen_scan_deps(struct comp_inst *comp)
+{
+  List_handle liter;
+  struct comp_def *def = comp->def;
+  struct comp_inst *inst;
+  struct comp_iformal *par;
+  struct Symtab_entry *entry;
+  char *deps;
+  int keep = 1;
+
+  if (list_len(def->init_code->lines) <= 0 || list_len(def->save_code->lines) > 0
+   || codeblock_uses(def->init_code, cogen_scan_init_words,
+        sizeof(cogen_scan_init_words)/sizeof(*cogen_scan_init_words)))
+    return NULL;
+  deps = str_dup((char*) " ");
+  liter = list_iterate(def->set_par);
+  while(keep && (par = (comp_iformal*) list_next(liter)))
+    if ((entry = symtab_lookup(comp->setpar, par->id)))
+      keep = cogen_exp_params((CExp) entry->val, &deps);
+  list_iterate_end(liter);
+  if (keep && codeblock_uses(def->init_code, cogen_scan_pos_words,
+        sizeof(cogen_scan_pos_words)/sizeof(*cogen_scan_pos_words))) {
+    liter = list_iterate(instrument_definition->complist);
+    while(keep && (inst = (comp_inst*) list_next(liter)))
+      keep = cogen_exp_params(inst->pos->place.x, &deps)
+        && cogen_exp_params(inst->pos->place.y, &deps)
+        && cogen_exp_params(inst->pos->place.z, &deps)
+        && cogen_exp_params(inst->pos->orientation.x, &deps)
+        && cogen_exp_params(inst->pos->orientation.y, &deps)
+        && cogen_exp_params(inst->pos->orientation.z, &deps);
+    list_iterate_end(liter);
+  }
+  if (!keep) { str_free(deps); deps = NULL; }
+  return deps;
+} /* cogen_scan_deps */
+
 /* *****************************************************************************
 * cogen_defundef: define/undefine a symbol from a List
 * input:  a list
 *         a flag: GLOBAL_INSTANCE_PAR_VALUE=define with component name,
 *                 LOCAL_INSTANCE_PAR_VALUE =define with 'comp' as structure name,
+*                                           or as constant (cogen_const_par),
 *                 INSTRUMENT_PAR_VALUE     =define with 'instrument_name' as structure name
 *                 GLOBAL_INSTANCE_PAR_REF  =define with component name pointer,
 *                 PAR_UNDEF                =un-define
@@ -363,6 +698,7 @@ static void cogen_defundef(struct comp_inst *comp, List l, char define_it)
   if(list_len(l) > 0) {
     List_handle liter;
     struct comp_iformal *c_formal;/* Name of component formal input parameter */
+    char *val;
 
     liter = list_iterate(l);
     while((c_formal = (comp_iformal*) list_next(liter))) {
@@ -376,8 +712,13 @@ static void cogen_defundef(struct comp_inst *comp, List l, char define_it)
           c_formal->id, comp->name, c_formal->id);
         break;
       case LOCAL_INSTANCE_PAR_REF:
-        coutf( "  #define %s (_comp->_parameters.%s)",
-          c_formal->id, c_formal->id);
+        if (l == comp->def->set_par && (val = cogen_const_par(comp, c_formal))) {
+          coutf( "  #define %s ((%s)%s) /* constant in all instances */",
+            c_formal->id, instr_formal_type_names_real[c_formal->type], val);
+          str_free(val);
+        } else
+          coutf( "  #define %s (_comp->_parameters.%s)",
+            c_formal->id, c_formal->id);
         break;
       case INSTRUMENT_PAR_VALUE:
         /* instrument parameters, only when no conflict with component */
@@ -447,6 +788,7 @@ int cogen_comp_declare(struct comp_inst *comp)
 {
     int warnings = 0;
     int nb_parameters = 0;
+    char *deps;
 
     if (!comp->def->flag_defined_structure) {
         // only once
@@ -580,6 +922,11 @@ int cogen_comp_declare(struct comp_inst *comp)
     /* instantiate one structure per component instance */
     coutf("_class_%s _%s_var;", comp->def->name, comp->name);
     coutf("#pragma acc declare create ( _%s_var )", comp->name);
+    if ((deps = cogen_scan_deps(comp))) { /* its state after INITIALIZE, for --scan-keep */
+      coutf("_class_%s_parameters _%s_scan_state;", comp->def->name, comp->name);
+      coutf("int _%s_scan_keep = 0;", comp->name);
+      str_free(deps);
+    }
     coutf("");
 
     return(warnings);
@@ -757,7 +1104,7 @@ static void cogen_comp_init_position(
   coutf("    _%s_var._position_relative = rot_apply(_%s_var._rotation_absolute, tc1);", comp->name, comp->name);
   coutf("  } /* %s=%s() AT ROTATED */", comp->name, comp->def->name);
 
-  coutf("  DEBUG_COMPONENT(\"%s\", _%s_var._position_absolute, _%s_var._rotation_absolute);", comp->name, comp->name, comp->name);
+  coutf("  DEBUG_COMPONENT(\"%s\", _%s_var._position_absolute, _%s_var._rotation_absolute, %i);", comp->name, comp->name, comp->name, comp->index);
   coutf("  instrument->_position_absolute[%i] = _%s_var._position_absolute;", comp->index, comp->name);
   coutf("  instrument->_position_relative[%i] = _%s_var._position_relative;", comp->index, comp->name);
 
@@ -1013,6 +1360,8 @@ int cogen_comp_setpos(
   coutf("  int current_setpos_index = %d;", comp->index);
 
   /* setting & output parameters of the component */
+  coutf("  if (mcscan.index) /* each --scan point starts as a separate run */");
+  coutf("    memset(&_%s_var._parameters, 0, sizeof(_%s_var._parameters));", comp->name, comp->name);
   cogen_comp_init_par(comp, instr, (char*) "SETTING");  // specific to each instance
   cogen_comp_init_par(comp, instr, (char*) "PRIVATE");  // specific to each instance
 
@@ -1135,6 +1484,25 @@ void cogen_getcompindex_fct(struct instr_def *instr){
   cout("");
 }
 
+/*
+ * Generates the function that returns the name of a component from its index,
+ * or NULL when out of range (reverse of _getcomp_index)
+ */
+void cogen_getcompname_fct(struct instr_def *instr){
+  cout("char *_getcomp_name(int index)");
+  cout("{");
+  List_handle iter;
+  iter = list_iterate(instr->complist);
+  struct comp_inst *comp;
+  while ((comp = (comp_inst*) list_next(iter)) != NULL) {
+    coutf("  if (index == %i) return \"%s\";", comp->index, comp->name);
+  }
+  list_iterate_end(iter);
+  cout("  return NULL;");
+  cout("}");
+  cout("");
+}
+
 void cogen_getdistance_fct(){
   cout("double index_getdistance(int first_index, int second_index)");
   cout("/* Calculate the distance two components from their indexes*/");
@@ -1410,6 +1778,33 @@ int cogen_decls(struct instr_def *instr)
   return(warnings);
 } /* cogen_decls */
 
+/* *****************************************************************************
+* is_checkpoint_type: tells if a DECLARE variable type is a plain number (or
+*   a fixed array of numbers), which can be written in checkpoints as is.
+*   Pointers and structures are left to the components (mccheckpoint_add).
+***************************************************************************** */
+int is_checkpoint_type(char *type)
+{
+  static const char *numeric_types[] = {
+    "double", "MCNUM", "float", "int", "long", "long int", "long long",
+    "long long int", "unsigned", "unsigned int", "unsigned long",
+    "unsigned long int", "unsigned long long", "unsigned long long int",
+    "int32_t", "uint32_t", "int64_t", "uint64_t", NULL };
+  char norm[256];
+  int  i, j = 0, space = 0;
+
+  if (!type || strchr(type, '*')) return 0;
+  for (i = 0; type[i] && j < (int)sizeof(norm)-1; i++) {
+    if (isspace((unsigned char)type[i])) { space = j > 0; continue; }
+    if (space) { norm[j++] = ' '; space = 0; }
+    norm[j++] = type[i];
+  }
+  norm[j] = '\0';
+  for (i = 0; numeric_types[i]; i++)
+    if (!strcmp(norm, numeric_types[i])) return 1;
+  return 0;
+} /* is_checkpoint_type */
+
 
 /* *****************************************************************************
 * cogen_section: write a section part from the instrument description
@@ -1572,7 +1967,26 @@ int cogen_section(struct instr_def *instr, char *section, char *section_lower,
 
     if (list_len(comp_code->lines) > 0) {
       /* each component is called once, iteratively */
-      coutf("  class_%s_%s(&_%s_var);", comp->def->name, section_lower, comp->name);
+      char *deps = NULL;
+      if (strcmp(section, "INITIALISE") && strcmp(section, "FINALLY"))
+        coutf("  class_%s_%s(&_%s_var);", comp->def->name, section_lower, comp->name);
+      else if (!(deps = cogen_scan_deps(comp)))
+        coutf("  class_%s_%s(&_%s_var);", comp->def->name, section_lower, comp->name);
+      else if (!strcmp(section, "INITIALISE")) {
+        coutf("  if (mcscan.index && _%s_scan_keep) /* --scan-keep: as initialised at the first point */",
+          comp->name);
+        coutf("    _%s_var._parameters = _%s_scan_state;", comp->name, comp->name);
+        cout( "  else {");
+        coutf("    class_%s_%s(&_%s_var);", comp->def->name, section_lower, comp->name);
+        coutf("    if ((_%s_scan_keep = mcscan_keeps(\"%s\")))", comp->name, deps);
+        coutf("      _%s_scan_state = _%s_var._parameters;", comp->name, comp->name);
+        cout( "  }");
+      } else {
+        coutf("  if (!_%s_scan_keep || mcscan.index + 1 >= mcscan.count) /* last point of a --scan-keep */",
+          comp->name);
+        coutf("  class_%s_%s(&_%s_var);", comp->def->name, section_lower, comp->name);
+      }
+      if (deps) str_free(deps);
     }
     cout("");
   }
@@ -1580,6 +1994,20 @@ int cogen_section(struct instr_def *instr, char *section, char *section_lower,
 
   /* end the instrument sequential comps calls section */
   if (!strcmp(section, "INITIALISE")) {
+    /* register numeric DECLARE variables for --checkpoint/--resume */
+    liter = list_iterate(instr->complist);
+    while((comp = (comp_inst*) list_next(liter)) != NULL) {
+      List_handle liter2;
+      struct comp_iformal *declvar;
+      if (!comp->def->decl_par) continue;
+      liter2 = list_iterate(comp->def->decl_par);
+      while((declvar = (comp_iformal*) list_next(liter2)))
+        if (is_checkpoint_type(declvar->type_custom))
+          coutf("  mccheckpoint_add(\"%s.%s\", &_%s_var._parameters.%s, sizeof(_%s_var._parameters.%s));",
+            comp->name, declvar->id, comp->name, declvar->id, comp->name, declvar->id);
+      list_iterate_end(liter2);
+    }
+    list_iterate_end(liter);
     /* Output graphics representation of components. */
     coutf("  if (mcdotrace) display();");
     cout("  DEBUG_INSTR_END();");
@@ -1597,8 +2025,11 @@ int cogen_section(struct instr_def *instr, char *section, char *section_lower,
     cout("#pragma acc update device(_instrument_var)");
     cout("#endif");
   }
-  else if (!strcmp(section, "SAVE"))
+  else if (!strcmp(section, "SAVE")) {
+    if (instr->enable_profile)
+      coutf("  mcprofile_save(); /* --profile */");
     coutf("  if (!handle) siminfo_close(); ");
+  }
   else if (!strcmp(section, "FINALLY")) {
     coutf("  siminfo_close(); ");
   }
@@ -1609,6 +2040,26 @@ int cogen_section(struct instr_def *instr, char *section, char *section_lower,
   coutf("} /* %s */", section_lower);
   cout("");
 
+  /* SAVE of a single component, for the precision probe of --target-error */
+  if (!strcmp(section, "SAVE")) {
+    cout("int _savecomp(int index) { /* returns 0 when the component has no SAVE */");
+    cout("  switch (index) {");
+    liter = list_iterate(instr->complist);
+    while((comp = (comp_inst*) list_next(liter)) != NULL) {
+      if (list_len(comp->def->save_code->lines) > 0) {
+        coutf("    case %i:", comp->index);
+        coutf("#pragma acc update host(_%s_var)", comp->name);
+        coutf("      class_%s_save(&_%s_var);", comp->def->name, comp->name);
+        cout("      return(1);");
+      }
+    }
+    list_iterate_end(liter);
+    cout("  }");
+    cout("  return(0);");
+    cout("} /* _savecomp */");
+    cout("");
+  }
+
   return(warnings);
 } /* cogen_section */
 
@@ -1658,10 +2109,10 @@ void def_trace_section(struct instr_def *instr)
   coutf("#define %s (_particle->%s)", "RESTORE"  , "_restore");
 #if MCCODE_PROJECT == 1     /* neutron */
   coutf("#define RESTORE_NEUTRON(_index, ...) _particle->_restore = _index;");
-  cout( "#define ABSORB0 do { DEBUG_STATE(); DEBUG_ABSORB(); MAGNET_OFF; ABSORBED++; return; } while(0)");
+  cout( "#define ABSORB0 do { DEBUG_STATE(); DEBUG_ABSORB(); MCPROGRESS_ABSORB(INDEX_CURRENT_COMP); MAGNET_OFF; ABSORBED++; return; } while(0)");
 #elif MCCODE_PROJECT == 2   /* xray */
   coutf("#define RESTORE_XRAY(_index, ...) _particle->_restore = _index;");
-  cout( "#define ABSORB0 do { DEBUG_STATE(); DEBUG_ABSORB(); ABSORBED++; return; } while(0)");
+  cout( "#define ABSORB0 do { DEBUG_STATE(); DEBUG_ABSORB(); MCPROGRESS_ABSORB(INDEX_CURRENT_COMP); ABSORBED++; return; } while(0)");
 #endif
   coutf("#define %s (_particle->%s)", "ABSORBED" , "_absorbed");
   /* define mcget_run_num within trace scope to refer to the particle */
@@ -1777,7 +2228,7 @@ int cogen_trace_functions(struct instr_def *instr)
 *          and next comp in GROUP is tested.
 *   JUMP:  sends _particle to the JumpTrace labels, either with condition
 *          or condition is (counter < iterations)
-*   SPLIT: loops from comp/group TRACE to END, incrementing mcrun_num
+*   SPLIT: loops from comp/group TRACE to END
 ***************************************************************************** */
 int cogen_raytrace(struct instr_def *instr)
 {
@@ -1917,7 +2368,7 @@ int cogen_raytrace(struct instr_def *instr)
       coutf("      mccoordschange(_%s_var._position_relative, _%s_var._rotation_relative, &_particle_save);", comp->name, comp->name);
     }
     if (comp->skip_transform == 0) {
-      coutf("      DEBUG_COMP(_%s_var._name);", comp->name);
+      coutf("      DEBUG_COMP(_%s_var._name, %i);", comp->name, comp->index);
       cout ("      DEBUG_STATE();");
     }
     /* call the component when there are TRACE and/or EXTEND lines */
@@ -1928,6 +2379,14 @@ int cogen_raytrace(struct instr_def *instr)
         coutf("      if ((%s)) // conditional WHEN execution", exp);
         str_free(exp);
       }
+      if (instr->enable_profile) {
+        coutf("      { MCPROFILE_ENTER(); /* --profile */");
+        coutf("        class_%s_trace(&_%s_var, _particle);%s",
+          comp->def->name,
+          comp->name,
+          list_len(comp->extend->lines) ? " /* contains EXTEND code */" : "");
+        coutf("        MCPROFILE_LEAVE(%i); }", comp->index);
+      } else
       coutf("      class_%s_trace(&_%s_var, _particle);%s",
         comp->def->name,
         comp->name,
@@ -2048,6 +2507,8 @@ int cogen_raytrace(struct instr_def *instr)
   coutf("  }");
   coutf("    #endif");
   coutf("");
+  if (instr->enable_profile)
+    coutf("  mcprofile_start();");
   coutf("  for (unsigned long long cloop=0; cloop<loops; cloop++) {");
   coutf("    #ifdef OPENACC");
   coutf("    if (loops>1) fprintf(stdout, \"%%d..\", (int)cloop); fflush(stdout);");
@@ -2064,7 +2525,7 @@ int cogen_raytrace(struct instr_def *instr)
   cout("     #endif");
   coutf("");
   coutf("    #pragma acc parallel loop num_gangs(numgangs) vector_length(vecsize)");
-  coutf("    for (unsigned long pidx=0 ; pidx < gpu_innerloop ; pidx++) {");
+  coutf("    for (unsigned long pidx=MCCHECKPOINT_START ; pidx < gpu_innerloop ; pidx++) {");
   coutf("      _class_particle particleN = mcgenstate(); // initial particle");
   coutf("      _class_particle* _particle = &particleN;");
   coutf("      particleN._uid = pidx;");
@@ -2076,9 +2537,17 @@ int cogen_raytrace(struct instr_def *instr)
   coutf("      particle_uservar_init(_particle);");
   coutf("");
   coutf("      raytrace(_particle);");
+  coutf("      MCPROGRESS_EVENT();");
+  coutf("      #ifndef OPENACC");
+  coutf("      if (mcbound.stop) break; /* --time-limit, --target-error */");
+  coutf("      #endif");
   coutf("    } /* inner for */");
+  coutf("    MCPROGRESS_BATCH(gpu_innerloop);");
   coutf("    seed = seed+gpu_innerloop;");
+  coutf("    if (mcbound.stop) break;");
   coutf("  } /* CPU for */");
+  if (instr->enable_profile)
+    coutf("  mcprofile_stop();");
   coutf("  /* if on GPU, printf has been globally nullified, re-enable here */");
   cout("     #ifdef OPENACC");
   cout("     #undef strlen");
@@ -2184,6 +2653,8 @@ int cogen_rt_funnel(struct instr_def *instr)
   cout("  #define ABSORB0 do { DEBUG_ABSORB(); MAGNET_OFF; ABSORBED++; } while(0)");
   cout("  #define ABSORB ABSORB0");
 
+  if (instr->enable_profile)
+    coutf("  mcprofile_start();");
   // batches
   coutf("  // outer loop / particle batches");
   coutf("  for (unsigned long long cloop=0; cloop<loops; cloop++) {");
@@ -2278,6 +2749,14 @@ int cogen_rt_funnel(struct instr_def *instr)
         str_free(exp);
       }
       // TRACE
+      if (instr->enable_profile) {
+        coutf("        { MCPROFILE_ENTER(); /* --profile */");
+        coutf("          class_%s_trace(&_%s_var, _particle);%s",
+        comp->def->name,
+        comp->name,
+        list_len(comp->extend->lines) ? " /* contains EXTEND code */" : "");
+        coutf("          MCPROFILE_LEAVE(%i); }", comp->index);
+      } else
       coutf("        class_%s_trace(&_%s_var, _particle);%s",
       comp->def->name,
       comp->name,
@@ -2313,9 +2792,13 @@ int cogen_rt_funnel(struct instr_def *instr)
   cout( "");
   list_iterate_end(liter);
 
+  coutf("    mcprogress_add(gpu_innerloop);");
   coutf("    // jump to next viable seed");
   coutf("    seed = seed + gpu_innerloop;");
+  coutf("    if (mcbound.stop) break; /* --time-limit, --target-error */");
   coutf("  } // outer loop / particle batches");
+  if (instr->enable_profile)
+    coutf("  mcprofile_stop();");
   cout( "");
   coutf("  free(particles);");
   coutf("  free(pbuffer);");
@@ -2403,6 +2886,8 @@ cogen_header(struct instr_def *instr, char *output_name)
     cout("#define MC_USE_DEFAULT_MAIN");
   if(instr->enable_trace)
     cout("#define MC_TRACE_ENABLED");
+  if(instr->enable_profile)
+    cout("#define MC_PROFILE");
   if(instr->portable)
     cout("#define MC_PORTABLE");
 
@@ -2437,6 +2922,23 @@ cogen_header(struct instr_def *instr, char *output_name)
   cout("#define MC_NUSERVAR 10");
   cout("#endif");
   cout("");
+#if MCCODE_PROJECT == 1   /* neutron */
+  /* the magnet stack is stored in the particle when a component uses pol-lib */
+  if (symtab_lookup(lib_instances, (char*) "pol-lib")) {
+    cout("/* magnetic field descriptor, pushed on the particle magnet stack by pol-lib */");
+    cout("#ifndef MCMAGNET_STACKSIZE");
+    cout("#define MCMAGNET_STACKSIZE 12");
+    cout("#endif");
+    cout("typedef struct mcmagnet_field_info {");
+    cout("  int func_id;");
+    cout("  Rotation *rot;");
+    cout("  Coords *pos;");
+    cout("  double *field_parameters;");
+    cout("  int stop;");
+    cout("} mcmagnet_field_info;");
+    cout("");
+  }
+#endif
   List_handle liter,liter2;
   struct comp_inst *comp;        /* Component instance. */
 
@@ -2469,7 +2971,10 @@ cogen_header(struct instr_def *instr, char *output_name)
   cout("  double vx,vy,vz; /* velocity [m/s] */");
   cout("  double sx,sy,sz; /* spin [0-1] */");
   cout("  int mcgravitation; /* gravity-state */");
-  cout("  void *mcMagnet;    /* precession-state */");
+  cout("  int mcMagnet;     /* precession-state: number of fields on the magnet stack */");
+  cout("  int mcMagnetTop;  /* index of the top of the magnet stack (ring) */");
+  if (symtab_lookup(lib_instances, (char*) "pol-lib"))
+    cout("  mcmagnet_field_info mcMagnetStack[MCMAGNET_STACKSIZE]; /* magnet stack */");
   cout("  int allow_backprop; /* allow backprop */");
 #elif MCCODE_PROJECT == 2 /* xray */
   cout("  double kx,ky,kz; /* wave-vector */");
@@ -2558,7 +3063,7 @@ cogen_header(struct instr_def *instr, char *output_name)
 #if MCCODE_PROJECT == 1     /* neutron */
   cout("#pragma acc routine");
   cout("_class_particle mcsetstate(double x, double y, double z, double vx, double vy, double vz,");
-  cout("			   double t, double sx, double sy, double sz, double p, int mcgravitation, void *mcMagnet, int mcallowbackprop);");
+  cout("			   double t, double sx, double sy, double sz, double p, int mcgravitation, int mcMagnet, int mcallowbackprop);");
   cout("#pragma acc routine");
   cout("_class_particle mcgetstate(_class_particle mcneutron, double *x, double *y, double *z,");
   cout("                           double *vx, double *vy, double *vz, double *t,");
@@ -2574,13 +3079,13 @@ cogen_header(struct instr_def *instr, char *output_name)
   cout("");
   cout("extern int mcgravitation;      /* flag to enable gravitation */");
   cout("#pragma acc declare create ( mcgravitation )");
-  cout("int mcallowbackprop;        ");
+  cout("extern int mcallowbackprop;    /* flag to enable negative/backprop */");
   cout("#pragma acc declare create ( mcallowbackprop )");
 
   cout("");
   cout("_class_particle mcgenstate(void) {");
 #if MCCODE_PROJECT == 1     /* neutron */
-  cout("  _class_particle particle = mcsetstate(0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, mcgravitation, NULL, mcallowbackprop);");
+  cout("  _class_particle particle = mcsetstate(0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, mcgravitation, 0, mcallowbackprop);");
 #elif MCCODE_PROJECT == 2   /* xray */
   cout("  _class_particle particle = mcsetstate(0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, mcgravitation, NULL, mcallowbackprop);");
 #endif
@@ -2835,20 +3340,25 @@ cogen_header(struct instr_def *instr, char *output_name)
   }
   else
   {
+    /* runtime library (mccode_runtime target): only the functions depending
+       on the particle structure are compiled with the instrument */
     coutf("#include \"%s%sshare%smccode-r.h\"",  sysdir_new, pathsep, pathsep);
-    fprintf(stderr,"Dependency: %s.o\n", "mccode-r");
 #if MCCODE_PROJECT == 1     /* neutron */
     coutf("#include \"%s%sshare%smcstas-r.h\"",  sysdir_new, pathsep, pathsep);
-    fprintf(stderr,"Dependency: %s.o\n", "mcstas-r");
 #elif MCCODE_PROJECT == 2   /* xray */
     coutf("#include \"%s%sshare%smcxtrace-r.h\"",  sysdir_new, pathsep, pathsep);
-    fprintf(stderr,"Dependency: %s.o\n", "mcxtrace-r");
 #endif
-
-    fprintf(stderr,"Dependency: %s.o\n", "mcstas-r");
+    cout("#define MC_RUNTIME_PARTICLE");
+    coutf("#include \"%s%sshare%smccode-r.c\"",  sysdir_new, pathsep, pathsep);
+#if MCCODE_PROJECT == 1     /* neutron */
+    coutf("#include \"%s%sshare%smcstas-r.c\"",  sysdir_new, pathsep, pathsep);
+#elif MCCODE_PROJECT == 2   /* xray */
+    coutf("#include \"%s%sshare%smcxtrace-r.c\"",  sysdir_new, pathsep, pathsep);
+#endif
+    fprintf(stderr,"Dependency: %s\n", "mccode_runtime");
     fprintf(stderr,"Dependency: '-DUSE_NEXUS -lNeXus' to enable NeXus support\n");
-    fprintf(stderr,"To build instrument '%s', compile and link with these libraries (in %s%sshare)\n",
-      instrument_definition->quoted_source, sysdir_new, pathsep);
+    fprintf(stderr,"To build instrument '%s', compile and link with the runtime library (mccode_runtime, compiled with the same options); the %%include libraries are embedded\n",
+      instrument_definition->quoted_source);
   }
   cout("");
   cout("/* *****************************************************************************");
@@ -3213,8 +3723,10 @@ cogen(char *output_name, struct instr_def *instr)
 
 
   cogen_getcompindex_fct(instr);
+  cogen_getcompname_fct(instr);
 
-  embed_file((char*) "metadata-r.c"); // functions used to query and display instrument/component-defined metadata strings
+  if (instr->include_runtime) /* else in the runtime library */
+    embed_file((char*) "metadata-r.c"); // functions used to query and display instrument/component-defined metadata strings
   embed_file((char*) "mccode_main.c");
 
   if (verbose && warnings)
@@ -45,6 +45,10 @@ static char *sys_subdir_table[] =
 
 
 
+/* This variable stores the full path of the last file opened by
+   try_open_file() (called from open_file_search()). */
+char *file_pathname = NULL;
+
 /* Attempt to open FILE in directory DIR (or current directory if DIR is
    NULL). */
 static FILE *
@@ -53,7 +57,13 @@ try_open_file(char *dir, char *name)
   char *path =
     dir != NULL ? str_cat (dir, MC_PATHSEP_S, name, NULL) : str_dup(name);
   FILE *f = fopen(path, "r");
-  str_free(path);
+  if(f != NULL)
+  {
+    if(file_pathname) str_free(file_pathname);
+    file_pathname = path;
+  }
+  else
+    str_free(path);
   return f;
 }
 
@@ -1085,7 +1085,7 @@ int mcformat_output(struct McStas_file_format McStasStruct)
     if (!mcstartdate) sscanf(McStasStruct.Date, "Simulation started %ld", &mcstartdate);
   }
   mcgravitation       = (McStasStruct.gravitation && strstr(McStasStruct.gravitation, "yes") ? 1 : 0);
-  mcrun_num = McStasStruct.RunNum;
+  mcprogress.events = McStasStruct.RunNum;
   mcncount  = McStasStruct.Ncount;
   strncpy(instrument_source, str_dup(McStasStruct.Source), CHAR_BUF_LENGTH);
   strncpy(instrument_name  , str_last_word(McStasStruct.InstrName), CHAR_BUF_LENGTH);
@@ -77,6 +77,47 @@ void adapt_tree_add(struct adapt_tree *t, int i, adapt_t v)
     s[j - step] -= v;
 }
 
+/*******************************************************************************
+* Stage v as the new value of v[i]. The tree is folded by adapt_tree_merge,
+* called here every t->interval staged values, so that searches see the
+* distribution change at these merge points only. When a bin is staged more
+* than once before a merge, the last value is used. With an interval of 1 the
+* value is added to the tree at once. Not thread safe: callers must stage,
+* merge and search serially.
+*******************************************************************************/
+void adapt_tree_stage(struct adapt_tree *t, int i, adapt_t v)
+{
+  if(t->interval <= 1)
+  {
+    adapt_tree_add(t, i, v - t->v[i]);
+    return;
+  }
+  t->w[i] = v;
+  if(!t->dirty[i])
+  {
+    t->dirty[i] = 1;
+    t->staged_bins[t->nstaged++] = i;
+  }
+  if(++t->staged % t->interval == 0)
+    adapt_tree_merge(t);
+}
+
+/*******************************************************************************
+* Fold the staged values into the tree, in staging order. Call once more at
+* the end of the run (e.g. in FINALLY) to flush the last staged values.
+*******************************************************************************/
+void adapt_tree_merge(struct adapt_tree *t)
+{
+  int i, k;
+  for(k = 0; k < t->nstaged; k++)
+  {
+    i = t->staged_bins[k];
+    t->dirty[i] = 0;
+    adapt_tree_add(t, i, t->w[i] - t->v[i]);
+  }
+  t->nstaged = 0;
+}
+
 /*******************************************************************************
 * Initialise an adaptive search tree. The tree has N nodes, and all nodes are
 * initialized to zero. Any N > 0 is allowed, but is rounded up to the nearest
@@ -98,8 +139,11 @@ adapt_tree_init(int N)
   {
     t->s = malloc((N + 1) * sizeof(*(t->s)));
     t->v = malloc(N * sizeof(*(t->v)));
+    t->w = malloc(N * sizeof(*(t->w)));
+    t->dirty = malloc(N * sizeof(*(t->dirty)));
+    t->staged_bins = malloc(N * sizeof(*(t->staged_bins)));
   }
-  if(!(t && t->s && t->v))
+  if(!(t && t->s && t->v && t->w && t->dirty && t->staged_bins))
   {
     fprintf(stderr, "Error: Out of memory (adapt_tree_init).\n");
     exit(1);
@@ -108,10 +152,15 @@ adapt_tree_init(int N)
   t->depth = depth;
   t->root = (1 << t->depth) - 1;
   t->initstep = (1 << (t->depth - 1));
+  t->interval = N;
+  t->staged = 0;
+  t->nstaged = 0;
   for(i = 0; i < t->N; i++)
   {
     t->s[i] = 0.0;
     t->v[i] = 0.0;
+    t->w[i] = 0.0;
+    t->dirty[i] = 0;
   }
   t->s[i] = 0.0;
   t->total = 0.0;
@@ -124,6 +173,9 @@ adapt_tree_init(int N)
 void
 adapt_tree_free(struct adapt_tree *t)
 {
+  free(t->staged_bins);
+  free(t->dirty);
+  free(t->w);
   free(t->v);
   free(t->s);
   free(t);
@@ -36,15 +36,27 @@ typedef double adapt_t;
 * The s array runs from 0 to N and is used to represents the cumulative sum
 * of v[0] through v[i-1]. The number represented is the sum of s[i] and all
 * its parents up to the root node.
+* The w array holds values staged by adapt_tree_stage. They are folded into v
+* and s by adapt_tree_merge every 'interval' staged values, so that searches
+* see a tree that only changes at these merge points. The staged bins are
+* listed in 'staged_bins', so that a merge costs O(log N) per staged bin.
+* The tree is not synchronised: it must be used serially (components are
+* NOACC).
 *******************************************************************************/
 
 struct adapt_tree
   {
     adapt_t *s, *v, total;
+    adapt_t *w;   /* staged values of v, N elements */
+    int *dirty;   /* non zero for bins staged since the last merge */
+    int *staged_bins; /* indices of these bins, in staging order */
+    int nstaged;  /* number of staged_bins */
     int N;      /* < 1 << (depth+1) */
     int depth;
     int root;     /* = (1 << depth) - 1 */
     int initstep;   /* = 1 << (depth-1) */
+    long interval; /* number of staged values between merges, default N */
+    long staged;  /* number of staged values so far */
   };
 
 /* adapt_tree-lib function prototypes */
@@ -53,6 +65,10 @@ struct adapt_tree
 int adapt_tree_search(struct adapt_tree *t, adapt_t v);
 #pragma acc routine
 void adapt_tree_add(struct adapt_tree *t, int i, adapt_t v);
+#pragma acc routine
+void adapt_tree_stage(struct adapt_tree *t, int i, adapt_t v);
+#pragma acc routine
+void adapt_tree_merge(struct adapt_tree *t);
 struct adapt_tree * adapt_tree_init(int N);
 void adapt_tree_free(struct adapt_tree *t);
 
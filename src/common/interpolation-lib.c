@@ -21,13 +21,15 @@
 * public function:
 * interpolator = interpolator_load(filename, 0, 0, NULL);
 *   or
-* interpolator = interpolator_load(filename, space_dim, field_dim, "regular" or "kdtree");
+* interpolator = interpolator_load(filename, space_dim, field_dim, "regular", "linear", "kdtree" or "resample");
 *
 * interpolator_info(interpolator);
 * 
 * interpolator_interpolate(interpolator, {x,y,z...}, {bx,by,bz...});
 *   or 
 * interpolator_interpolate3_3(interpolator, x,y,z, &bx,&by,&bz);
+*   or, for n points stored as [n][space_dim] -> [n][field_dim]
+* interpolator_interpolate_batch(interpolator, n, space, field);
 * 
 * interpolator_save(interpolator);
 *
@@ -48,10 +50,8 @@
 * ---------------------------------------------------------------------------------
 * 1. On GPU's (NVIDIA/OpenACC) only the 'regular' interpolation method is available
 *    and us hence the 'default'. A GPU-compiled instrument will exit with an error
-*    if you decide to force 'kdtree' mode.
-*    ('kdtree' needs the macro R_SWAP which works node connectivity/placement in
-*      the loaded dataset structure - is thus not thread-safe. And difficult to
-*      make 'atomic' / would require 'one file content pr. neutron'... :-( )
+*    if you decide to force 'kdtree' mode, as the recursive k-d tree search is
+*    not offloaded. 'resample' may be used there, as long as the grid fits.
 *
 * 2. On CPU's the default is 'NULL'/0, meaning that the library will itself try to
 *    evaluate if a dataset is suitable for 'regular' or 'kdtree'. You may still
@@ -59,6 +59,15 @@
 *
 * 3. 'regular' means 'quite regular indeed'... Voxels in the volume MUST be of
 *    uniform size AND dimensions of the volume MUST be equal on all spatial axes.
+*
+* 4. 'linear' (or 'trilinear') uses the same grid as 'regular', but returns the
+*    multi-linear interpolation of the 2^dim surrounding grid elements instead of
+*    the nearest one. It is never selected automatically.
+*
+* 5. 'resample' builds the k-d tree and then resamples it onto a regular grid with
+*    as many bins as unique values along each axis, using 'regular' afterwards.
+*    The grid is limited to INTERPOLATOR_RESAMPLE_MAXMEM bytes (default 1 Gb),
+*    beyond which the k-d tree is kept.
 * ---------------------------------------------------------------------------------
 */
 
@@ -83,181 +92,186 @@
 // kdtree_squaredDistance: Calculate the standard Euclidean distance between 
 //   these two points in whatever dimension we are considering.
 #pragma acc routine
-double kdtree_squaredDistance(vertex* a, vertex* b)
+double kdtree_squaredDistance(double *a, double *b, int dim)
 {
   int i;
   double sum = 0;
-  if (!a || !b || a->space_dimensionality != b->space_dimensionality) return 0;
-  
-  for (i = 0; i < a->space_dimensionality; i++) {
-    sum += R_SQR(a->v[i] - b->v[i]);
+  for (i = 0; i < dim; i++) {
+    sum += R_SQR(a[i] - b[i]);
   }
   return sum;
 } // kdtree_squaredDistance
 
-/******************************************************************************/
-// kdtree_borderCheck: Check to see whether or not this node provides a better 
-//   nearest neighbour.
-#pragma acc routine
-void kdtree_borderCheck(vertex *v, treeNode *thisNode,
-                 vertex **currentBest, double *sDist)
-{
-  if (!thisNode || !v || !sDist) return;
-  
-  double thisDist = kdtree_squaredDistance(thisNode->point,v);
-  if (thisDist < *sDist)
-  {
-    *sDist        = thisDist;
-    *currentBest  = thisNode->point;
-  }
-  // Now recurse down the children, checking whether or not we should
-  // go both sides of the splitting plane, or just down one side.
-  int k = (thisNode->depth) % v->space_dimensionality;
-  if (R_SQR(thisNode->point->v[k] - v->v[k]) <= *sDist)
-  {
-   // The distance to the current spliting plane is less than our current
-   // estimate for the shortest distance, we are going to have to traverse
-   // both sides of the splitting plane.
-    kdtree_borderCheck(v, thisNode->lChild, currentBest, sDist);
-    kdtree_borderCheck(v, thisNode->rChild, currentBest, sDist);
-  } else {
-    // We only have to consider one side of the splitting plane.
-    if (thisNode->point->v[k] > (*currentBest)->v[k])
-      kdtree_borderCheck(v, thisNode->lChild, currentBest, sDist);
-    else
-      kdtree_borderCheck(v, thisNode->rChild, currentBest, sDist);
-  }
-} // kdtree_borderCheck
-
 /******************************************************************************/
 
 // kdtree_partition: Note we slightly modify the standard partition algorithm, 
 //   so that we can partition based on only one dimension of the pointset.
-#pragma acc routine
-int kdtree_partition(vertex **points, int d, int left, int right, int pivot)
+//   'perm' holds point indices into 'coords' ([points][dim] array).
+//   This is a three-way partition: on return [left,*lt-1] holds values below
+//   the pivot, [*lt,*gt] values equal to it and [*gt+1,right] values above, so
+//   that the many repeated coordinates of gridded data do not degrade it.
+void kdtree_partition(long *perm, double *coords, int dim, int d,
+                      long left, long right, long pivot, long *lt, long *gt)
 {
-  double pivotValue = points[pivot]->v[d];
-  int i;
-  int storeIndex = left;
-  
-  if (!points) return 0;
-
-  R_SWAP(points[pivot], points[right], vertex*);
-
-  for (i = left; i < right; i++) {
-    if (points[i]->v[d] < pivotValue) {
-      R_SWAP(points[storeIndex], points[i], vertex*);
-      storeIndex ++;
-    }
+  double pivotValue = coords[perm[pivot]*dim + d];
+  long i  = left;
+  long lo = left;
+  long hi = right;
+
+  while (i <= hi) {
+    double x = coords[perm[i]*dim + d];
+    if (x < pivotValue) {
+      R_SWAP(perm[lo], perm[i], long);
+      lo++; i++;
+    } else if (x > pivotValue) {
+      R_SWAP(perm[i], perm[hi], long);
+      hi--;
+    } else
+      i++;
   }
-  R_SWAP(points[right], points[storeIndex], vertex*);
-
-  return storeIndex;
+  *lt = lo;
+  *gt = hi;
 } // kdtree_partition
 
 /******************************************************************************/
 // kdtree_splitAboutMedian: Find the median in expected linear time. - We will 
-//   also pivot all the data about the found median, returning the integer giving
-//   the pivot value.
+//   also pivot all the data about the found median, so that the median ends at
+//   index (left+right)/2, smaller values before it and larger values after it.
 
-int kdtree_splitAboutMedian(vertex **points, int d, int left, int right)
+long kdtree_splitAboutMedian(long *perm, double *coords, int dim, int d,
+                             long left, long right)
 {
-  int k = (right-left)/2 +left;
-  if (!points) return 0;
+  long k = (right-left)/2 +left;
   
   // This isn't a perfect uniform distribution, but it doesn't really matter
   // for this application.
   while (left < right)
   {
-    int pivotIndex    = rand() % (right-left)+left;
-    int pivotNewIndex = kdtree_partition(points,d,left,right,pivotIndex);
-    if (k == pivotNewIndex)
+    long lt, gt;
+    long pivotIndex = rand() % (right-left)+left;
+    kdtree_partition(perm, coords, dim, d, left, right, pivotIndex, &lt, &gt);
+    if (k >= lt && k <= gt)
       return k;
-    else if (k < pivotNewIndex)
-      right = pivotNewIndex-1;
+    else if (k < lt)
+      right = lt-1;
     else
-      left  = pivotNewIndex+1;
+      left  = gt+1;
   }
 
-  return left;
+  return k;
 } // kdtree_splitAboutMedian
 
 /******************************************************************************/
-// kdtree_addToTree: create a kd-tree out of a point set
-treeNode* kdtree_addToTree(vertex **points, int left, int right, int depth)
+// kdtree_addToTree: order the index range [left,right] of perm as an implicit
+//   k-d tree: median at the middle, subtrees on each side. Expected O(n log n).
+void kdtree_addToTree(long *perm, double *coords, int dim,
+                      long left, long right, int depth)
 {
-  // We can modify the number of dimensions in use. This is defined in the
-  // header file.
+  long med;
+  if (right <= left) return;
 
-  if (right < left || !points) return NULL;
+  med = kdtree_splitAboutMedian(perm, coords, dim, depth % dim, left, right);
 
-  int d = depth % points[0]->space_dimensionality;
-
-  treeNode *node = malloc(sizeof(treeNode));
-  node->depth    = depth;
-
-  int med      = kdtree_splitAboutMedian(points, d, left, right);
-  node->point  = points[med];
-
-  node->lChild = kdtree_addToTree(points, left,  med-1, depth + 1);
-  node->rChild = kdtree_addToTree(points, med+1, right, depth + 1);
-
-  return node;
+  kdtree_addToTree(perm, coords, dim, left,  med-1, depth + 1);
+  kdtree_addToTree(perm, coords, dim, med+1, right, depth + 1);
 } // kdtree_addToTree
 
 /******************************************************************************/
-// kdtree_nearestNeighbour_helper: helper function for kdtree_nearestNeighbour
-//   used recursively until a close vertex is found
-#pragma acc routine
-void kdtree_nearestNeighbour_helper(vertex* v, treeNode *tree,
-                             vertex **bestV, double *bestDist)
+// kdtree_build: create a flattened kd-tree out of a point set given as
+//   coords [points][space_dim] and data [points][field_dim]. The arrays are
+//   copied in tree order. Returns NULL when out of memory.
+kdTree *kdtree_build(double *coords, double *data, long points,
+                     int space_dim, int field_dim)
 {
-  if (!v || !tree || !bestDist) return;
-  
-  int k = tree->depth % v->space_dimensionality;
-
-  int left = tree->point->v[k] > v->v[k];
-
-  treeNode *first  = left ? tree->lChild : tree->rChild;
-  treeNode *second = left ? tree->rChild : tree->lChild;
-
-  // investigate first child if present
-  if (first != NULL) {
-    kdtree_nearestNeighbour_helper(v, first, bestV, bestDist);
+  kdTree *tree = malloc(sizeof(kdTree));
+  long   *perm = malloc(points*sizeof(long));
+  long    i;
+  int     j;
+
+  if (tree) {
+    tree->points = points;
+    tree->space_dimensionality = space_dim;
+    tree->field_dimensionality = field_dim;
+    tree->coords = malloc(points*space_dim*sizeof(double));
+    tree->data   = malloc(points*field_dim*sizeof(double));
   }
-
-  // update result
-  double thisDist = kdtree_squaredDistance(tree->point, v);
-  if ((*bestV == NULL) || (thisDist < *bestDist)) {
-    *bestDist = thisDist;
-    *bestV    = tree->point;
+  if (!tree || !perm || !tree->coords || !tree->data) {
+    if (tree) { free(tree->coords); free(tree->data); free(tree); }
+    free(perm);
+    return NULL;
   }
 
-  // no second child to investigate
-  if (second == NULL) {
-    return;
+  for (i=0; i < points; i++) perm[i] = i;
+  kdtree_addToTree(perm, coords, space_dim, 0, points-1, 0);
+
+  for (i=0; i < points; i++) {
+    for (j=0; j < space_dim; j++)
+      tree->coords[i*space_dim+j] = coords[perm[i]*space_dim+j];
+    for (j=0; j < field_dim; j++)
+      tree->data[i*field_dim+j]   = data[perm[i]*field_dim+j];
   }
+  free(perm);
+  return tree;
+} // kdtree_build
 
-  // we only investigate second child if necessary
-  double treek = tree->point->v[k];
+/******************************************************************************/
+// kdtree_free: release a flattened kd-tree
+void kdtree_free(kdTree *tree)
+{
+  if (!tree) return;
+  free(tree->coords);
+  free(tree->data);
+  free(tree);
+} // kdtree_free
+
+/******************************************************************************/
+// kdtree_nearestNeighbour_helper: helper function for kdtree_nearestNeighbour
+//   used recursively on the index range [left,right] of the tree
+#pragma acc routine
+void kdtree_nearestNeighbour_helper(kdTree *tree, double *v,
+                             long left, long right, int depth,
+                             long *best, double *bestDist)
+{
+  while (left <= right) {
+    int    dim = tree->space_dimensionality;
+    long   med = (right-left)/2 + left;
+    int    k   = depth % dim;
+    double thisDist = kdtree_squaredDistance(tree->coords + med*dim, v, dim);
+    double diff     = v[k] - tree->coords[med*dim + k];
+
+    // update result
+    if (*best < 0 || thisDist < *bestDist) {
+      *bestDist = thisDist;
+      *best     = med;
+    }
 
-  if (R_SQR(treek - v->v[k]) <= *bestDist) {
-    kdtree_borderCheck(v, second, bestV, bestDist);
+    // investigate the side of the query first, the other side only when the
+    // splitting plane is closer than the current best
+    if (diff < 0) {
+      kdtree_nearestNeighbour_helper(tree, v, left, med-1, depth+1, best, bestDist);
+      if (R_SQR(diff) > *bestDist) return;
+      left = med+1;
+    } else {
+      kdtree_nearestNeighbour_helper(tree, v, med+1, right, depth+1, best, bestDist);
+      if (R_SQR(diff) > *bestDist) return;
+      right = med-1;
+    }
+    depth++;
   }
 } // kdtree_nearestNeighbour_helper
 
 /******************************************************************************/
-// kdtree_nearestNeighbour: find closest vertex in tree to given vertex coords
+// kdtree_nearestNeighbour: find closest point in tree to given coords.
+//   returns its index in the tree arrays, or -1 for an empty tree.
 #pragma acc routine
-vertex* kdtree_nearestNeighbour(vertex* v, treeNode *tree) {
-  vertex *bestV = NULL;
+long kdtree_nearestNeighbour(double *v, kdTree *tree) {
+  long   best = -1;
   double bestDist = 0;
-  if (!v || !tree) return NULL;
+  if (!v || !tree || tree->points <= 0) return -1;
 
-  kdtree_nearestNeighbour_helper(v, tree, &bestV, &bestDist);
-  v->data = bestV->data;
+  kdtree_nearestNeighbour_helper(tree, v, 0, tree->points-1, 0, &best, &bestDist);
   
-  return bestV;
+  return best;
 } // kdtree_nearestNeighbour
 
 #undef R_SQR
@@ -299,6 +313,7 @@ struct interpolator_struct *interpolator_init(void) {
   
   strcpy(interpolator->method,"NULL");
   strcpy(interpolator->filename,"NULL");
+  interpolator->method_id = INTERPOLATOR_NONE;
   interpolator->points = interpolator->space_dimensionality 
                        = interpolator->field_dimensionality = 0;
   interpolator->kdtree = NULL;
@@ -349,6 +364,66 @@ void interpolator_info(struct interpolator_struct *interpolator) {
   );
 } /* interpolator_info */
  
+/*******************************************************************************
+ * interpolator_resample: fill a regular grid from the k-d tree, with bin[]
+ *   points along each axis between min[] and max[], and release the tree.
+ *   returns 1 on success, 0 when the grid does not fit in
+ *   INTERPOLATOR_RESAMPLE_MAXMEM or memory is missing (the tree is then kept).
+ ******************************************************************************/
+int interpolator_resample(struct interpolator_struct *interpolator)
+{
+  long   sdim = interpolator->space_dimensionality;
+  long   fdim = interpolator->field_dimensionality;
+  double *grid[3] = { NULL, NULL, NULL };
+  double size = fdim*sizeof(double);
+  long   prod = 1, index;
+  int    dim;
+
+  for (dim=0; dim < sdim; dim++) {
+    prod *= interpolator->bin[dim];
+    size *= interpolator->bin[dim];
+  }
+  if (size > INTERPOLATOR_RESAMPLE_MAXMEM) {
+    printf("interpolator_resample: grid would require %g Gb, above the %g Gb limit. Keeping kd-tree for file '%s'.\n",
+      size/1073741824.0, INTERPOLATOR_RESAMPLE_MAXMEM/1073741824.0, interpolator->filename);
+    return 0;
+  }
+  for (dim=0; dim < fdim; dim++) {
+    grid[dim] = (double*)calloc(prod, sizeof(double));
+    if (!grid[dim]) {
+      for (dim=0; dim < fdim; dim++) free(grid[dim]);
+      return 0;
+    }
+  }
+  printf("interpolator_resample: resampling file '%s' onto %ld grid points (%g Gb).\n",
+    interpolator->filename, prod, size/1073741824.0);
+
+  /* the grid now has a constant step on all axes */
+  for (dim=0; dim < sdim; dim++) {
+    if (interpolator->bin[dim] > 1)
+      interpolator->step[dim] = (interpolator->max[dim]-interpolator->min[dim])/(interpolator->bin[dim]-1);
+    interpolator->constant_step[dim] = 1;
+  }
+  for (index=0; index < prod; index++) {
+    double space[INTERPOLATOR_DIMENSIONS];
+    long   rest = index, w;
+    for (dim=sdim-1; dim >= 0; dim--) {
+      space[dim] = interpolator->min[dim] + (rest % interpolator->bin[dim])*interpolator->step[dim];
+      rest      /= interpolator->bin[dim];
+    }
+    w = kdtree_nearestNeighbour(space, interpolator->kdtree);
+    for (dim=0; dim < fdim; dim++)
+      grid[dim][index] = interpolator->kdtree->data[w*fdim + dim];
+  }
+  interpolator->prod  = prod;
+  interpolator->gridx = grid[0];
+  interpolator->gridy = grid[1];
+  interpolator->gridz = grid[2];
+  kdtree_free(interpolator->kdtree);
+  interpolator->kdtree = NULL;
+  return 1;
+} /* interpolator_resample */
+
 /*******************************************************************************
  * interpolator_load: interpolation initialiser, from point cloud
  *   returns the interpolator structure
@@ -388,6 +463,8 @@ struct interpolator_struct *interpolator_load(char *filename,
     strcpy(interpolator->method, method);
   else
     strcpy(interpolator->method, "NULL");
+  if (!strcmp(interpolator->method, "trilinear"))
+    strcpy(interpolator->method, "linear");
   
   /* get columns and determine dimensionality if not set */
   if (!interpolator->space_dimensionality) {
@@ -445,7 +522,7 @@ struct interpolator_struct *interpolator_load(char *filename,
         interpolator->constant_step[dim] = 0; /* not constant step -> kd-tree should be used */
         if (!strcmp(interpolator->method, "NULL") || !strcmp(interpolator->method, "0")) {
           strcpy(interpolator->method, "kdtree");
-	} else if (!strcmp(interpolator->method, "regular")) { 
+	} else if (!strcmp(interpolator->method, "regular") || !strcmp(interpolator->method, "linear")) { 
 	    // We arrived here with 'regular' explicitly user-selected / required (GPU)
 	    // which leads to wrong results.
 	    fprintf(stderr,"\n\n%s\n\n",
@@ -454,7 +531,7 @@ struct interpolator_struct *interpolator_load(char *filename,
 	      "   non-consistent axis 'binning' along one or more axes.\n"
               "   This combination is not possible.\n"
 	      "   Please either resample the file to a regular grid or run with 'kdtree'\n"
-	      "   (NB: kdtree is available on CPU only)");
+	      "   or 'resample' (NB: kdtree is available on CPU only)");
 	    exit(-1);
 	}
       }
@@ -463,7 +540,9 @@ struct interpolator_struct *interpolator_load(char *filename,
     printf("interpolator_load: Axis %d: step=%g, unique values=%li, from file '%s'.\n",
         dim, interpolator->step[dim], interpolator->bin[dim], filename);
 
-    if (interpolator->step[dim]<=0 || interpolator->bin[dim]<=1) {
+    /* an axis with a single value (e.g. a 2D map in a 3D space) is kept,
+     * with a null step: the grid interpolators then ignore that coordinate */
+    if (interpolator->bin[dim]>1 && interpolator->step[dim]<=0) {
       fprintf(stderr, "interpolator_load: ERROR: Invalid axis %d: step=%g, unique values=%li, from file '%s'.\n",
         dim, interpolator->step[dim], interpolator->bin[dim], filename);
       strcpy(interpolator->method,"NULL");
@@ -477,8 +556,8 @@ struct interpolator_struct *interpolator_load(char *filename,
     if (strcmp(interpolator->method, "kdtree"))  /* not kdtree ? -> use direct indexing */
       strcpy(interpolator->method, "regular");
   
-  /* assign interpolation technique: 'regular' direct indexing */
-  if (!strcmp(interpolator->method, "regular")) {
+  /* assign interpolation technique: 'regular' direct indexing, also used by 'linear' */
+  if (!strcmp(interpolator->method, "regular") || !strcmp(interpolator->method, "linear")) {
     interpolator->kdtree = NULL;
 
     /* store table values onto the grid: each field component is stored on the
@@ -501,20 +580,20 @@ struct interpolator_struct *interpolator_load(char *filename,
         break;
       }
       for (index=0; index<table.rows; index++) {
-        long *indices = malloc(interpolator->space_dimensionality*sizeof(long));
+        long indices[INTERPOLATOR_DIMENSIONS];
         long this_index;
         int  axis=0;
 
         /* compute index 'space' elements of this 'field' value */
         for (axis=0; axis < interpolator->space_dimensionality; axis++) {
           double x      = Table_Index(table, index, axis);
-          indices[axis] = round((x - interpolator->min[axis])/interpolator->step[axis]);
+          indices[axis] = interpolator->bin[axis] > 1 ?
+            round((x - interpolator->min[axis])/interpolator->step[axis]) : 0;
         }
         this_index = interpolator_offset(interpolator->space_dimensionality,
                        interpolator->bin, indices);
         // array[axis1][axis2][...] = field[dim] column after [space] elements
         array[this_index] = Table_Index(table, index, interpolator->space_dimensionality+dim);
-	free(indices);
       }
       if (dim==0)
 	interpolator->gridx = array;
@@ -527,55 +606,152 @@ struct interpolator_struct *interpolator_load(char *filename,
   } else
 
   /* assign interpolation technique: kd-tree (when nearest direct indexing fails) */
-  if (!strcmp(interpolator->method, "kdtree")) {
-    // Allocate array of vertex pointers
-    vertex **vertices = calloc(table.rows, sizeof(vertex*));
-    if (!vertices) {
+  if (!strcmp(interpolator->method, "kdtree") || !strcmp(interpolator->method, "resample")) {
+    long    sdim = interpolator->space_dimensionality;
+    long    fdim = interpolator->field_dimensionality;
+    // Convert from table to contiguous [points][dim] arrays
+    double *coords = malloc(table.rows*sdim*sizeof(double));
+    double *fields = malloc(table.rows*fdim*sizeof(double));
+    long    i, j;
+    if (coords && fields) {
+      for (i=0; i < table.rows; i++) {
+        for (j = 0; j < sdim; j++)
+          coords[i*sdim + j] = Table_Index(table, i, j);
+        for (j = 0; j < fdim; j++)
+          fields[i*fdim + j] = Table_Index(table, i, sdim + j);
+      }
+      interpolator->kdtree = kdtree_build(coords, fields, table.rows, sdim, fdim);
+    }
+    free(coords);
+    free(fields);
+    if (!interpolator->kdtree) {
       fprintf(stderr, "interpolator_load: ERROR: Not enough memory when allocating field with %li vertices from file '%s'\n",
-        interpolator->bin[dim], filename);
+        table.rows, filename);
       strcpy(interpolator->method,"NULL");
+      Table_Free(&table);
       return NULL;
     }
-
-    // Convert from table to array layout
-    int i, j;
-    long count=0;
-    for (i=0; i < table.rows; i++)
-    {
-      vertex *v    = malloc(sizeof(vertex));
-      double *field= calloc(interpolator->field_dimensionality, sizeof(double));
-      double *coord= calloc(interpolator->space_dimensionality, sizeof(double));
-      if (v && field && coord) {
-        for (j = 0; j < interpolator->space_dimensionality; j++) {
-          coord[j]    = Table_Index(table, i,     j);
-        }
-        for (j = 0; j < interpolator->field_dimensionality; j++) {
-          field[j] = Table_Index(table, i, interpolator->space_dimensionality + j);
-        }
-        v->space_dimensionality = interpolator->space_dimensionality;
-        v->v    = coord;
-        v->data = field;
-        v->index= i;
-      }
-      vertices[i] = v;
-    }
-
-    interpolator->kdtree = kdtree_addToTree(vertices, 0, table.rows-1, 0); // build treeNode
     //for (i=0; i<INTERPOLATOR_DIMENSIONS; interpolator->grid[i++] = NULL);  // inactivate grid method
     interpolator->gridx=NULL;
     interpolator->gridy=NULL;
     interpolator->gridz=NULL;
-    free(vertices);
+    if (!strcmp(interpolator->method, "resample")) {
+      if (interpolator_resample(interpolator))
+        strcpy(interpolator->method, "regular");
+      else {
+        #ifdef OPENACC
+        fprintf(stderr, "\n\n!! interpolator_load: FATAL ERROR: !! \n'resample' could not build the grid, and 'kdtree' is not supported on OpenACC/GPU!\n\n");
+        Table_Free(&table);
+        exit(-1);
+        #endif
+        strcpy(interpolator->method, "kdtree");
+      }
+    }
   } 
   else
     fprintf(stderr, "interpolator_load: ERROR: unknown interpolator method %s [file '%s'].\n",
       interpolator->method, filename);
+
+  /* resolve the method once, for the interpolation calls */
+  if (!strcmp(interpolator->method, "kdtree") && interpolator->kdtree)
+    interpolator->method_id = INTERPOLATOR_KDTREE;
+  else if (!strcmp(interpolator->method, "regular") && interpolator->gridx)
+    interpolator->method_id = INTERPOLATOR_REGULAR;
+  else if (!strcmp(interpolator->method, "linear") && interpolator->gridx)
+    interpolator->method_id = INTERPOLATOR_LINEAR;
   
   // Free table
   Table_Free(&table);
   return interpolator;
 } /* end interpolator_load */
      
+/******************************************************************************/
+// interpolator_kdtree: nearest point of the k-d tree, copied into field
+#pragma acc routine
+double *interpolator_kdtree(struct interpolator_struct *interpolator,
+  double *space, double *field)
+{
+  int  i;
+  long w = kdtree_nearestNeighbour(space, interpolator->kdtree);
+  if (w < 0) return NULL;
+  double *data = interpolator->kdtree->data + w*interpolator->field_dimensionality;
+  for (i=0; i<interpolator->field_dimensionality; i++){
+      field[i]=data[i];
+  }
+  return (data);
+} // interpolator_kdtree
+
+/******************************************************************************/
+// interpolator_regular: nearest element of the regular grid. Locations
+//   outside the grid get the value on its boundary.
+#pragma acc routine
+double *interpolator_regular(struct interpolator_struct *interpolator,
+  double *space, double *field)
+{
+  int  axis;
+  long indices[INTERPOLATOR_DIMENSIONS];
+  for (axis=0; axis < interpolator->space_dimensionality; axis++) {
+    double f;
+    indices[axis] = 0;
+    if (interpolator->bin[axis] < 2) continue; /* single element */
+    f = round((space[axis]-interpolator->min[axis])/interpolator->step[axis]);
+    if (f > interpolator->bin[axis]-1) f = interpolator->bin[axis]-1;
+    if (f > 0) indices[axis] = (long)f;
+  }
+  long index = interpolator_offset(interpolator->space_dimensionality, interpolator->bin, indices);
+  field[0] = interpolator->gridx[index];
+  if (interpolator->field_dimensionality > 1) field[1] = interpolator->gridy[index];
+  if (interpolator->field_dimensionality > 2) field[2] = interpolator->gridz[index];
+  return field;
+} // interpolator_regular
+
+/******************************************************************************/
+// interpolator_linear: multi-linear interpolation between the 2^dim grid
+//   elements surrounding 'space'. Locations outside the grid get the value
+//   on its boundary, as with interpolator_regular.
+#pragma acc routine
+double *interpolator_linear(struct interpolator_struct *interpolator,
+  double *space, double *field)
+{
+  int    axis, corner, ncorners;
+  long   base=0, stride[INTERPOLATOR_DIMENSIONS];
+  double w[INTERPOLATOR_DIMENSIONS];
+  double *grid[3] = { interpolator->gridx, interpolator->gridy, interpolator->gridz };
+  int    sdim = interpolator->space_dimensionality;
+  int    fdim = interpolator->field_dimensionality;
+
+  /* row-major strides, as in interpolator_offset */
+  for (axis=sdim-1; axis >= 0; axis--)
+    stride[axis] = (axis == sdim-1 ? 1 : stride[axis+1]*interpolator->bin[axis+1]);
+  /* lower grid element and weight of the upper one along each axis */
+  for (axis=0; axis < sdim; axis++) {
+    double f;
+    long   i0;
+    if (interpolator->bin[axis] < 2) { w[axis] = 0; continue; } /* single element */
+    f = (space[axis]-interpolator->min[axis])/interpolator->step[axis];
+    if (f < 0) f = 0;
+    if (f > interpolator->bin[axis]-1) f = interpolator->bin[axis]-1;
+    i0 = (long)f;
+    if (i0 > interpolator->bin[axis]-2) i0 = interpolator->bin[axis]-2;
+    w[axis] = f - i0;
+    base   += i0*stride[axis];
+  }
+  for (axis=0; axis < fdim; axis++) field[axis] = 0;
+  ncorners = 1 << sdim;
+  for (corner=0; corner < ncorners; corner++) {
+    double weight = 1;
+    long   offset = base;
+    for (axis=0; axis < sdim; axis++) {
+      if (corner & (1 << axis)) { weight *= w[axis];   offset += stride[axis]; }
+      else                        weight *= 1-w[axis];
+    }
+    if (!weight) continue; /* e.g. beyond a single element axis */
+    for (axis=0; axis < fdim; axis++)
+      field[axis] += weight*grid[axis][offset];
+  }
+  return field;
+} // interpolator_linear
+
 /*******************************************************************************
  * interpolator_interpolate: main interpolation routine.
  *   returns the 'field' value (of length interpolator->field_dimensionality)
@@ -586,53 +762,63 @@ double *interpolator_interpolate(struct interpolator_struct *interpolator,
   double *space, double *field)
 {
   if (!space || !interpolator || !field) return NULL;
-  #ifdef OPENACC
-  #define strcmp str_comp
-  #endif
-  
-  /* k-d tree call ************************************************************/
-  if (!strcmp(interpolator->method, "kdtree") && interpolator->kdtree) {
-    vertex v;
-    int i;
-    v.v = space; 
-    v.space_dimensionality=interpolator->space_dimensionality;
-    vertex *w =kdtree_nearestNeighbour(&v, interpolator->kdtree);
-    if (!w) return NULL;
-    for (i=0; i<interpolator->field_dimensionality; i++){
-        field[i]=w->data[i];
-    }
-    return (w->data);
 
-  } else 
-  
+  switch (interpolator->method_id) {
+  /* k-d tree call ************************************************************/
+  case INTERPOLATOR_KDTREE:
+    return interpolator_kdtree(interpolator, space, field);
   /* nearest direct grid element call *****************************************/
-  if (!strcmp(interpolator->method, "regular") && interpolator->gridx) {
-    int axis;
-    long *indices = malloc((int)interpolator->space_dimensionality*sizeof(double));
-    for (axis=0; axis < interpolator->space_dimensionality; axis++) {
-      indices[axis] = round((space[axis]-interpolator->min[axis])/interpolator->step[axis]);
-    }
-    long index = interpolator_offset(3, interpolator->bin, indices);
-    for (axis=0; axis < interpolator->field_dimensionality; axis++) {
-      if (axis==0)
-	field[axis] = interpolator->gridx[index];
-      if (axis==1)
-        field[axis] = interpolator->gridy[index];
-      if (axis==2)
-        field[axis] = interpolator->gridz[index];
-    }
-    free(indices);
-    return field;
-  } else {
+  case INTERPOLATOR_REGULAR:
+    return interpolator_regular(interpolator, space, field);
+  /* multi-linear grid interpolation call *************************************/
+  case INTERPOLATOR_LINEAR:
+    return interpolator_linear(interpolator, space, field);
+  default:
     #ifndef OPENACC
     fprintf(stderr, "interpolator_interpolate: ERROR: invalid interpolator method %s from file '%s'.\n",
       interpolator->method, interpolator->filename);
     exit(-1);
     #endif
+    return NULL;
   }
-  
 } // interpolator_interpolate
 
+/*******************************************************************************
+ * interpolator_interpolate_batch: interpolation of n points at once.
+ *   'space' holds n locations of length space_dimensionality, one after the
+ *   other, and 'field' receives n values of length field_dimensionality.
+ *   returns 'field', or NULL on error.
+ ******************************************************************************/
+#pragma acc routine
+double *interpolator_interpolate_batch(struct interpolator_struct *interpolator,
+  long n, double *space, double *field)
+{
+  long i;
+  long sdim, fdim;
+  if (!space || !interpolator || !field) return NULL;
+  sdim = interpolator->space_dimensionality;
+  fdim = interpolator->field_dimensionality;
+
+  /* the method is resolved once for the whole batch */
+  switch (interpolator->method_id) {
+  case INTERPOLATOR_KDTREE:
+    for (i=0; i<n; i++)
+      if (!interpolator_kdtree(interpolator, space+i*sdim, field+i*fdim)) return NULL;
+    break;
+  case INTERPOLATOR_REGULAR:
+    for (i=0; i<n; i++)
+      interpolator_regular(interpolator, space+i*sdim, field+i*fdim);
+    break;
+  case INTERPOLATOR_LINEAR:
+    for (i=0; i<n; i++)
+      interpolator_linear(interpolator, space+i*sdim, field+i*fdim);
+    break;
+  default:
+    return interpolator_interpolate(interpolator, space, field);
+  }
+  return field;
+} // interpolator_interpolate_batch
+
 
 /*******************************************************************************
  * interpolator_interpolate3_3: main interpolation routine for 3D space
@@ -21,13 +21,15 @@
 * public function:
 * interpolator = interpolator_load(filename, 0, 0, NULL);
 *   or
-* interpolator = interpolator_load(filename, space_dim, field_dim, "regular" or "kdtree");
+* interpolator = interpolator_load(filename, space_dim, field_dim, "regular", "linear", "kdtree" or "resample");
 *
 * interpolator_info(interpolator);
 * 
 * interpolator_interpolate(interpolator, {x,y,z...}, {bx,by,bz...});
 *   or 
 * interpolator_interpolate3_3(interpolator, x,y,z, &bx,&by,&bz);
+*   or, for n points stored as [n][space_dim] -> [n][field_dim]
+* interpolator_interpolate_batch(interpolator, n, space, field);
 * 
 * interpolator_save(interpolator);
 *
@@ -48,10 +50,8 @@
 * ---------------------------------------------------------------------------------
 * 1. On GPU's (NVIDIA/OpenACC) only the 'regular' interpolation method is available
 *    and us hence the 'default'. A GPU-compiled instrument will exit with an error
-*    if you decide to force 'kdtree' mode.
-*    ('kdtree' needs the macro R_SWAP which works node connectivity/placement in
-*      the loaded dataset structure - is thus not thread-safe. And difficult to
-*      make 'atomic' / would require 'one file content pr. neutron'... :-( )
+*    if you decide to force 'kdtree' mode, as the recursive k-d tree search is
+*    not offloaded. 'resample' may be used there, as long as the grid fits.
 *
 * 2. On CPU's the default is 'NULL'/0, meaning that the library will itself try to
 *    evaluate if a dataset is suitable for 'regular' or 'kdtree'. You may still
@@ -59,6 +59,18 @@
 *
 * 3. 'regular' means 'quite regular indeed'... Voxels in the volume MUST be of
 *    uniform size AND dimensions of the volume MUST be equal on all spatial axes.
+*
+* 4. 'linear' (or 'trilinear') uses the same grid as 'regular', but returns the
+*    multi-linear interpolation of the 2^dim surrounding grid elements instead of
+*    the nearest one. It is never selected automatically.
+*
+* 5. 'resample' builds the k-d tree and then resamples it onto a regular grid with
+*    as many bins as unique values along each axis, using 'regular' afterwards.
+*    The grid is limited to INTERPOLATOR_RESAMPLE_MAXMEM bytes (default 1 Gb),
+*    beyond which the k-d tree is kept.
+*
+* 6. An axis with a single unique value (e.g. a 2D field map given in a 3D space)
+*    is accepted: 'regular' and 'linear' then ignore that coordinate.
 * ---------------------------------------------------------------------------------
 */
 
@@ -72,37 +84,42 @@
 #ifndef INTERPOLATOR_DIMENSIONS
 #define INTERPOLATOR_DIMENSIONS 3
 #endif
+/* largest grid built by the 'resample' method, in bytes */
+#ifndef INTERPOLATOR_RESAMPLE_MAXMEM
+#define INTERPOLATOR_RESAMPLE_MAXMEM 1073741824.0
+#endif
 
-typedef struct
-{
-  // This is the location of this point (space).
-  short  space_dimensionality;
-  double *v;    // e.g. double []
-  
-  // These are the values for our field at this location.
-  double *data; // e.g. double []
+/* Flattened k-d tree. The points are reordered at build so that the node
+   splitting an index range [left,right] is stored at (left+right)/2, with its
+   left subtree in [left,mid-1] and right subtree in [mid+1,right]. The
+   splitting axis is depth % space_dimensionality. Coordinates and field values
+   are stored contiguously, so that queries do not chase pointers. */
+typedef struct {
+  long    points;
+  int     space_dimensionality;
+  int     field_dimensionality;
+  double *coords; /* [points][space_dimensionality] */
+  double *data;   /* [points][field_dimensionality] */
+  #pragma acc shape(coords[0:points*space_dimensionality], data[0:points*field_dimensionality]) init_needed(points,space_dimensionality,field_dimensionality)
+} kdTree;
 
-  // This is the point index in the point list.
-  int    index;
-  #pragma acc shape(v[0:space_dimensionality], data[0:space_dimensionality]) init_needed(space_dimensionality)
-} vertex;
- 
-/* This struct will store each node of our kdtree. */
-typedef struct _treeNode {
-  vertex   *point;
-  int       depth;
-  struct _treeNode *rChild;
-  struct _treeNode *lChild;
-  #pragma acc shape(point[0:1],rChild[0:1],lChild[0:1])
-} treeNode;
+/* interpolation technique, set from interpolator->method at load so that the
+   interpolation calls do not need to compare strings */
+enum interpolator_method {
+  INTERPOLATOR_NONE=0,  /* unknown method or not loaded */
+  INTERPOLATOR_REGULAR, /* nearest element of the regular grid */
+  INTERPOLATOR_LINEAR,  /* multi-linear interpolation on the regular grid */
+  INTERPOLATOR_KDTREE   /* nearest neighbour in the point cloud */
+};
 
 struct interpolator_struct {
   char  method[256];
+  int   method_id;            /* enum interpolator_method */
   long  space_dimensionality; // [x,y,z...]
   long  field_dimensionality; // [bx,by,bz...]
   long  points;
   char  filename[1024];
-  treeNode *kdtree;    /* for k-d tree */
+  kdTree   *kdtree;    /* for k-d tree */
   #pragma acc shape(kdtree[0:1])
   double  *gridx;  /* each grid contains a component of the field */
   double  *gridy;
@@ -152,3 +169,13 @@ double *interpolator_interpolate3_3(struct interpolator_struct *interpolator,
                     double  x,  double  y,  double  z,
                     double *bx, double *by, double *bz);
 
+/*******************************************************************************
+ * interpolator_interpolate_batch: interpolation of n points at once.
+ *   'space' holds n locations of length space_dimensionality, one after the
+ *   other, and 'field' receives n values of length field_dimensionality.
+ *   returns 'field', or NULL on error.
+ ******************************************************************************/
+#pragma acc routine
+double *interpolator_interpolate_batch(struct interpolator_struct *interpolator,
+  long n, double *space, double *field);
+
@@ -45,8 +45,12 @@
 #if defined(__unix__) || defined(__APPLE__)
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #endif
 
+/* the instrument only includes the particle section when linked with the
+   runtime library, see the end of this file */
+#ifndef MC_RUNTIME_PARTICLE
 
 #ifndef DANSE
 #ifdef MC_ANCIENT_COMPATIBILITY
@@ -55,9 +59,9 @@ int defaultmain  = 0;
 #endif
 /* else defined directly in the McCode generated C code */
 
-static   long mcseed                 = 0; /* seed for random generator */
+mcstatic long mcseed                 = 0; /* seed for random generator */
 #pragma acc declare create ( mcseed )
-static   long mcstartdate            = 0; /* start simulation time */
+mcstatic long mcstartdate            = 0; /* start simulation time */
 static   int  mcdisable_output_files = 0; /* --no-output-files */
 mcstatic int  mcgravitation          = 0; /* use gravitation flag, for PROP macros */
 mcstatic int  mcusedefaults          = 0; /* assume default value for all parameters */
@@ -66,6 +70,19 @@ mcstatic int  mcnexus_embed_idf      = 0; /* flag to embed xml-formatted IDF fil
 #pragma acc declare create ( mcdotrace )
 int      mcallowbackprop             = 0;         /* flag to enable negative/backprop */
 
+#ifndef MC_EMBEDDED_RUNTIME /* runtime library: else defined in mccode-r.h */
+char    *dirname                     = NULL;      /* name of output directory */
+char    *siminfo_name                = "mccode";  /* default output sim file name */
+char    *mcformat                    = NULL;      /* NULL (default) or a specific format */
+FILE    *siminfo_file                = NULL;
+#ifndef NOSIGNALS
+char    *mcsig_message;
+#endif
+#ifdef USE_NEXUS
+NXhandle nxhandle;
+#endif
+#endif
+
 /* OpenACC-related segmentation parameters: */
 int vecsize = 128;
 int numgangs = 7813;
@@ -83,7 +100,6 @@ MONND_BUFSIZ = ND_BUFFER;
 /* Number of particle histories to simulate. */
 #ifdef NEUTRONICS
 mcstatic unsigned long long int mcncount             = 1;
-mcstatic unsigned long long int mcrun_num            = 0;
 #else
 #ifdef MCDEFAULT_NCOUNT
 mcstatic unsigned long long int mcncount             = MCDEFAULT_NCOUNT;
@@ -91,9 +107,10 @@ mcstatic unsigned long long int mcncount             = MCDEFAULT_NCOUNT;
 mcstatic unsigned long long int mcncount             = 1000000;
 #endif
 #pragma acc declare create ( mcncount )
-mcstatic unsigned long long int mcrun_num            = 0;
-#pragma acc declare create ( mcrun_num )
 #endif /* NEUTRONICS */
+struct mcprogress_struct mcprogress = { 0 }; /* progress counters, see mcprogress_tick */
+struct mcprofile_struct  mcprofile  = { 0 }; /* per component profile, see mcprofile_save */
+struct mcbound_struct    mcbound    = { 0 }; /* bounded run, see mcbound_check */
 
 #else
 #include "mcstas-globals.h"
@@ -185,9 +202,11 @@ int any_set(int n, ...){
 IArray1d create_iarr1d(int n){
   IArray1d arr2d;
   arr2d = calloc(n, sizeof(int));
+  mccheckpoint_add("IArray1d", arr2d, n*sizeof(int));
   return arr2d;
 }
 void destroy_iarr1d(IArray1d a){
+  mccheckpoint_remove(a);
   free(a);
 }
 
@@ -197,6 +216,7 @@ IArray2d create_iarr2d(int nx, int ny){
 
   int *p1;
   p1 = calloc(nx*ny, sizeof(int));
+  mccheckpoint_add("IArray2d", p1, nx*ny*sizeof(int));
 
   int i;
   for (i=0; i<nx; i++){
@@ -205,6 +225,7 @@ IArray2d create_iarr2d(int nx, int ny){
   return arr2d;
 }
 void destroy_iarr2d(IArray2d a){
+  mccheckpoint_remove(a[0]);
   free(a[0]);
   free(a);
 }
@@ -227,6 +248,7 @@ IArray3d create_iarr3d(int nx, int ny, int nz){
   // 3d
   int *p2;
   p2 = calloc(nx*ny*nz, sizeof(int));
+  mccheckpoint_add("IArray3d", p2, nx*ny*nz*sizeof(int));
   for (i=0; i<nx; i++){
     for (j=0; j<ny; j++){
       arr3d[i][j] = &(p2[(i*ny+j)*nz]);
@@ -236,6 +258,7 @@ IArray3d create_iarr3d(int nx, int ny, int nz){
 }
 
 void destroy_iarr3d(IArray3d a){
+  mccheckpoint_remove(a[0][0]);
   free(a[0][0]);
   free(a[0]);
   free(a);
@@ -244,10 +267,12 @@ void destroy_iarr3d(IArray3d a){
 DArray1d create_darr1d(int n){
   DArray1d arr2d;
   arr2d = calloc(n, sizeof(double));
+  mccheckpoint_add("DArray1d", arr2d, n*sizeof(double));
   return arr2d;
 }
 
 void destroy_darr1d(DArray1d a){
+  mccheckpoint_remove(a);
   free(a);
 }
 
@@ -257,6 +282,7 @@ DArray2d create_darr2d(int nx, int ny){
 
   double *p1;
   p1 = calloc(nx*ny, sizeof(double));
+  mccheckpoint_add("DArray2d", p1, nx*ny*sizeof(double));
 
   int i;
   for (i=0; i<nx; i++){
@@ -266,6 +292,7 @@ DArray2d create_darr2d(int nx, int ny){
 }
 
 void destroy_darr2d(DArray2d a){
+  mccheckpoint_remove(a[0]);
   free(a[0]);
   free(a);
 }
@@ -289,6 +316,7 @@ DArray3d create_darr3d(int nx, int ny, int nz){
   // 3d
   double *p2;
   p2 = calloc(nx*ny*nz, sizeof(double));
+  mccheckpoint_add("DArray3d", p2, nx*ny*nz*sizeof(double));
   for (i=0; i<nx; i++){
     for (j=0; j<ny; j++){
       arr3d[i][j] = &(p2[(i*ny+j)*nz]);
@@ -298,6 +326,7 @@ DArray3d create_darr3d(int nx, int ny, int nz){
 }
 
 void destroy_darr3d(DArray3d a){
+  mccheckpoint_remove(a[0][0]);
   free(a[0][0]);
   free(a[0]);
   free(a);
@@ -308,8 +337,11 @@ void destroy_darr3d(DArray3d a){
 
 #ifdef USE_MPI
 /* MPI rank */
-static int mpi_node_rank;
-static int mpi_node_root = 0;
+mcstatic int mpi_node_rank;
+mcstatic int mpi_node_root = 0;
+#ifndef MC_EMBEDDED_RUNTIME
+int mpi_node_count; /* else defined in mccode-r.h */
+#endif
 
 
 /*******************************************************************************
@@ -894,6 +926,38 @@ MCDETECTOR mcdetector_statistics(
 
 } /* mcdetector_statistics */
 
+/*******************************************************************************
+* mcbound_probe_import: precision probe of a bounded run, from detector_import.
+*   Gets the relative error on the intensity of the probed component data with
+*   mcdetector_statistics, working on a copy of p2 which it would otherwise
+*   replace with the error bars. Keeps the largest error when the component
+*   writes more than one data set.
+*******************************************************************************/
+static void mcbound_probe_import(MCDETECTOR detector)
+{
+  long    size = detector.m*detector.n*detector.p;
+  double *p1   = detector.p1;
+  double *p2   = NULL;
+  double  error;
+
+  if (!size || !p1 || strcasestr(detector.format,"list")) return;
+  if (detector.p2) {
+    p2 = (double*)malloc(size*sizeof(double));
+    if (!p2) return;
+    memcpy(p2, detector.p2, size*sizeof(double));
+    detector.p2 = p2;
+  }
+  detector = mcdetector_statistics(detector);
+  if (detector.p1 != p1) free(detector.p1); /* 1D [x I E N] block */
+  free(p2);
+
+  if (detector.events < MCBOUND_MIN_EVENTS || !detector.intensity)
+    error = HUGE_VAL;
+  else
+    error = fabs(detector.error/detector.intensity);
+  if (error > mcbound.error) mcbound.error = error;
+} /* mcbound_probe_import */
+
 /*******************************************************************************
 * detector_import: build detector structure, merge non-lists from MPI
 *                    compute basic stat, write "Detector:" line
@@ -1046,6 +1110,22 @@ MCDETECTOR detector_import(
   else
     snprintf(detector.limits, CHAR_BUF_LENGTH, "%g %g %g %g %g %g", x1, x2, y1, y2, z1, z2);
 
+  /* precision probe of a bounded run: no MPI reduce, no output ============= */
+  if (mcbound.probe) {
+    mcbound_probe_import(detector);
+    detector.m = 0;
+    return(detector);
+  }
+
+  /* bounded run ended early: scale to the events actually traced ============ */
+  if (mcbound.scale && !strcasestr(detector.format,"list") && m) {
+    long i;
+    for (i=0; i<m*n*p; i++) {
+      p1[i] *= mcbound.scale;
+      if (p2) p2[i] *= mcbound.scale*mcbound.scale;
+    }
+  }
+
   /* if MPI and nodes_nb > 1: reduce data sets when using MPI =============== */
 #ifdef USE_MPI
   if (!strcasestr(detector.format,"list") && mpi_node_count > 1 && m) {
@@ -2381,6 +2461,7 @@ MCDETECTOR mcdetector_out_0D(char *t, double p0, double p1, double p2,
     "I", "", "",
     0, 0, 0, 0, 0, 0, c,
     &p0, &p1, &p2, posa, rota, index); /* write Detector: line */
+  if (!detector.m) return(detector);
 
 #ifdef USE_NEXUS
   if (strcasestr(detector.format, "NeXus"))
@@ -2751,7 +2832,7 @@ unsigned long long int mcget_run_num() // shuld be (_class_particle* _particle)
 {
   /* This function only remains for the few cases outside TRACE where we need to know
      the number of simulated particles */
-  return mcrun_num;
+  return mcprogress.events;
 }
 
 /* mcsetn_arg: get ncount from a string argument */
@@ -2778,6 +2859,431 @@ mcsetseed(char *arg)
 
 #ifndef MCCODE_H
 
+/* SECTION: progress counters. ============================================== */
+
+/* mcprogress_time: wall clock in seconds */
+static double mcprogress_time(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+/*******************************************************************************
+* mcprogress_start: reset the counters before the ray loop. The per component
+*   ABSORB counters are indexed as INDEX_CURRENT_COMP, from 1 to ncomp.
+*******************************************************************************/
+void mcprogress_start(void)
+{
+  int n = 0;
+
+  while (_getcomp_name(n+1)) n++;
+  free(mcprogress.absorbed);
+  mcprogress.absorbed = (unsigned long long*)calloc(n+1, sizeof(unsigned long long));
+  mcprogress.ncomp    = n;
+  mcprogress.events   = 0;
+  mcprogress.stride   = 1;
+  mcprogress.next_tick= 1;
+  mcprogress.start    = mcprogress_time();
+  if (mcprogress.status_interval <= 0) mcprogress.status_interval = 10;
+  mcprogress.next_status = mcprogress.start + mcprogress.status_interval;
+}
+
+/*******************************************************************************
+* mcprogress_report: write the current progress of this process to f:
+*   events, rate, estimated time to completion and fraction of the events
+*   absorbed in each component.
+*******************************************************************************/
+void mcprogress_report(FILE *f, char *status)
+{
+  double elapsed = mcprogress_time() - mcprogress.start;
+  double events  = (double)mcprogress.events;
+  double ncount  = (double)mcget_ncount();
+  double rate    = elapsed > 0 ? events/elapsed : 0;
+  int    i;
+
+  fprintf(f, "Instrument: %s (%s)\n", instrument_name, instrument_source);
+  fprintf(f, "Status: %s\n", status);
+#ifdef USE_MPI
+  fprintf(f, "Nodes: %i (counters of node %i)\n", mpi_node_count, mpi_node_rank);
+#endif
+  fprintf(f, "Events: %.0f/%.0f (%.2f %%)\n", events, ncount, ncount ? 100*events/ncount : 0);
+  fprintf(f, "Elapsed: %.1f [s]\n", elapsed);
+  fprintf(f, "Rate: %g [events/s]\n", rate);
+  if (rate > 0 && events < ncount)
+    fprintf(f, "ETA: %.1f [s]\n", (ncount - events)/rate);
+  if (mcprogress.absorbed && events > 0) {
+    fprintf(f, "Absorbed fraction per component:\n");
+    for (i = 1; i <= mcprogress.ncomp; i++)
+      if (mcprogress.absorbed[i])
+        fprintf(f, "  %-30s %g\n", _getcomp_name(i), mcprogress.absorbed[i]/events);
+  }
+}
+
+/* mcprogress_status: write the --status-file, through a temporary file */
+static void mcprogress_status(char *status)
+{
+  char  tmp[CHAR_BUF_LENGTH];
+  FILE *f;
+
+  if (!mcprogress.status_file) return;
+  snprintf(tmp, CHAR_BUF_LENGTH, "%s.tmp", mcprogress.status_file);
+  f = fopen(tmp, "w");
+  if (!f) return;
+  mcprogress_report(f, status);
+  fclose(f);
+  rename(tmp, mcprogress.status_file);
+}
+
+/*******************************************************************************
+* mcprogress_tick: called every mcprogress.stride events, checks the bounds of
+*   the run, writes a checkpoint when requested or due, and the status file
+*   when its interval has elapsed. The stride doubles from 1 up to
+*   MCPROGRESS_CHECK+1 events, but no more than MCPROGRESS_PERIOD seconds at
+*   the event rate, so that slow events do not delay --time-limit or SIGTERM.
+*******************************************************************************/
+void mcprogress_tick(void)
+{
+  double now, rate;
+
+  if (!mcprogress.status_file && !mccheckpoint.file
+    && !mcbound.time_limit && !mcbound.target_error) {
+    mcprogress.next_tick = mcprogress.events + MCPROGRESS_CHECK + 1;
+    return;
+  }
+  now = mcprogress_time();
+  mcprogress.stride *= 2;
+  if (now > mcprogress.start) {
+    rate = (mcprogress.events - mccheckpoint.start)/(now - mcprogress.start);
+    if (mcprogress.stride > rate*MCPROGRESS_PERIOD)
+      mcprogress.stride = rate*MCPROGRESS_PERIOD;
+  }
+  if (mcprogress.stride < 1) mcprogress.stride = 1;
+  if (mcprogress.stride > MCPROGRESS_CHECK + 1) mcprogress.stride = MCPROGRESS_CHECK + 1;
+  mcprogress.next_tick = mcprogress.events + mcprogress.stride;
+  mcbound_check(now);
+  if (mccheckpoint.file && mccheckpoint.tracing
+    && (mccheckpoint.request || now >= mccheckpoint.next)) {
+    mccheckpoint_save();
+    mccheckpoint.next = now + mccheckpoint.interval;
+    if (mccheckpoint.request == 2) {
+      printf("# " MCCODE_STRING ": Finishing simulation (save results and exit)\n");
+      mccheckpoint.tracing = 0;
+      finally();
+      exit(0);
+    }
+    mccheckpoint.request = 0;
+  }
+  if (!mcprogress.status_file) return;
+  if (now < mcprogress.next_status) return;
+  mcprogress.next_status = now + mcprogress.status_interval;
+  MPI_MASTER(
+  mcprogress_status("running");
+  );
+}
+
+/* mcprogress_add: count a batch of events traced elsewhere (GPU kernel) */
+void mcprogress_add(unsigned long long count)
+{
+  mcprogress.events += count;
+  mcprogress_tick();
+}
+
+/* mcprogress_stop: final status, at the end of the ray loop */
+void mcprogress_stop(void)
+{
+  MPI_MASTER(
+  mcprogress_status("finished");
+  );
+}
+
+/* SECTION: component profiler. ============================================= */
+
+/* mcprofile_clock: monotonic clock in [ns], when no time stamp counter */
+unsigned long long mcprofile_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#else
+  return (unsigned long long)(mcprogress_time()*1e9);
+#endif
+}
+
+/*******************************************************************************
+* mcprofile_start: reset the per component profile before the ray loop. Called
+*   from raytrace_all when the instrument is generated with --profile.
+*******************************************************************************/
+void mcprofile_start(void)
+{
+  int n = 0;
+
+  while (_getcomp_name(n+1)) n++;
+  free(mcprofile.comps);
+  mcprofile.comps = (struct mcprofile_comp*)calloc(n+1, sizeof(struct mcprofile_comp));
+  mcprofile.ncomp = n;
+  mcprofile.ticks = 0;
+  mcprofile.seconds = 0;
+  mcprofile.start = mcprogress_time();
+  mcprofile.start_ticks = MCPROFILE_TICKS();
+}
+
+/* mcprofile_stop: measure the tick rate over the ray loop */
+void mcprofile_stop(void)
+{
+  if (!mcprofile.comps) return;
+  mcprofile.ticks   = MCPROFILE_TICKS() - mcprofile.start_ticks;
+  mcprofile.seconds = mcprogress_time() - mcprofile.start;
+}
+
+/*******************************************************************************
+* mcprofile_save: print the per component profile and write it into
+*   profile.dat in the output directory. Called from SAVE; the counters of all
+*   MPI nodes are summed.
+*******************************************************************************/
+void mcprofile_save(void)
+{
+  double *sum, total = 0;
+  double  ticks, seconds;
+  char   *filename;
+  FILE   *f;
+  int     i, n = mcprofile.ncomp;
+
+  if (!mcprofile.comps) return;
+  ticks   = mcprofile.ticks   ? (double)mcprofile.ticks : (double)(MCPROFILE_TICKS() - mcprofile.start_ticks);
+  seconds = mcprofile.seconds ? mcprofile.seconds       : mcprogress_time() - mcprofile.start;
+  /* entries, scatters, absorbs, seconds per component */
+  sum = (double*)calloc(4*(n+1), sizeof(double));
+  if (!sum) return;
+  for (i = 1; i <= n; i++) {
+    sum[4*i]   = (double)mcprofile.comps[i].entries;
+    sum[4*i+1] = (double)mcprofile.comps[i].scatters;
+    sum[4*i+2] = (double)mcprofile.comps[i].absorbs;
+    sum[4*i+3] = ticks > 0 ? mcprofile.comps[i].ticks*seconds/ticks : 0;
+  }
+#ifdef USE_MPI
+  if (mpi_node_count > 1) mc_MPI_Sum(sum, 4*(n+1));
+#endif
+  for (i = 1; i <= n; i++) total += sum[4*i+3];
+
+  MPI_MASTER(
+  filename = dirname && !mcdisable_output_files ? mcfull_file("profile", "dat") : NULL;
+  f = filename ? fopen(filename, "w") : NULL;
+  printf("Profile of %s TRACE (%g [s] in components):\n", instrument_name, total);
+  printf("  %-4s %-30s %12s %12s %12s %12s %7s %12s\n",
+    "#", "component", "entries", "scatters", "absorbs", "time [s]", "time %", "ns/entry");
+  if (f) {
+    fprintf(f, "# Instrument: %s (%s)\n", instrument_name, instrument_source);
+    fprintf(f, "# type: profile\n");
+    fprintf(f, "# time: %g [s] in components\n", total);
+    fprintf(f, "# variables: index component entries scatters absorbs time time_percent ns_per_entry\n");
+  }
+  for (i = 1; i <= n; i++) {
+    double *c = sum+4*i;
+    double pc = total > 0 ? 100*c[3]/total : 0;
+    double ns = c[0] > 0 ? 1e9*c[3]/c[0] : 0;
+    if (!c[0]) continue;
+    printf("  %-4i %-30s %12.0f %12.0f %12.0f %12.4g %7.2f %12.4g\n",
+      i, _getcomp_name(i), c[0], c[1], c[2], c[3], pc, ns);
+    if (f)
+      fprintf(f, "%i %s %.0f %.0f %.0f %g %g %g\n",
+        i, _getcomp_name(i), c[0], c[1], c[2], c[3], pc, ns);
+  }
+  if (f) fclose(f);
+  free(filename);
+  );
+  free(sum);
+}
+
+/* SECTION: binary trace stream. ============================================ */
+
+/*******************************************************************************
+* With --trace-file=FILE, the per-event trace messages (ENTER, COMP, STATE,
+* SCATTER, ABSORB, LEAVE) are written to FILE as binary records through a
+* buffer, instead of text on stdout. The instrument description (INSTRUMENT,
+* COMPONENT, MCDISPLAY) is still printed, so that the legacy text output is
+* that description followed by the text from --trace-decode=FILE.
+*
+* The file starts with MCTRACE_MAGIC and a 32 bit byte order mark, followed by
+* records made of a type character and, in host byte order:
+*   MCTRACE_NAME    int32 index, int32 length, name (written at init)
+*   MCTRACE_COMP    int32 index
+*   MCTRACE_STATE
+*   MCTRACE_SCATTER uint8 count, count doubles
+*   MCTRACE_ENTER, MCTRACE_ABSORB, MCTRACE_LEAVE: no data
+*******************************************************************************/
+FILE         *mctrace_file     = NULL;   /* binary trace stream, or NULL */
+static char  *mctrace_filename = NULL;   /* --trace-file */
+static char  *mctrace_buffer   = NULL;
+static size_t mctrace_buffer_len = 0;
+
+/* mctrace_put: append n bytes to the trace buffer, writing it when full */
+static void mctrace_put(const void *data, size_t n)
+{
+  if (mctrace_buffer_len + n > MCTRACE_BUFSIZ) {
+    fwrite(mctrace_buffer, 1, mctrace_buffer_len, mctrace_file);
+    mctrace_buffer_len = 0;
+  }
+  memcpy(mctrace_buffer + mctrace_buffer_len, data, n);
+  mctrace_buffer_len += n;
+}
+
+/* mctrace_close: write the buffered records and close the trace stream */
+void mctrace_close(void)
+{
+  if (!mctrace_file) return;
+  if (mctrace_buffer_len)
+    fwrite(mctrace_buffer, 1, mctrace_buffer_len, mctrace_file);
+  fclose(mctrace_file);
+  free(mctrace_buffer);
+  mctrace_file       = NULL;
+  mctrace_buffer     = NULL;
+  mctrace_buffer_len = 0;
+}
+
+/* mctrace_open: open the binary trace stream. Returns 0 on error. */
+int mctrace_open(char *filename)
+{
+  uint32_t bom = MCTRACE_BOM;
+
+  mctrace_buffer = (char*)malloc(MCTRACE_BUFSIZ);
+  mctrace_file   = mctrace_buffer ? fopen(filename, "wb") : NULL;
+  if (!mctrace_file) {
+    fprintf(stderr, "Error: can not open trace file %s (mctrace_open)\n", filename);
+    free(mctrace_buffer);
+    mctrace_buffer = NULL;
+    return 0;
+  }
+  mctrace_buffer_len = 0;
+  mctrace_put(MCTRACE_MAGIC, strlen(MCTRACE_MAGIC));
+  mctrace_put(&bom, sizeof(bom));
+  atexit(mctrace_close);
+  return 1;
+}
+
+/* mctrace_name: record the name of component index */
+void mctrace_name(int index, char *name)
+{
+  char    type = MCTRACE_NAME;
+  int32_t i    = index;
+  int32_t len  = strlen(name);
+
+  mctrace_put(&type, 1);
+  mctrace_put(&i,   sizeof(i));
+  mctrace_put(&len, sizeof(len));
+  mctrace_put(name, len);
+}
+
+/* mctrace_event: record an event, with the component index for MCTRACE_COMP */
+void mctrace_event(char type, int index)
+{
+  int32_t i = index;
+
+  mctrace_put(&type, 1);
+  if (type == MCTRACE_COMP) mctrace_put(&i, sizeof(i));
+}
+
+/* mctrace_state: record the n doubles given after n as a STATE/SCATTER */
+void mctrace_state(char type, int n, ...)
+{
+  double  state[256];
+  uint8_t count = (n > 255 ? 255 : n);
+  va_list ap;
+  int     i;
+
+  va_start(ap, n);
+  for (i = 0; i < count; i++) state[i] = va_arg(ap, double);
+  va_end(ap);
+  mctrace_put(&type,  1);
+  mctrace_put(&count, 1);
+  mctrace_put(state,  count*sizeof(double));
+}
+
+/*******************************************************************************
+* mctrace_decode: print a binary trace stream as the legacy trace text.
+*   returns the number of records, or -1 on error.
+*******************************************************************************/
+long mctrace_decode(char *filename)
+{
+  FILE    *f;
+  char     magic[sizeof(MCTRACE_MAGIC)];
+  uint32_t bom = 0;
+  char   **names  = NULL;
+  int32_t  nnames = 0;
+  long     records = 0;
+  int      type, ok = 1;
+
+  f = fopen(filename, "rb");
+  if (!f) {
+    fprintf(stderr, "Error: can not open trace file %s (mctrace_decode)\n", filename);
+    return -1;
+  }
+  if (fread(magic, 1, strlen(MCTRACE_MAGIC), f) != strlen(MCTRACE_MAGIC)
+   || strncmp(magic, MCTRACE_MAGIC, strlen(MCTRACE_MAGIC))
+   || fread(&bom, sizeof(bom), 1, f) != 1) {
+    fprintf(stderr, "Error: %s is not a " MCCODE_NAME " trace file (mctrace_decode)\n", filename);
+    fclose(f);
+    return -1;
+  }
+  if (bom != MCTRACE_BOM) {
+    fprintf(stderr, "Error: %s was written on a host with another byte order (mctrace_decode)\n", filename);
+    fclose(f);
+    return -1;
+  }
+
+  while (ok && (type = fgetc(f)) != EOF) {
+    int32_t index, len;
+    uint8_t count;
+    double  state[256];
+    int     i;
+
+    switch (type) {
+    case MCTRACE_NAME:
+      ok = fread(&index, sizeof(index), 1, f) == 1
+        && fread(&len,   sizeof(len),   1, f) == 1
+        && index >= 0 && len >= 0;
+      if (!ok) break;
+      if (index >= nnames) {
+        names = (char**)realloc(names, (index+1)*sizeof(char*));
+        for (i = nnames; i <= index; i++) names[i] = NULL;
+        nnames = index+1;
+      }
+      free(names[index]);
+      names[index] = (char*)calloc(len+1, 1);
+      ok = fread(names[index], 1, len, f) == (size_t)len;
+      break;
+    case MCTRACE_COMP:
+      ok = fread(&index, sizeof(index), 1, f) == 1;
+      if (ok) printf("COMP: \"%s\"\n",
+        index >= 0 && index < nnames && names[index] ? names[index] : "");
+      break;
+    case MCTRACE_STATE:
+    case MCTRACE_SCATTER:
+      ok = fread(&count, 1, 1, f) == 1
+        && fread(state, sizeof(double), count, f) == count;
+      if (!ok) break;
+      printf(type == MCTRACE_STATE ? "STATE:" : "SCATTER:");
+      for (i = 0; i < count; i++) printf(i ? ", %g" : " %g", state[i]);
+      printf("\n");
+      break;
+    case MCTRACE_ENTER:  printf("ENTER:\n");  break;
+    case MCTRACE_ABSORB: printf("ABSORB:\n"); break;
+    case MCTRACE_LEAVE:  printf("LEAVE:\n");  break;
+    default: ok = 0;
+    }
+    if (ok) records++;
+  }
+  if (!ok)
+    fprintf(stderr, "Error: %s is truncated or corrupted after %ld records (mctrace_decode)\n",
+      filename, records);
+
+  while (nnames > 0) free(names[--nnames]);
+  free(names);
+  fclose(f);
+  return ok ? records : -1;
+} /* mctrace_decode */
+
 /* SECTION: MCDISPLAY support. =============================================== */
 
 /*******************************************************************************
@@ -3474,241 +3980,48 @@ mcstatic void norm_func(double *x, double *y, double *z) {
 }
 
 
-/* SECTION: GPU algorithms ================================================== */
-
-
-/*
-*  Divide-and-conquer strategy for parallelizing this task: Sort absorbed
-*  particles last.
-*
-*   particles:  the particle array, required to checking _absorbed
-*   pbuffer:    same-size particle buffer array required for parallel sort
-*   len:        sorting area-of-interest size (e.g. from previous calls)
-*   buffer_len: total array size
-*   flag_split: if set, multiply live particles into absorbed slots, up to buffer_len
-*   multiplier: output arg, becomes the  SPLIT multiplier if flag_split is set
-*/
-#ifdef FUNNEL
-long sort_absorb_last(_class_particle* particles, _class_particle* pbuffer, long len, long buffer_len, long flag_split, long* multiplier) {
-  #define SAL_THREADS 1024 // num parallel sections
-  if (len<SAL_THREADS) return sort_absorb_last_serial(particles, len);
-
-  if (multiplier != NULL) *multiplier = -1; // set default out value for multiplier
-  long newlen = 0;
-  long los[SAL_THREADS]; // target array startidxs
-  long lens[SAL_THREADS]; // target array sublens
-  long l = floor(len/(SAL_THREADS-1)); // subproblem_len
-  long ll = len - l*(SAL_THREADS-1); // last_subproblem_len
-
-  // TODO: The l vs ll is too simplistic, since ll can become much larger
-  // than l, resulting in idling. We should distribute lengths more evenly.
-
-  // step 1: sort sub-arrays
-  #pragma acc parallel loop present(particles[0:buffer_len], pbuffer[0:buffer_len])
-  for (unsigned long tidx=0; tidx<SAL_THREADS; tidx++) {
-    long lo = l*tidx;
-    long loclen = l;
-    if (tidx==(SAL_THREADS-1)) loclen = ll; // last sub-problem special case
-    long i = lo;
-    long j = lo + loclen - 1;
+/*******************************************************************************
+* mccoordschange_polarisation: applies rotation to vector (sx sy sz)
+*******************************************************************************/
+void mccoordschange_polarisation(Rotation t, double *sx, double *sy, double *sz)
+{
+  Coords b, c;
 
-    // write into pbuffer at i and j
-    #pragma acc loop seq
-    while (i < j) {
-      #pragma acc loop seq
-      while (!particles[i]._absorbed && i<j) {
-        pbuffer[i] = particles[i];
-        i++;
-      }
-      #pragma acc loop seq
-      while (particles[j]._absorbed && i<j) {
-        pbuffer[j] = particles[j];
-        j--;
-      }
-      if (i < j) {
-        pbuffer[j] = particles[i];
-        pbuffer[i] = particles[j];
-        i++;
-        j--;
-      }
-    }
-    // transfer edge case
-    if (i==j)
-      pbuffer[i] = particles[i];
+  b.x = *sx;
+  b.y = *sy;
+  b.z = *sz;
+  c = rot_apply(t, b);
+  *sx = c.x;
+  *sy = c.y;
+  *sz = c.z;
+}
 
-    lens[tidx] = i - lo;
-    if (i==j && !particles[i]._absorbed) lens[tidx]++;
-  }
+/* SECTION: vector math  ==================================================== */
 
-  // determine lo's
-  long accumlen = 0;
-  #pragma acc loop seq
-  for (long idx=0; idx<SAL_THREADS; idx++) {
-    los[idx] = accumlen;
-    accumlen = accumlen + lens[idx];
+/* normal_vec_func: Compute normal vector to (x,y,z). */
+void normal_vec(double *nx, double *ny, double *nz,
+                double x, double y, double z)
+{
+  double ax = fabs(x);
+  double ay = fabs(y);
+  double az = fabs(z);
+  double l;
+  if(x == 0 && y == 0 && z == 0)
+  {
+    *nx = 0;
+    *ny = 0;
+    *nz = 0;
+    return;
   }
-
-  // step 2: write non-absorbed sub-arrays to psorted/output from the left
-  #pragma acc parallel loop present(pbuffer[0:buffer_len])
-  for (unsigned long tidx=0; tidx<SAL_THREADS; tidx++) {
-    long j, k;
-    #pragma acc loop seq
-    for (long i=0; i<lens[tidx]; i++) {
-      j = i + l*tidx;
-      k = i + los[tidx];
-      particles[k] = pbuffer[j];
-    }
-  }
-  //for (int ii=0;ii<accumlen;ii++) printf("%ld ", (psorted[ii]->_absorbed));
-
-  // return (no SPLIT)
-  if (flag_split != 1)
-    return accumlen;
-
-  // SPLIT - repeat the non-absorbed block N-1 times, where len % accumlen = N + R
-  int mult = buffer_len / accumlen; // TODO: possibly use a new arg, bufferlen, rather than len
-
-  // not enough space for full-block split, return
-  if (mult <= 1)
-    return accumlen;
-
-  // copy non-absorbed block
-  #pragma acc parallel loop present(particles[0:buffer_len])
-  for (long tidx = 0; tidx < accumlen; tidx++) { // tidx: thread index
-    randstate_t randstate[7];
-    _class_particle sourcebuffer;
-    _class_particle targetbuffer;
-    // assign reduced weight to all particles
-    particles[tidx].p=particles[tidx].p/mult;
-    #pragma acc loop seq
-    for (long bidx = 1; bidx < mult; bidx++) { // bidx: block index
-      // preserve absorbed particle (for randstate)
-      sourcebuffer = particles[bidx*accumlen + tidx];
-      // buffer full particle struct
-      targetbuffer = particles[tidx];
-      // reassign previous randstate
-      targetbuffer.randstate[0] = sourcebuffer.randstate[0];
-      targetbuffer.randstate[1] = sourcebuffer.randstate[1];
-      targetbuffer.randstate[2] = sourcebuffer.randstate[2];
-      targetbuffer.randstate[3] = sourcebuffer.randstate[3];
-      targetbuffer.randstate[4] = sourcebuffer.randstate[4];
-      targetbuffer.randstate[5] = sourcebuffer.randstate[5];
-      targetbuffer.randstate[6] = sourcebuffer.randstate[6];
-      // apply
-      particles[bidx*accumlen + tidx] = targetbuffer;
-    }
-  }
-
-  // set out split multiplier value
-  *multiplier = mult;
-
-  // return expanded array size
-  return accumlen * mult;
-}
-
-#endif
-
-/*
-*  Fallback serial version of the one above.
-*/
-long sort_absorb_last_serial(_class_particle* particles, long len) {
-  long i = 0;
-  long j = len - 1;
-  _class_particle pbuffer;
-
-  // bubble
-  while (i < j) {
-    while (!particles[i]._absorbed && i<j) i++;
-    while (particles[j]._absorbed && i<j) j--;
-    if (i < j) {
-      pbuffer = particles[j];
-      particles[j] = particles[i];
-      particles[i] = pbuffer;
-      i++;
-      j--;
-    }
-  }
-
-  // return new length
-  if (i==j && !particles[i]._absorbed)
-    return i + 1;
-  else
-    return i;
-}
-
-/*******************************************************************************
-* mccoordschange: applies rotation to (x y z) and (vx vy vz) and Spin (sx,sy,sz)
-*******************************************************************************/
-void mccoordschange(Coords a, Rotation t, _class_particle *particle)
-{
-  Coords b, c;
-
-  b.x = particle->x;
-  b.y = particle->y;
-  b.z = particle->z;
-  c = rot_apply(t, b);
-  b = coords_add(c, a);
-  particle->x = b.x;
-  particle->y = b.y;
-  particle->z = b.z;
-
-#if MCCODE_PARTICLE_CODE == 2112
-    if (particle->vz != 0.0 || particle->vx != 0.0 || particle->vy != 0.0)
-      mccoordschange_polarisation(t, &(particle->vx), &(particle->vy), &(particle->vz));
-
-    if (particle->sz != 0.0 || particle->sx != 0.0 || particle->sy != 0.0)
-      mccoordschange_polarisation(t, &(particle->sx), &(particle->sy), &(particle->sz));
-#elif MCCODE_PARTICLE_CODE == 22
-    if (particle->kz != 0.0 || particle->kx != 0.0 || particle->ky != 0.0)
-      mccoordschange_polarisation(t, &(particle->kx), &(particle->ky), &(particle->kz));
-
-    if (particle->Ez != 0.0 || particle->Ex != 0.0 || particle->Ey != 0.0)
-      mccoordschange_polarisation(t, &(particle->Ex), &(particle->Ey), &(particle->Ez));
-#endif
-}
-
-/*******************************************************************************
-* mccoordschange_polarisation: applies rotation to vector (sx sy sz)
-*******************************************************************************/
-void mccoordschange_polarisation(Rotation t, double *sx, double *sy, double *sz)
-{
-  Coords b, c;
-
-  b.x = *sx;
-  b.y = *sy;
-  b.z = *sz;
-  c = rot_apply(t, b);
-  *sx = c.x;
-  *sy = c.y;
-  *sz = c.z;
-}
-
-/* SECTION: vector math  ==================================================== */
-
-/* normal_vec_func: Compute normal vector to (x,y,z). */
-void normal_vec(double *nx, double *ny, double *nz,
-                double x, double y, double z)
-{
-  double ax = fabs(x);
-  double ay = fabs(y);
-  double az = fabs(z);
-  double l;
-  if(x == 0 && y == 0 && z == 0)
-  {
-    *nx = 0;
-    *ny = 0;
-    *nz = 0;
-    return;
-  }
-  if(ax < ay)
-  {
-    if(ax < az)
-    {                           /* Use X axis */
-      l = sqrt(z*z + y*y);
-      *nx = 0;
-      *ny = z/l;
-      *nz = -y/l;
-      return;
+  if(ax < ay)
+  {
+    if(ax < az)
+    {                           /* Use X axis */
+      l = sqrt(z*z + y*y);
+      *nx = 0;
+      *ny = z/l;
+      *nz = -y/l;
+      return;
     }
   }
   else
@@ -3862,252 +4175,103 @@ int solve_2nd_order(double *t0, double *t1, double A, double B, double C){
 
 } /*solve_2nd_order_improved*/
 
-
 /*******************************************************************************
- * randvec_target_circle: Choose random direction towards target at (x,y,z)
- * with given radius.
- * If radius is zero, choose random direction in full 4PI, no target.
+ * solve_4th_order: fourth order equation solve:
+ *   A*t^4 + B*t^3 + C*t^2 + D*t + E = 0 for tmin < t <= tmax
+ * solve_4th_order(t, A,B,C,D,E, tmin,tmax)
+ *   returns the number of roots found in the interval, stored in increasing
+ *   order in 't', which must hold 4 values. Leading coefficients which are
+ *   exactly 0 lower the order of the equation.
+ * The roots of the successive derivatives split the interval into monotonic
+ * pieces, each holding at most one root, which is bracketed and refined with
+ * Newton steps falling back to bisection. The cost is thus bounded, and does
+ * not depend on a starting point. Double roots (tangent contact) are missed.
+ * EXAMPLE usage for intersection of a trajectory in a gravitation field with
+ * an ellipse, see Elliptic_guide_gravity.
  ******************************************************************************/
-void _randvec_target_circle(double *xo, double *yo, double *zo, double *solid_angle,
-        double xi, double yi, double zi, double radius,
-        _class_particle* _particle)
+#pragma acc routine seq
+int solve_4th_order(double *t, double A, double B, double C, double D, double E,
+  double tmin, double tmax)
 {
-  double l2, phi, theta, nx, ny, nz, xt, yt, zt, xu, yu, zu;
-
-  if(radius == 0.0)
-  {
-    /* No target, choose uniformly a direction in full 4PI solid angle. */
-    theta = acos(1 - rand0max(2));
-    phi = rand0max(2 * PI);
-    if(solid_angle)
-      *solid_angle = 4*PI;
-    nx = 1;
-    ny = 0;
-    nz = 0;
-    yi = sqrt(xi*xi+yi*yi+zi*zi);
-    zi = 0;
-    xi = 0;
-  }
-  else
-  {
-    double costheta0;
-    l2 = xi*xi + yi*yi + zi*zi; /* sqr Distance to target. */
-    costheta0 = sqrt(l2/(radius*radius+l2));
-    if (radius < 0) costheta0 *= -1;
-    if(solid_angle)
-    {
-      /* Compute solid angle of target as seen from origin. */
-        *solid_angle = 2*PI*(1 - costheta0);
-    }
-
-    /* Now choose point uniformly on circle surface within angle theta0 */
-    theta = acos (1 - rand0max(1 - costheta0)); /* radius on circle */
-    phi = rand0max(2 * PI); /* rotation on circle at given radius */
-    /* Now, to obtain the desired vector rotate (xi,yi,zi) angle theta around a
-       perpendicular axis u=i x n and then angle phi around i. */
-    if(xi == 0 && zi == 0)
-    {
-      nx = 1;
-      ny = 0;
-      nz = 0;
-    }
-    else
-    {
-      nx = -zi;
-      nz = xi;
-      ny = 0;
+  double q[5][5];     /* q[m][0..m]: derivative of order n-m, highest power first */
+  double r[2][6];     /* roots of the current and previous derivatives */
+  int    nr[2]={0,0};
+  int    n, m, i, k, cur=0;
+  double bound=0;
+
+  q[4][0]=A; q[4][1]=B; q[4][2]=C; q[4][3]=D; q[4][4]=E;
+  /* lower the order while the leading coefficient is 0 */
+  for (n=4, k=0; n > 0 && q[4][k] == 0; n--, k++);
+  if (n == 0) return 0;
+  for (i=0; i<=n; i++) q[n][i] = q[4][k+i];
+
+  /* all real roots are within the Cauchy bound */
+  for (i=1; i<=n; i++)
+    if (fabs(q[n][i]/q[n][0]) > bound) bound = fabs(q[n][i]/q[n][0]);
+  bound += 1;
+  if (tmax >  bound) tmax =  bound;
+  if (tmin < -bound) tmin = -bound;
+  if (tmax <= tmin) return 0;
+
+  /* successive derivatives, down to the linear one */
+  for (m=n-1; m>=1; m--)
+    for (i=0; i<=m; i++) q[m][i] = q[m+1][i]*(m+1-i);
+
+  for (m=1; m<=n; m++) {
+    int    prev = cur;
+    double a=tmin, fa=0;
+    cur = 1-cur;
+    nr[cur] = 0;
+    /* points splitting ]tmin,tmax] into monotonic pieces of q[m] */
+    for (k=0; k<=nr[prev]; k++) {
+      double b = (k < nr[prev] ? r[prev][k] : tmax);
+      double fb=0, df;
+      for (i=0; i<=m; i++) fb = fb*b + q[m][i];
+      if (k == 0) {
+        for (i=0, fa=0; i<=m; i++) fa = fa*a + q[m][i];
+      }
+      if (fb == 0 && b > tmin) {
+        r[cur][nr[cur]++] = b;
+      } else if ((fa < 0 && fb > 0) || (fa > 0 && fb < 0)) {
+        /* bracketed root: Newton steps, bisection when leaving the bracket */
+        double lo=a, hi=b, flo=fa, x=0.5*(a+b);
+        int    iter;
+        for (iter=0; iter < 100; iter++) {
+          double fx=0, xn;
+          for (i=0, df=0; i<=m; i++) { df = df*x + fx; fx = fx*x + q[m][i]; }
+          if (fx == 0) break;
+          if ((fx < 0) == (flo < 0)) { lo = x; flo = fx; } else hi = x;
+          xn = (df ? x - fx/df : 0.5*(lo+hi));
+          if (!(xn > lo && xn < hi)) xn = 0.5*(lo+hi);
+          if (fabs(xn-x) <= 2*DBL_EPSILON*fabs(xn) || hi-lo <= 2*DBL_EPSILON*fabs(hi)) {
+            x = xn; break;
+          }
+          x = xn;
+        }
+        r[cur][nr[cur]++] = x;
+      }
+      a = b; fa = fb;
     }
   }
+  for (k=0; k<nr[cur] && k<4; k++) t[k] = r[cur][k];
+  return k;
+} /* solve_4th_order */
 
-  /* [xyz]u = [xyz]i x n[xyz] (usually vertical) */
-  vec_prod(xu,  yu,  zu, xi, yi, zi,        nx, ny, nz);
-  /* [xyz]t = [xyz]i rotated theta around [xyz]u */
-  rotate  (xt,  yt,  zt, xi, yi, zi, theta, xu, yu, zu);
-  /* [xyz]o = [xyz]t rotated phi around n[xyz] */
-  rotate (*xo, *yo, *zo, xt, yt, zt, phi, xi, yi, zi);
-}
-/* randvec_target_circle */
 
-/*******************************************************************************
- * randvec_target_rect_angular: Choose random direction towards target at
- * (xi,yi,zi) with given ANGULAR dimension height x width. height=phi_x=[0,PI],
- * width=phi_y=[0,2*PI] (radians)
- * If height or width is zero, choose random direction in full 4PI, no target.
- *******************************************************************************/
-void _randvec_target_rect_angular(double *xo, double *yo, double *zo, double *solid_angle,
-        double xi, double yi, double zi, double width, double height, Rotation A,
-        _class_particle* _particle)
-{
-  double theta, phi, nx, ny, nz, xt, yt, zt, xu, yu, zu;
-  Coords tmp;
-  Rotation Ainverse;
 
-  rot_transpose(A, Ainverse);
 
-  if(height == 0.0 || width == 0.0)
-  {
-    randvec_target_circle(xo, yo, zo, solid_angle, xi, yi, zi, 0);
-    return;
-  }
-  else
-  {
-    if(solid_angle)
-    {
-      /* Compute solid angle of target as seen from origin. */
-      *solid_angle = 2*fabs(width*sin(height/2));
-    }
+/* SECTION: random numbers ==================================================
 
-    /* Go to global coordinate system */
+  How to add a new RNG:
 
-    tmp = coords_set(xi, yi, zi);
-    tmp = rot_apply(Ainverse, tmp);
-    coords_get(tmp, &xi, &yi, &zi);
-
-    /* Now choose point uniformly on the unit sphere segment with angle theta/phi */
-    phi   = width*randpm1()/2.0;
-    theta = asin(randpm1()*sin(height/2.0));
-    /* Now, to obtain the desired vector rotate (xi,yi,zi) angle theta around
-       n, and then phi around u. */
-    if(xi == 0 && zi == 0)
-    {
-      nx = 1;
-      ny = 0;
-      nz = 0;
-    }
-    else
-    {
-      nx = -zi;
-      nz = xi;
-      ny = 0;
-    }
-  }
-
-  /* [xyz]u = [xyz]i x n[xyz] (usually vertical) */
-  vec_prod(xu,  yu,  zu, xi, yi, zi,        nx, ny, nz);
-  /* [xyz]t = [xyz]i rotated theta around [xyz]u */
-  rotate  (xt,  yt,  zt, xi, yi, zi, theta, nx, ny, nz);
-  /* [xyz]o = [xyz]t rotated phi around n[xyz] */
-  rotate (*xo, *yo, *zo, xt, yt, zt, phi, xu,  yu,  zu);
-
-  /* Go back to local coordinate system */
-  tmp = coords_set(*xo, *yo, *zo);
-  tmp = rot_apply(A, tmp);
-  coords_get(tmp, &*xo, &*yo, &*zo);
-}
-/* randvec_target_rect_angular */
-
-/*******************************************************************************
- * randvec_target_rect_real: Choose random direction towards target at (xi,yi,zi)
- * with given dimension height x width (in meters !).
- *
- * Local emission coordinate is taken into account and corrected for 'order' times.
- * (See remarks posted to mcstas-users by George Apostolopoulus <gapost@ipta.demokritos.gr>)
- *
- * If height or width is zero, choose random direction in full 4PI, no target.
- *
- * Traditionally, this routine had the name randvec_target_rect - this is now a
- * a define (see mcstas-r.h) pointing here. If you use the old rouine, you are NOT
- * taking the local emmission coordinate into account.
-*******************************************************************************/
-void _randvec_target_rect_real(double *xo, double *yo, double *zo, double *solid_angle,
-        double xi, double yi, double zi,
-        double width, double height, Rotation A,
-        double lx, double ly, double lz, int order,
-        _class_particle* _particle)
-{
-  double dx, dy, dist, dist_p, nx, ny, nz, mx, my, mz, n_norm, m_norm;
-  double cos_theta;
-  Coords tmp;
-  Rotation Ainverse;
-
-  rot_transpose(A, Ainverse);
-
-  if(height == 0.0 || width == 0.0)
-  {
-    randvec_target_circle(xo, yo, zo, solid_angle,
-               xi, yi, zi, 0);
-    return;
-  }
-  else
-  {
-    /* Now choose point uniformly on rectangle within width x height */
-    dx = width*randpm1()/2.0;
-    dy = height*randpm1()/2.0;
-
-    /* Determine distance to target plane*/
-    dist = sqrt(xi*xi + yi*yi + zi*zi);
-    /* Go to global coordinate system */
-
-    tmp = coords_set(xi, yi, zi);
-    tmp = rot_apply(Ainverse, tmp);
-    coords_get(tmp, &xi, &yi, &zi);
-
-    /* Determine vector normal to trajectory axis (z) and gravity [0 1 0] */
-    vec_prod(nx, ny, nz, xi, yi, zi, 0, 1, 0);
-
-    /* This now defines the x-axis, normalize: */
-    n_norm=sqrt(nx*nx + ny*ny + nz*nz);
-    nx = nx/n_norm;
-    ny = ny/n_norm;
-    nz = nz/n_norm;
-
-    /* Now, determine our y-axis (vertical in many cases...) */
-    vec_prod(mx, my, mz, xi, yi, zi, nx, ny, nz);
-    m_norm=sqrt(mx*mx + my*my + mz*mz);
-    mx = mx/m_norm;
-    my = my/m_norm;
-    mz = mz/m_norm;
-
-    /* Our output, random vector can now be defined by linear combination: */
-
-    *xo = xi + dx * nx + dy * mx;
-    *yo = yi + dx * ny + dy * my;
-    *zo = zi + dx * nz + dy * mz;
-
-    /* Go back to local coordinate system */
-    tmp = coords_set(*xo, *yo, *zo);
-    tmp = rot_apply(A, tmp);
-    coords_get(tmp, &*xo, &*yo, &*zo);
-
-    /* Go back to local coordinate system */
-    tmp = coords_set(xi, yi, zi);
-    tmp = rot_apply(A, tmp);
-    coords_get(tmp, &xi, &yi, &zi);
-
-    if (solid_angle) {
-      /* Calculate vector from local point to remote random point */
-      lx = *xo - lx;
-      ly = *yo - ly;
-      lz = *zo - lz;
-      dist_p = sqrt(lx*lx + ly*ly + lz*lz);
-
-      /* Adjust the 'solid angle' */
-      /* 1/r^2 to the chosen point times cos(\theta) between the normal */
-      /* vector of the target rectangle and direction vector of the chosen point. */
-      cos_theta = (xi * lx + yi * ly + zi * lz) / (dist * dist_p);
-      *solid_angle = width * height / (dist_p * dist_p);
-      int counter;
-      for (counter = 0; counter < order; counter++) {
-        *solid_angle = *solid_angle * cos_theta;
-      }
-    }
-  }
-}
-/* randvec_target_rect_real */
-
-
-/* SECTION: random numbers ==================================================
-
-  How to add a new RNG:
-
-  - Use an rng with a manegable state vector, e.g. of lengt 4 or 7. The state
-  will sit on the particle struct as a "randstate_t state[RANDSTATE_LEN]"
-  - If the rng has a long state (as MT), set an empty "srandom" and initialize
-  it explicitly using the appropriate define (RNG_ALG)
-  - Add a seed and a random function (the transforms will be reused)
-  - Write the proper defines in mccode-r.h, e.g. randstate_t and RANDSTATE_LEN,
-  srandom and random.
-  - Compile using -DRNG_ALG=<selector int value>
+  - Use an rng with a manegable state vector, e.g. of lengt 4 or 7. The state
+  will sit on the particle struct as a "randstate_t state[RANDSTATE_LEN]"
+  - If the rng has a long state (as MT), set an empty "srandom" and initialize
+  it explicitly using the appropriate define (RNG_ALG)
+  - Add a seed and a random function (the transforms will be reused)
+  - Write the proper defines in mccode-r.h, e.g. randstate_t and RANDSTATE_LEN,
+  srandom and random.
+  - Compile using -DRNG_ALG=<selector int value>
 
 ============================================================================= */
 
@@ -4415,115 +4579,696 @@ double _randminmax(double min, double max, randstate_t* state) {
 }
 
 
-/* SECTION: main and signal handlers ======================================== */
+/* SECTION: checkpoint and resume =========================================== */
 
 /*******************************************************************************
-* mchelp: displays instrument executable help with possible options
+* A checkpoint file (one per MPI node, suffixed with the node rank) holds, in
+* host byte order:
+*   MCCHECKPOINT_MAGIC, int32 byte order mark 0x01020304,
+*   uint64 parameter hash, int32 nodes, int32 RNG_ALG, int64 seed,
+*   uint64 ncount, uint64 events done on this node,
+*   with the Mersenne Twister: int32 mti, uint32 mt[624],
+*   int32 nblocks, then for each block: char name[64], uint64 size, data.
+* The blocks are registered in the same order by INITIALIZE at each run, and
+* are checked by name and size at resume.
 *******************************************************************************/
-static void
-mchelp(char *pgmname)
-{
-  int i;
+struct mccheckpoint_struct mccheckpoint = { 0 };
 
-  fprintf(stderr, "%s (%s) instrument simulation, generated with " MCCODE_STRING " (" MCCODE_DATE ")\n", instrument_name, instrument_source);
-  fprintf(stderr, "Usage: %s [options] [parm=value ...]\n", pgmname);
-  fprintf(stderr,
-"Options are:\n"
-"  -s SEED   --seed=SEED      Set random seed (must be != 0)\n"
-"  -n COUNT  --ncount=COUNT   Set number of particles to simulate.\n"
-"  -d DIR    --dir=DIR        Put all data files in directory DIR.\n"
-"  -t        --trace          Enable trace of " MCCODE_PARTICLE "s through instrument.\n"
-"                             (Use -t=2 or --trace=2 for modernised mcdisplay rendering)\n"
-"  -g        --gravitation    Enable gravitation for all trajectories.\n"
-"  --no-output-files          Do not write any data files.\n"
-"  -h        --help           Show this help message.\n"
-"  -i        --info           Detailed instrument information.\n"
-"  --list-parameters          Print the instrument parameters to standard out\n"
-"  -y        --yes            Assume default values for all parameters with a default\n"
-"  --meta-list                Print names of components which defined metadata\n"
-"  --meta-defined COMP[:NAME] Print component defined metadata names, or (0,1) if NAME provided\n"
-"  --meta-type COMP:NAME      Print metadata format type specified in definition\n"
-"  --meta-data COMP:NAME      Print the metadata text\n"
-"  --source                   Show the instrument code which was compiled.\n"
-#ifdef OPENACC
-"\n"
-"  --vecsize                  OpenACC vector-size (default: 128)\n"
-"  --numgangs                 Number of OpenACC gangs (default: 7813)\n"
-"  --gpu_innerloop            Maximum rays to process pr. OpenACC \n"
-"                             kernel run (default: 2147483647)\n"
-"\n"
-#endif
-"\n"
-"  --bufsiz                   Monitor_nD list/buffer-size (default: 1000000)\n"
-"  --format=FORMAT            Output data files using FORMAT="
-   FLAVOR_UPPER
-#ifdef USE_NEXUS
-   " NEXUS\n"
-"  --IDF                      Embed an xml-formatted IDF instrument definition\n"
-"                             in the NeXus file (if existent in .)\n\n"
-#else
-"\n\n"
-#endif
-);
+/* mccheckpoint_filename: per node file name, to be freed */
+static char *mccheckpoint_filename(char *name)
+{
+  char *file = (char*)malloc(strlen(name) + 32);
+  if (!file) return NULL;
+  strcpy(file, name);
 #ifdef USE_MPI
-  fprintf(stderr,
-  "This instrument has been compiled with MPI support.\n  Use 'mpirun %s [options] [parm=value ...]'.\n", pgmname);
-#endif
-#ifdef OPENACC
-  fprintf(stderr,
-  "This instrument has been compiled with NVIDIA GPU support through OpenACC.\n  Running on systems without such devices will lead to segfaults.\nFurter, fprintf, sprintf and printf have been removed from any component TRACE.\n");
+  if (mpi_node_count > 1) sprintf(file + strlen(file), ".%i", mpi_node_rank);
 #endif
+  return file;
+}
 
-  if(numipar > 0)
-  {
-    fprintf(stderr, "Instrument parameters are:\n");
-    for(i = 0; i < numipar; i++)
-      if (mcinputtable[i].val && strlen(mcinputtable[i].val))
-        fprintf(stderr, "  %-16s(%s) [default='%s']\n", mcinputtable[i].name,
-        (*mcinputtypes[mcinputtable[i].type].parminfo)(mcinputtable[i].name),
-        mcinputtable[i].val);
-      else
-        fprintf(stderr, "  %-16s(%s)\n", mcinputtable[i].name,
-        (*mcinputtypes[mcinputtable[i].type].parminfo)(mcinputtable[i].name));
+/* mccheckpoint_params: FNV-1a hash of the instrument parameter values */
+static uint64_t mccheckpoint_params(void)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  char     buffer[CHAR_BUF_LENGTH*16];
+  char    *c;
+  int      i;
+
+  for (i = 0; i < numipar; i++) {
+    strcpy(buffer, "NULL");
+    if (mcinputtable[i].par)
+      mcinputtypes[mcinputtable[i].type].printer(buffer, mcinputtable[i].par);
+    for (c = mcinputtable[i].name; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    hash = (hash ^ '=') * 1099511628211ULL;
+    for (c = buffer; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
   }
+  return hash;
+}
 
-#ifndef NOSIGNALS
-  fprintf(stderr, "Known signals are: "
-#ifdef SIGUSR1
-  "USR1 (status) "
-#endif
-#ifdef SIGUSR2
-  "USR2 (save) "
-#endif
-#ifdef SIGBREAK
-  "BREAK (save) "
-#endif
-#ifdef SIGTERM
-  "TERM (save and exit)"
-#endif
-  "\n");
-#endif /* !NOSIGNALS */
-} /* mchelp */
+/*******************************************************************************
+* mccheckpoint_add: register a memory block to be written in checkpoints and
+*   restored at resume. Does nothing unless --checkpoint or --resume is given.
+*******************************************************************************/
+void mccheckpoint_add(char *name, void *ptr, size_t size)
+{
+  struct mccheckpoint_block *b;
+
+  if ((!mccheckpoint.file && !mccheckpoint.resume) || !ptr || !size) return;
+  if (mccheckpoint.nblocks >= mccheckpoint.maxblocks) {
+    int max = mccheckpoint.maxblocks ? 2*mccheckpoint.maxblocks : 64;
+    b = (struct mccheckpoint_block*)realloc(mccheckpoint.blocks, max*sizeof(*b));
+    if (!b) exit(-fprintf(stderr, "Error: Out of memory (mccheckpoint_add)\n"));
+    mccheckpoint.blocks    = b;
+    mccheckpoint.maxblocks = max;
+  }
+  b = mccheckpoint.blocks + mccheckpoint.nblocks++;
+  strncpy(b->name, name, sizeof(b->name)-1);
+  b->name[sizeof(b->name)-1] = '\0';
+  b->ptr  = ptr;
+  b->size = size;
+}
 
+/* mccheckpoint_remove: unregister a block, e.g. when its array is freed */
+void mccheckpoint_remove(void *ptr)
+{
+  int i;
+  for (i = 0; i < mccheckpoint.nblocks; i++)
+    if (mccheckpoint.blocks[i].ptr == ptr) mccheckpoint.blocks[i].ptr = NULL;
+}
 
-/* mcshowhelp: show help and exit with 0 */
-static void
-mcshowhelp(char *pgmname)
+/*******************************************************************************
+* mccheckpoint_save: write a checkpoint of this node, through a temporary file.
+*   Must be called between two events. Returns 1 on success.
+*******************************************************************************/
+int mccheckpoint_save(void)
 {
-  mchelp(pgmname);
-  exit(0);
+  char    *file, *tmp;
+  FILE    *f;
+  uint32_t bom = 0x01020304;
+  uint64_t u64;
+  int64_t  i64;
+  int32_t  i32;
+  int      i, ok = 1;
+
+  if (!mccheckpoint.file || !(file = mccheckpoint_filename(mccheckpoint.file))) return 0;
+  tmp = (char*)malloc(strlen(file) + 5);
+  sprintf(tmp, "%s.tmp", file);
+  f = fopen(tmp, "wb");
+  if (!f) {
+    fprintf(stderr, "Warning: can not write checkpoint %s (mccheckpoint_save)\n", tmp);
+    free(tmp); free(file);
+    return 0;
+  }
+  fwrite(MCCHECKPOINT_MAGIC, 1, 8, f);
+  fwrite(&bom, sizeof(bom), 1, f);
+  u64 = mccheckpoint_params();        fwrite(&u64, sizeof(u64), 1, f);
+#ifdef USE_MPI
+  i32 = mpi_node_count;
+#else
+  i32 = 1;
+#endif
+  fwrite(&i32, sizeof(i32), 1, f);
+  i32 = RNG_ALG;                      fwrite(&i32, sizeof(i32), 1, f);
+  i64 = mccheckpoint.seed;            fwrite(&i64, sizeof(i64), 1, f);
+  u64 = mccheckpoint.ncount;          fwrite(&u64, sizeof(u64), 1, f);
+  u64 = mcprogress.events;            fwrite(&u64, sizeof(u64), 1, f);
+#if RNG_ALG == _RNG_ALG_MT
+  i32 = mti;                          fwrite(&i32, sizeof(i32), 1, f);
+  fwrite(mt, sizeof(mt), 1, f);
+#endif
+  i32 = mccheckpoint.nblocks;         fwrite(&i32, sizeof(i32), 1, f);
+  for (i = 0; i < mccheckpoint.nblocks; i++) {
+    struct mccheckpoint_block *b = mccheckpoint.blocks + i;
+    fwrite(b->name, sizeof(b->name), 1, f);
+    u64 = b->ptr ? b->size : 0;       fwrite(&u64, sizeof(u64), 1, f);
+    if (b->ptr && fwrite(b->ptr, 1, b->size, f) != b->size) ok = 0;
+  }
+  if (fclose(f) || !ok) {
+    fprintf(stderr, "Warning: can not write checkpoint %s (mccheckpoint_save)\n", tmp);
+    remove(tmp);
+    ok = 0;
+  } else ok = !rename(tmp, file);
+  if (ok) MPI_MASTER(
+    printf("Checkpoint: %llu events written to %s\n", mcprogress.events, file);
+  );
+  free(tmp); free(file);
+  return ok;
 }
 
-/* mcusage: display usage when error in input arguments and exit with 1 */
-static void
-mcusage(char *pgmname)
+/* mccheckpoint_read: read n bytes or exit */
+static void mccheckpoint_read(void *ptr, size_t n, FILE *f, char *file)
 {
-  fprintf(stderr, "Error: incorrect command line arguments\n");
-  mchelp(pgmname);
-  exit(1);
+  if (fread(ptr, 1, n, f) != n)
+    exit(-fprintf(stderr, "Error: checkpoint %s is truncated (mccheckpoint_read)\n", file));
 }
 
-/* mcenabletrace: enable trace/mcdisplay or error if requires recompile */
+/* mccheckpoint_open: open the --resume file of this node and check its header */
+static FILE *mccheckpoint_open(char **file)
+{
+  char     magic[8];
+  uint32_t bom;
+  uint64_t u64;
+  int32_t  i32;
+  FILE    *f;
+
+  *file = mccheckpoint_filename(mccheckpoint.resume);
+  f = *file ? fopen(*file, "rb") : NULL;
+  if (!f)
+    exit(-fprintf(stderr, "Error: can not open checkpoint %s (mccheckpoint_open)\n", *file ? *file : mccheckpoint.resume));
+  mccheckpoint_read(magic, 8, f, *file);
+  mccheckpoint_read(&bom, sizeof(bom), f, *file);
+  if (strncmp(magic, MCCHECKPOINT_MAGIC, 8) || bom != 0x01020304)
+    exit(-fprintf(stderr, "Error: %s is not a checkpoint of this machine (mccheckpoint_open)\n", *file));
+  mccheckpoint_read(&u64, sizeof(u64), f, *file);
+  if (u64 != mccheckpoint_params())
+    exit(-fprintf(stderr, "Error: checkpoint %s was written with other instrument parameters (mccheckpoint_open)\n", *file));
+  mccheckpoint_read(&i32, sizeof(i32), f, *file);
+#ifdef USE_MPI
+  if (i32 != mpi_node_count)
+#else
+  if (i32 != 1)
+#endif
+    exit(-fprintf(stderr, "Error: checkpoint %s was written with %i MPI nodes (mccheckpoint_open)\n", *file, (int)i32));
+  mccheckpoint_read(&i32, sizeof(i32), f, *file);
+  if (i32 != RNG_ALG)
+    exit(-fprintf(stderr, "Error: checkpoint %s was written with RNG_ALG=%i (mccheckpoint_open)\n", *file, (int)i32));
+  return f;
+}
+
+/*******************************************************************************
+* mccheckpoint_header: at the end of option parsing, take the seed and ncount
+*   from the --resume file, so that INITIALIZE and the ray loop see the same
+*   values as the checkpointed run.
+*******************************************************************************/
+void mccheckpoint_header(void)
+{
+  char   *file;
+  FILE   *f;
+  int64_t i64;
+  uint64_t u64;
+
+#if defined(OPENACC) || defined(FUNNEL)
+  if (mccheckpoint.file || mccheckpoint.resume) {
+    fprintf(stderr, "Warning: --checkpoint and --resume are only available for CPU builds without FUNNEL. Ignored.\n");
+    mccheckpoint.file = mccheckpoint.resume = NULL;
+  }
+#endif
+  if (mccheckpoint.resume) {
+    f = mccheckpoint_open(&file);
+    mccheckpoint_read(&i64, sizeof(i64), f, file);
+    mcseed = (long)i64;
+    mccheckpoint_read(&u64, sizeof(u64), f, file);
+    mcset_ncount(u64);
+    fclose(f);
+    free(file);
+  }
+  mccheckpoint.seed   = mcseed;
+  mccheckpoint.ncount = mcget_ncount();
+  if (mccheckpoint.interval <= 0) mccheckpoint.interval = 600;
+}
+
+/*******************************************************************************
+* mccheckpoint_start: before the ray loop, restore the event position, RNG
+*   state and registered blocks from the --resume file.
+*******************************************************************************/
+void mccheckpoint_start(void)
+{
+  char    *file;
+  FILE    *f;
+  char     name[64];
+  int64_t  i64;
+  uint64_t u64;
+  int32_t  i32;
+  int      i;
+
+  mccheckpoint.start = 0;
+  if (mccheckpoint.resume) {
+    f = mccheckpoint_open(&file);
+    mccheckpoint_read(&i64, sizeof(i64), f, file);
+    mccheckpoint_read(&u64, sizeof(u64), f, file);
+    mccheckpoint_read(&u64, sizeof(u64), f, file);
+    mccheckpoint.start = mcprogress.events = u64;
+#if RNG_ALG == _RNG_ALG_MT
+    mccheckpoint_read(&i32, sizeof(i32), f, file);
+    mti = i32;
+    mccheckpoint_read(mt, sizeof(mt), f, file);
+#endif
+    mccheckpoint_read(&i32, sizeof(i32), f, file);
+    if (i32 != mccheckpoint.nblocks)
+      exit(-fprintf(stderr, "Error: checkpoint %s holds %i blocks, the instrument has %i (mccheckpoint_start)\n",
+        file, (int)i32, mccheckpoint.nblocks));
+    for (i = 0; i < mccheckpoint.nblocks; i++) {
+      struct mccheckpoint_block *b = mccheckpoint.blocks + i;
+      mccheckpoint_read(name, sizeof(name), f, file);
+      mccheckpoint_read(&u64, sizeof(u64), f, file);
+      if (strncmp(name, b->name, sizeof(name)) || u64 != (b->ptr ? b->size : 0))
+        exit(-fprintf(stderr, "Error: checkpoint %s block %i is %s (%llu bytes), expected %s (%llu bytes) (mccheckpoint_start)\n",
+          file, i, name, (unsigned long long)u64, b->name, (unsigned long long)(b->ptr ? b->size : 0)));
+      if (u64) mccheckpoint_read(b->ptr, u64, f, file);
+    }
+    fclose(f);
+    MPI_MASTER(
+    printf("Resuming from %s at event %llu\n", file, mccheckpoint.start);
+    );
+    free(file);
+  }
+  mccheckpoint.next    = mcprogress_time() + mccheckpoint.interval;
+  mccheckpoint.tracing = 1;
+}
+
+/* mccheckpoint_stop: end of the ray loop, no more checkpoints */
+void mccheckpoint_stop(void)
+{
+  mccheckpoint.tracing = 0;
+}
+
+/* SECTION: bounded run ===================================================== */
+
+/* the precision probe runs the SAVE in a forked copy of the process, which
+   must not enter the MPI reductions of mcdetector_out */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(OPENACC) && !defined(USE_MPI)
+#define MCBOUND_FORK
+#endif
+
+/*******************************************************************************
+* mcbound_header: at the end of option parsing, check the --time-limit and
+*   --target-error options, and record the ncount with which INITIALIZE
+*   normalises the source weights.
+*******************************************************************************/
+void mcbound_header(void)
+{
+  mcbound.ncount = mcget_ncount();
+  if (mcbound.time_limit < 0 || mcbound.target_error < 0)
+    exit(-fprintf(stderr, "Error: --time-limit and --target-error must be positive (mcbound_header)\n"));
+  if (!mcbound.target_error) return;
+#ifndef MCBOUND_FORK
+  exit(-fprintf(stderr, "Error: --target-error is only available on Unix CPU builds without MPI (mcbound_header)\n"));
+#endif
+  if (!mcbound.monitor)
+    exit(-fprintf(stderr, "Error: --target-error requires --target-monitor=COMP (mcbound_header)\n"));
+  mcbound.index = _getcomp_index(mcbound.monitor);
+  if (mcbound.index < 0)
+    exit(-fprintf(stderr, "Error: --target-monitor: no component %s in instrument %s (mcbound_header)\n",
+      mcbound.monitor, instrument_name));
+}
+
+/*******************************************************************************
+* mcbound_probe: relative error on the --target-monitor data, or -1 if none.
+*   The SAVE runs in a forked copy of the process, which sends the error back
+*   through a pipe: whatever the SAVE changes (e.g. Monitor_nD fixing its auto
+*   limits, or flushing its list buffer) is lost with the copy. When the copy
+*   can not be made, the error is unknown (HUGE_VAL) until the next probe.
+*******************************************************************************/
+static double mcbound_probe(void)
+{
+  double result[2] = { 0, HUGE_VAL }; /* has_save, error */
+#ifdef MCBOUND_FORK
+  int    fd[2];
+  pid_t  pid;
+
+  if (pipe(fd)) return mcbound.error = HUGE_VAL;
+  pid = fork();
+  if (pid == 0) {
+    close(fd[0]);
+    mcbound.error = -1;
+    mcbound.probe = mcbound.index;
+    result[0] = _savecomp(mcbound.index);
+    result[1] = mcbound.error;
+    if (write(fd[1], result, sizeof(result)) != sizeof(result)) _exit(1);
+    _exit(0); /* without flushing the stdio buffers of the parent */
+  }
+  close(fd[1]);
+  if (pid < 0 || read(fd[0], result, sizeof(result)) != sizeof(result)) {
+    result[0] = 1;
+    result[1] = HUGE_VAL;
+  }
+  close(fd[0]);
+  if (pid > 0) waitpid(pid, NULL, 0);
+#endif
+  mcbound.error = result[1];
+  if (!result[0] || mcbound.error < 0) {
+    MPI_MASTER(
+    fprintf(stderr, "Warning: --target-monitor %s does not output any data. --target-error ignored.\n",
+      mcbound.monitor);
+    );
+    mcbound.target_error = 0;
+  }
+  return mcbound.error;
+}
+
+/*******************************************************************************
+* mcbound_check: from mcprogress_tick, sets mcbound.stop when the time limit is
+*   reached (1) or, every MCBOUND_INTERVAL, when the probed relative error is
+*   below the target (2), which MPI builds do not probe (see MCBOUND_FORK).
+*   As the error goes as 1/sqrt(events), the next probe is brought forward to
+*   when the target is expected, at the current event rate.
+*******************************************************************************/
+void mcbound_check(double now)
+{
+  double target = mcbound.target_error;
+  double rate, eta;
+
+  if (mcbound.stop) return;
+  if (mcbound.time_limit && now - mcprogress.start >= mcbound.time_limit) {
+    mcbound.stop = 1;
+    return;
+  }
+  if (!target || now < mcbound.next) return;
+  mcbound.next = now + MCBOUND_INTERVAL;
+  if (mcbound_probe() < 0) return;
+  if (mcbound.error <= target) {
+    mcbound.stop = 2;
+    return;
+  }
+  rate = now > mcprogress.start ?
+    (mcprogress.events - mccheckpoint.start)/(now - mcprogress.start) : 0;
+  if (rate > 0 && isfinite(mcbound.error)) {
+    eta = mcprogress.events*(mcbound.error*mcbound.error/(target*target) - 1)/rate;
+    if (eta < MCBOUND_INTERVAL) mcbound.next = now + eta;
+  }
+}
+
+/*******************************************************************************
+* mcbound_finish: after the ray loop and the MPI merge of the event counters.
+*   When fewer events than requested were traced, sets the scaling applied by
+*   detector_import to the data, and the ncount written in the headers.
+*******************************************************************************/
+void mcbound_finish(void)
+{
+  unsigned long long events = mcprogress.events;
+
+  if (!mcbound.time_limit && !mcbound.monitor) return;
+  if (!events || events >= mcbound.ncount) return;
+  mcbound.scale = (double)mcbound.ncount/events;
+  MPI_MASTER(
+  if (mcbound.stop == 2)
+    printf("Bounded run: relative error %g on %s reached after %llu events\n",
+      mcbound.error, mcbound.monitor, events);
+  else
+    printf("Bounded run: time limit %g [s] reached after %llu events\n",
+      mcbound.time_limit, events);
+  );
+#ifdef USE_MPI
+  events /= mpi_node_count;
+#endif
+  mcset_ncount(events);
+}
+
+
+/* SECTION: parameter scan ================================================== */
+
+struct mcscan_struct mcscan = { 0 };
+
+/*******************************************************************************
+* mcscan_assign: checks the NAME=VALUE assignments of the scan point index, and
+*   sets the instrument parameters when set is true (the other parameters keep
+*   their value from the command line or the previous point).
+*******************************************************************************/
+static void mcscan_assign(int index, int set)
+{
+  char *point, *name, *value;
+  int   j, len;
+
+  point = (char*)malloc(strlen(mcscan.points[index]) + 1);
+  if (!point) exit(-fprintf(stderr, "Error: Out of memory (mcscan_assign)\n"));
+  for (name = mcscan.points[index]; *(name += strspn(name, " \t")); name += len) {
+    len = strcspn(name, " \t");
+    strncpy(point, name, len);
+    point[len] = '\0';
+    if (!(value = strchr(point, '=')))
+      exit(-fprintf(stderr, "Error: --scan point %i: '%s' is not NAME=VALUE (mcscan_assign)\n",
+        index, point));
+    *value++ = '\0';
+    for (j = 0; j < numipar; j++)
+      if (!strcmp(mcinputtable[j].name, point)) break;
+    if (j == numipar)
+      exit(-fprintf(stderr, "Error: --scan point %i: unrecognized parameter %s (mcscan_assign)\n",
+        index, point));
+    if (set && (!strlen(value)
+        || !(*mcinputtypes[mcinputtable[j].type].getparm)(value, mcinputtable[j].par))) {
+      (*mcinputtypes[mcinputtable[j].type].error)(mcinputtable[j].name, value);
+      exit(1);
+    }
+  }
+  free(point);
+}
+
+/*******************************************************************************
+* mcscan_point: sets the instrument parameters of the scan point index, and its
+*   output directory DIR/index.
+*******************************************************************************/
+static void mcscan_point(int index)
+{
+  char path[CHAR_BUF_LENGTH];
+
+  mcscan.index = index;
+  mcscan_assign(index, 1);
+
+  /* each point runs as a simulation of its own */
+  mcset_ncount(mcscan.ncount);
+  mcbound.stop  = 0;
+  mcbound.next  = 0;
+  mcbound.scale = 0;
+  if (mcscan.dir) {
+    snprintf(path, CHAR_BUF_LENGTH, "%s%c%i", mcscan.dir, MC_PATHSEP_C, index);
+    mcuse_dir(strdup(path));
+  }
+  MPI_MASTER(
+  printf("Scan point %i of %i: %s\n", index + 1, mcscan.count, mcscan.points[index]);
+  );
+}
+
+/*******************************************************************************
+* mcscan_read: reads the --scan file: points as lines of NAME=VALUE
+*   assignments, # for comments.
+*******************************************************************************/
+static void mcscan_read(void)
+{
+  char  line[16*CHAR_BUF_LENGTH];
+  char *p;
+  FILE *f;
+  int   i;
+
+  f = fopen(mcscan.file, "r");
+  if (!f)
+    exit(-fprintf(stderr, "Error: can not read the --scan file %s (mcscan_read)\n", mcscan.file));
+  while (fgets(line, sizeof(line), f)) {
+    if ((p = strchr(line, '#'))) *p = '\0';
+    for (p = line + strlen(line); p > line && strchr(" \t\r\n", p[-1]); *--p = '\0');
+    if (!line[strspn(line, " \t")]) continue;
+    mcscan.points = (char**)realloc(mcscan.points, (mcscan.count + 1)*sizeof(char*));
+    if (!mcscan.points || !(mcscan.points[mcscan.count] = strdup(line)))
+      exit(-fprintf(stderr, "Error: Out of memory (mcscan_read)\n"));
+    mcscan.count++;
+  }
+  fclose(f);
+  if (!mcscan.count)
+    exit(-fprintf(stderr, "Error: no point in the --scan file %s (mcscan_read)\n", mcscan.file));
+  for (i = 0; i < mcscan.count; i++) mcscan_assign(i, 0);
+}
+
+/*******************************************************************************
+* mcscan_sets: returns 1 when the point index of the scan assigns the
+*   instrument parameter name.
+*******************************************************************************/
+static int mcscan_sets(int index, char *name)
+{
+  char *p = mcscan.points[index];
+  int   len = strlen(name);
+
+  while (*(p += strspn(p, " \t"))) {
+    if (!strncmp(p, name, len) && p[len] == '=') return 1;
+    p += strcspn(p, " \t");
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* mcscan_keeps: from the generated INITIALISE at the first point, returns 1
+*   when a component instance may keep its state after INITIALIZE for the
+*   whole --scan --scan-keep: no point assigns any of the instrument
+*   parameters deps (as " name name ") it depends on.
+*******************************************************************************/
+int mcscan_keeps(char *deps)
+{
+  char name[CHAR_BUF_LENGTH];
+  int  i, len;
+
+  if (!mcscan.keep || !mcscan.count) return 0;
+  for (deps += strspn(deps, " "); *deps; deps += len + strspn(deps + len, " ")) {
+    len = strcspn(deps, " ");
+    if (len >= CHAR_BUF_LENGTH) return 0;
+    strncpy(name, deps, len);
+    name[len] = '\0';
+    for (i = 0; i < mcscan.count; i++)
+      if (mcscan_sets(i, name)) return 0;
+  }
+  return 1;
+}
+
+/*******************************************************************************
+* mcscan_header: at the end of option parsing, creates the output directory
+*   dir of the --scan, and sets its first point.
+*******************************************************************************/
+void mcscan_header(char *dir)
+{
+  if (mccheckpoint.file || mccheckpoint.resume || mctrace_filename)
+    exit(-fprintf(stderr, "Error: --scan can not be used with --checkpoint, --resume or --trace-file (mcscan_header)\n"));
+  if (!mcdisable_output_files) {
+    if (!dir || !strlen(dir))
+      exit(-fprintf(stderr, "Error: --scan requires an output directory (-d) (mcscan_header)\n"));
+    mcuse_dir(dir);
+    mcscan.dir = dirname;
+  }
+  mcscan.ncount = mcget_ncount();
+  mcscan_point(0);
+}
+
+/*******************************************************************************
+* mcscan_next: from mccode_main, after a point of the scan has been simulated,
+*   sets the next point. Returns 0 at the end of the scan (or without --scan).
+*******************************************************************************/
+int mcscan_next(void)
+{
+  if (mcscan.index + 1 >= mcscan.count) return 0;
+  mcscan_point(mcscan.index + 1);
+  return 1;
+}
+
+
+/* SECTION: main and signal handlers ======================================== */
+
+/*******************************************************************************
+* mchelp: displays instrument executable help with possible options
+*******************************************************************************/
+static void
+mchelp(char *pgmname)
+{
+  int i;
+
+  fprintf(stderr, "%s (%s) instrument simulation, generated with " MCCODE_STRING " (" MCCODE_DATE ")\n", instrument_name, instrument_source);
+  fprintf(stderr, "Usage: %s [options] [parm=value ...]\n", pgmname);
+  fprintf(stderr,
+"Options are:\n"
+"  -s SEED   --seed=SEED      Set random seed (must be != 0)\n"
+"  -n COUNT  --ncount=COUNT   Set number of particles to simulate.\n"
+"  -d DIR    --dir=DIR        Put all data files in directory DIR.\n"
+"  -t        --trace          Enable trace of " MCCODE_PARTICLE "s through instrument.\n"
+"                             (Use -t=2 or --trace=2 for modernised mcdisplay rendering)\n"
+"  --status-file=FILE         Write the progress, rate, ETA and absorbed fractions\n"
+"                             to FILE during the simulation (also sent on SIGUSR1).\n"
+"  --status-interval=SEC      Time between two writes of the status file (default: 10).\n"
+"  --trace-file=FILE          Enable trace, writing the " MCCODE_PARTICLE " events to FILE in\n"
+"                             binary form instead of text on standard out.\n"
+"  --trace-decode=FILE        Print a --trace-file FILE as trace text and exit.\n"
+"  --checkpoint=FILE          Periodically save the simulation state to FILE, also\n"
+"                             on SIGUSR2, and on SIGTERM before exiting.\n"
+"  --checkpoint-interval=SEC  Time between two checkpoints (default: 600).\n"
+"  --resume=FILE              Continue the simulation saved in checkpoint FILE. The\n"
+"                             instrument parameters must be the same.\n"
+"  --time-limit=SEC           End the simulation after SEC seconds of ray tracing.\n"
+"  --target-error=REL         End the simulation when the relative error on the\n"
+"                             intensity of the --target-monitor reaches REL.\n"
+"  --target-monitor=COMP      Monitor component probed for --target-error, on Unix\n"
+"                             CPU builds without MPI only.\n"
+"                             With these, COUNT is a maximum and the results are\n"
+"                             normalised to the rays actually simulated. GPU and\n"
+"                             FUNNEL builds check between --gpu_innerloop batches.\n"
+"  --scan=FILE                Simulate in turn the points of FILE, one per line of\n"
+"                             parm=value assignments, into DIR/0, DIR/1, ...\n"
+"  --scan-keep                Initialise once for the whole scan the components\n"
+"                             without SAVE whose parameters, and positions when\n"
+"                             their INITIALIZE uses them, are not scanned.\n"
+"  -g        --gravitation    Enable gravitation for all trajectories.\n"
+"  --no-output-files          Do not write any data files.\n"
+"  -h        --help           Show this help message.\n"
+"  -i        --info           Detailed instrument information.\n"
+"  --list-parameters          Print the instrument parameters to standard out\n"
+"  -y        --yes            Assume default values for all parameters with a default\n"
+"  --meta-list                Print names of components which defined metadata\n"
+"  --meta-defined COMP[:NAME] Print component defined metadata names, or (0,1) if NAME provided\n"
+"  --meta-type COMP:NAME      Print metadata format type specified in definition\n"
+"  --meta-data COMP:NAME      Print the metadata text\n"
+"  --source                   Show the instrument code which was compiled.\n"
+#ifdef OPENACC
+"\n"
+"  --vecsize                  OpenACC vector-size (default: 128)\n"
+"  --numgangs                 Number of OpenACC gangs (default: 7813)\n"
+"  --gpu_innerloop            Maximum rays to process pr. OpenACC \n"
+"                             kernel run (default: 2147483647)\n"
+"\n"
+#endif
+"\n"
+"  --bufsiz                   Monitor_nD list/buffer-size (default: 1000000)\n"
+"  --format=FORMAT            Output data files using FORMAT="
+   FLAVOR_UPPER
+#ifdef USE_NEXUS
+   " NEXUS\n"
+"  --IDF                      Embed an xml-formatted IDF instrument definition\n"
+"                             in the NeXus file (if existent in .)\n\n"
+#else
+"\n\n"
+#endif
+);
+#ifdef USE_MPI
+  fprintf(stderr,
+  "This instrument has been compiled with MPI support.\n  Use 'mpirun %s [options] [parm=value ...]'.\n", pgmname);
+#endif
+#ifdef OPENACC
+  fprintf(stderr,
+  "This instrument has been compiled with NVIDIA GPU support through OpenACC.\n  Running on systems without such devices will lead to segfaults.\nFurter, fprintf, sprintf and printf have been removed from any component TRACE.\n");
+#endif
+
+  if(numipar > 0)
+  {
+    fprintf(stderr, "Instrument parameters are:\n");
+    for(i = 0; i < numipar; i++)
+      if (mcinputtable[i].val && strlen(mcinputtable[i].val))
+        fprintf(stderr, "  %-16s(%s) [default='%s']\n", mcinputtable[i].name,
+        (*mcinputtypes[mcinputtable[i].type].parminfo)(mcinputtable[i].name),
+        mcinputtable[i].val);
+      else
+        fprintf(stderr, "  %-16s(%s)\n", mcinputtable[i].name,
+        (*mcinputtypes[mcinputtable[i].type].parminfo)(mcinputtable[i].name));
+  }
+
+#ifndef NOSIGNALS
+  fprintf(stderr, "Known signals are: "
+#ifdef SIGUSR1
+  "USR1 (status) "
+#endif
+#ifdef SIGUSR2
+  "USR2 (save) "
+#endif
+#ifdef SIGBREAK
+  "BREAK (save) "
+#endif
+#ifdef SIGTERM
+  "TERM (save and exit)"
+#endif
+  "\n");
+#endif /* !NOSIGNALS */
+} /* mchelp */
+
+
+/* mcshowhelp: show help and exit with 0 */
+static void
+mcshowhelp(char *pgmname)
+{
+  mchelp(pgmname);
+  exit(0);
+}
+
+/* mcusage: display usage when error in input arguments and exit with 1 */
+static void
+mcusage(char *pgmname)
+{
+  fprintf(stderr, "Error: incorrect command line arguments\n");
+  mchelp(pgmname);
+  exit(1);
+}
+
+/* mcenabletrace: enable trace/mcdisplay or error if requires recompile */
 static void
 mcenabletrace(int mode)
 {
@@ -4716,6 +5461,32 @@ mcparseoptions(int argc, char *argv[])
       printf("%s\n", literal);
       exit(0);
     }
+    else if(!strncmp("--status-file=", argv[i], 14))
+      mcprogress.status_file = &argv[i][14];
+    else if(!strncmp("--status-interval=", argv[i], 18))
+      mcprogress.status_interval = atof(&argv[i][18]);
+    else if(!strncmp("--trace-file=", argv[i], 13)) {
+      mctrace_filename = &argv[i][13];
+      if (!mcdotrace) mcenabletrace(1);
+    }
+    else if(!strncmp("--checkpoint=", argv[i], 13))
+      mccheckpoint.file = &argv[i][13];
+    else if(!strncmp("--checkpoint-interval=", argv[i], 22))
+      mccheckpoint.interval = atof(&argv[i][22]);
+    else if(!strncmp("--resume=", argv[i], 9))
+      mccheckpoint.resume = &argv[i][9];
+    else if(!strncmp("--time-limit=", argv[i], 13))
+      mcbound.time_limit = atof(&argv[i][13]);
+    else if(!strncmp("--target-error=", argv[i], 15))
+      mcbound.target_error = atof(&argv[i][15]);
+    else if(!strncmp("--target-monitor=", argv[i], 17))
+      mcbound.monitor = &argv[i][17];
+    else if(!strncmp("--scan=", argv[i], 7))
+      mcscan.file = &argv[i][7];
+    else if(!strcmp("--scan-keep", argv[i]))
+      mcscan.keep = 1;
+    else if(!strncmp("--trace-decode=", argv[i], 15))
+      exit(mctrace_decode(&argv[i][15]) < 0);
     else if(!strncmp("--trace=", argv[i], 8)) {
       mcenabletrace(atoi(&argv[i][8]));
     } else if(!strncmp("-t=", argv[i], 3) || !strcmp("--verbose", argv[i])) {
@@ -4814,6 +5585,11 @@ mcparseoptions(int argc, char *argv[])
       mcusage(argv[0]);
     }
   }
+  if (mcscan.file) {
+    mcscan_read();
+    for(j = 0; j < numipar; j++)
+      if (mcscan_sets(0, mcinputtable[j].name)) paramsetarray[j] = paramset = 1;
+  }
   if (mcusedefaults) {
     MPI_MASTER(
      printf("Using all default parameter values\n");
@@ -4844,7 +5620,15 @@ mcparseoptions(int argc, char *argv[])
 #ifdef USE_MPI
   if (mcdotrace) mpi_node_count=1; /* disable threading when in trace mode */
 #endif
-  if (usedir && strlen(usedir) && !mcdisable_output_files) mcuse_dir(usedir);
+  mccheckpoint_header(); /* seed and ncount from --resume */
+  mcbound_header();
+  if (mcdotrace && mctrace_filename) {
+    MPI_MASTER(
+    if (!mctrace_open(mctrace_filename)) exit(1);
+    );
+  }
+  if (mcscan.file) mcscan_header(usedir);
+  else if (usedir && strlen(usedir) && !mcdisable_output_files) mcuse_dir(usedir);
 } /* mcparseoptions */
 
 #ifndef NOSIGNALS
@@ -4938,6 +5722,7 @@ void sighandler(int sig)
 
   if (sig == SIG_STAT)
   {
+    mcprogress_report(stdout, "running");
     printf("# " MCCODE_STRING ": Resuming simulation (continue)\n");
     fflush(stdout);
     return;
@@ -4946,6 +5731,10 @@ void sighandler(int sig)
   if (sig == SIG_SAVE)
   {
     printf("# " MCCODE_STRING ": Saving data and resume simulation (continue)\n");
+    if (mccheckpoint.file && mccheckpoint.tracing) {
+      mccheckpoint.request = 1;
+      mcprogress.next_tick = 0; /* serviced after the current event */
+    }
     save(NULL);
     fflush(stdout);
     return;
@@ -4953,6 +5742,14 @@ void sighandler(int sig)
   else
   if (sig == SIG_TERM)
   {
+    if (mccheckpoint.file && mccheckpoint.tracing) {
+      /* the event being traced is incomplete: write the checkpoint after it */
+      printf("# " MCCODE_STRING ": Writing checkpoint, then save results and exit\n");
+      mccheckpoint.request = 2;
+      mcprogress.next_tick = 0;
+      fflush(stdout);
+      return;
+    }
     printf("# " MCCODE_STRING ": Finishing simulation (save results and exit)\n");
     finally();
     exit(0);
@@ -4987,7 +5784,7 @@ void neutronics_main_(float *inx, float *iny, float *inz, float *invx, float *in
   extern double mcnt, mcnsx, mcnsy, mcnsz, mcnp;
 
   /* External code governs iteration - McStas is iterated once per call to neutronics_main. I.e. below counter must be initiancated for each call to neutronics_main*/
-  mcrun_num=0;
+  mcprogress.events=0;
 
   time_t t;
   t = (time_t)mcstartdate;
@@ -5028,5 +5825,447 @@ void neutronics_main_(float *inx, float *iny, float *inz, float *invx, float *in
 
 #endif /*NEUTRONICS*/
 
+
 #endif /* !MCCODE_H */
+#endif /* !MC_RUNTIME_PARTICLE */
+
+/* SECTION: particle structure ============================================
+
+  The functions below depend on the particle structure of the instrument,
+  with its USERVARs. When the runtime is a separately compiled library
+  (MC_RUNTIME_LIBRARY, see mccode-runtime.h), they are compiled with the
+  instrument, which only includes this section (MC_RUNTIME_PARTICLE).
+
+============================================================================= */
+
+#ifndef MC_RUNTIME_LIBRARY
+
+/* SECTION: GPU algorithms ================================================== */
+
+
+/*
+*  Divide-and-conquer strategy for parallelizing this task: Sort absorbed
+*  particles last.
+*
+*   particles:  the particle array, required to checking _absorbed
+*   pbuffer:    same-size particle buffer array required for parallel sort
+*   len:        sorting area-of-interest size (e.g. from previous calls)
+*   buffer_len: total array size
+*   flag_split: if set, multiply live particles into absorbed slots, up to buffer_len
+*   multiplier: output arg, becomes the  SPLIT multiplier if flag_split is set
+*/
+#ifdef FUNNEL
+long sort_absorb_last(_class_particle* particles, _class_particle* pbuffer, long len, long buffer_len, long flag_split, long* multiplier) {
+  #define SAL_THREADS 1024 // num parallel sections
+  if (len<SAL_THREADS) return sort_absorb_last_serial(particles, len);
+
+  if (multiplier != NULL) *multiplier = -1; // set default out value for multiplier
+  long newlen = 0;
+  long los[SAL_THREADS]; // target array startidxs
+  long lens[SAL_THREADS]; // target array sublens
+  long l = floor(len/(SAL_THREADS-1)); // subproblem_len
+  long ll = len - l*(SAL_THREADS-1); // last_subproblem_len
+
+  // TODO: The l vs ll is too simplistic, since ll can become much larger
+  // than l, resulting in idling. We should distribute lengths more evenly.
+
+  // step 1: sort sub-arrays
+  #pragma acc parallel loop present(particles[0:buffer_len], pbuffer[0:buffer_len])
+  for (unsigned long tidx=0; tidx<SAL_THREADS; tidx++) {
+    long lo = l*tidx;
+    long loclen = l;
+    if (tidx==(SAL_THREADS-1)) loclen = ll; // last sub-problem special case
+    long i = lo;
+    long j = lo + loclen - 1;
+
+    // write into pbuffer at i and j
+    #pragma acc loop seq
+    while (i < j) {
+      #pragma acc loop seq
+      while (!particles[i]._absorbed && i<j) {
+        pbuffer[i] = particles[i];
+        i++;
+      }
+      #pragma acc loop seq
+      while (particles[j]._absorbed && i<j) {
+        pbuffer[j] = particles[j];
+        j--;
+      }
+      if (i < j) {
+        pbuffer[j] = particles[i];
+        pbuffer[i] = particles[j];
+        i++;
+        j--;
+      }
+    }
+    // transfer edge case
+    if (i==j)
+      pbuffer[i] = particles[i];
+
+    lens[tidx] = i - lo;
+    if (i==j && !particles[i]._absorbed) lens[tidx]++;
+  }
+
+  // determine lo's
+  long accumlen = 0;
+  #pragma acc loop seq
+  for (long idx=0; idx<SAL_THREADS; idx++) {
+    los[idx] = accumlen;
+    accumlen = accumlen + lens[idx];
+  }
+
+  // step 2: write non-absorbed sub-arrays to psorted/output from the left
+  #pragma acc parallel loop present(pbuffer[0:buffer_len])
+  for (unsigned long tidx=0; tidx<SAL_THREADS; tidx++) {
+    long j, k;
+    #pragma acc loop seq
+    for (long i=0; i<lens[tidx]; i++) {
+      j = i + l*tidx;
+      k = i + los[tidx];
+      particles[k] = pbuffer[j];
+    }
+  }
+  //for (int ii=0;ii<accumlen;ii++) printf("%ld ", (psorted[ii]->_absorbed));
+
+  // return (no SPLIT)
+  if (flag_split != 1)
+    return accumlen;
+
+  // SPLIT - repeat the non-absorbed block N-1 times, where len % accumlen = N + R
+  int mult = buffer_len / accumlen; // TODO: possibly use a new arg, bufferlen, rather than len
+
+  // not enough space for full-block split, return
+  if (mult <= 1)
+    return accumlen;
+
+  // copy non-absorbed block
+  #pragma acc parallel loop present(particles[0:buffer_len])
+  for (long tidx = 0; tidx < accumlen; tidx++) { // tidx: thread index
+    randstate_t randstate[7];
+    _class_particle sourcebuffer;
+    _class_particle targetbuffer;
+    // assign reduced weight to all particles
+    particles[tidx].p=particles[tidx].p/mult;
+    #pragma acc loop seq
+    for (long bidx = 1; bidx < mult; bidx++) { // bidx: block index
+      // preserve absorbed particle (for randstate)
+      sourcebuffer = particles[bidx*accumlen + tidx];
+      // buffer full particle struct
+      targetbuffer = particles[tidx];
+      // reassign previous randstate
+      targetbuffer.randstate[0] = sourcebuffer.randstate[0];
+      targetbuffer.randstate[1] = sourcebuffer.randstate[1];
+      targetbuffer.randstate[2] = sourcebuffer.randstate[2];
+      targetbuffer.randstate[3] = sourcebuffer.randstate[3];
+      targetbuffer.randstate[4] = sourcebuffer.randstate[4];
+      targetbuffer.randstate[5] = sourcebuffer.randstate[5];
+      targetbuffer.randstate[6] = sourcebuffer.randstate[6];
+      // apply
+      particles[bidx*accumlen + tidx] = targetbuffer;
+    }
+  }
+
+  // set out split multiplier value
+  *multiplier = mult;
+
+  // return expanded array size
+  return accumlen * mult;
+}
+
+#endif
+
+/*
+*  Fallback serial version of the one above.
+*/
+long sort_absorb_last_serial(_class_particle* particles, long len) {
+  long i = 0;
+  long j = len - 1;
+  _class_particle pbuffer;
+
+  // bubble
+  while (i < j) {
+    while (!particles[i]._absorbed && i<j) i++;
+    while (particles[j]._absorbed && i<j) j--;
+    if (i < j) {
+      pbuffer = particles[j];
+      particles[j] = particles[i];
+      particles[i] = pbuffer;
+      i++;
+      j--;
+    }
+  }
+
+  // return new length
+  if (i==j && !particles[i]._absorbed)
+    return i + 1;
+  else
+    return i;
+}
+
+
+/*******************************************************************************
+* mccoordschange: applies rotation to (x y z) and (vx vy vz) and Spin (sx,sy,sz)
+*******************************************************************************/
+void mccoordschange(Coords a, Rotation t, _class_particle *particle)
+{
+  Coords b, c;
+
+  b.x = particle->x;
+  b.y = particle->y;
+  b.z = particle->z;
+  c = rot_apply(t, b);
+  b = coords_add(c, a);
+  particle->x = b.x;
+  particle->y = b.y;
+  particle->z = b.z;
+
+#if MCCODE_PARTICLE_CODE == 2112
+    if (particle->vz != 0.0 || particle->vx != 0.0 || particle->vy != 0.0)
+      mccoordschange_polarisation(t, &(particle->vx), &(particle->vy), &(particle->vz));
+
+    if (particle->sz != 0.0 || particle->sx != 0.0 || particle->sy != 0.0)
+      mccoordschange_polarisation(t, &(particle->sx), &(particle->sy), &(particle->sz));
+#elif MCCODE_PARTICLE_CODE == 22
+    if (particle->kz != 0.0 || particle->kx != 0.0 || particle->ky != 0.0)
+      mccoordschange_polarisation(t, &(particle->kx), &(particle->ky), &(particle->kz));
+
+    if (particle->Ez != 0.0 || particle->Ex != 0.0 || particle->Ey != 0.0)
+      mccoordschange_polarisation(t, &(particle->Ex), &(particle->Ey), &(particle->Ez));
+#endif
+}
+
+
+/*******************************************************************************
+ * randvec_target_circle: Choose random direction towards target at (x,y,z)
+ * with given radius.
+ * If radius is zero, choose random direction in full 4PI, no target.
+ ******************************************************************************/
+void _randvec_target_circle(double *xo, double *yo, double *zo, double *solid_angle,
+        double xi, double yi, double zi, double radius,
+        _class_particle* _particle)
+{
+  double l2, phi, theta, nx, ny, nz, xt, yt, zt, xu, yu, zu;
+
+  if(radius == 0.0)
+  {
+    /* No target, choose uniformly a direction in full 4PI solid angle. */
+    theta = acos(1 - rand0max(2));
+    phi = rand0max(2 * PI);
+    if(solid_angle)
+      *solid_angle = 4*PI;
+    nx = 1;
+    ny = 0;
+    nz = 0;
+    yi = sqrt(xi*xi+yi*yi+zi*zi);
+    zi = 0;
+    xi = 0;
+  }
+  else
+  {
+    double costheta0;
+    l2 = xi*xi + yi*yi + zi*zi; /* sqr Distance to target. */
+    costheta0 = sqrt(l2/(radius*radius+l2));
+    if (radius < 0) costheta0 *= -1;
+    if(solid_angle)
+    {
+      /* Compute solid angle of target as seen from origin. */
+        *solid_angle = 2*PI*(1 - costheta0);
+    }
+
+    /* Now choose point uniformly on circle surface within angle theta0 */
+    theta = acos (1 - rand0max(1 - costheta0)); /* radius on circle */
+    phi = rand0max(2 * PI); /* rotation on circle at given radius */
+    /* Now, to obtain the desired vector rotate (xi,yi,zi) angle theta around a
+       perpendicular axis u=i x n and then angle phi around i. */
+    if(xi == 0 && zi == 0)
+    {
+      nx = 1;
+      ny = 0;
+      nz = 0;
+    }
+    else
+    {
+      nx = -zi;
+      nz = xi;
+      ny = 0;
+    }
+  }
+
+  /* [xyz]u = [xyz]i x n[xyz] (usually vertical) */
+  vec_prod(xu,  yu,  zu, xi, yi, zi,        nx, ny, nz);
+  /* [xyz]t = [xyz]i rotated theta around [xyz]u */
+  rotate  (xt,  yt,  zt, xi, yi, zi, theta, xu, yu, zu);
+  /* [xyz]o = [xyz]t rotated phi around n[xyz] */
+  rotate (*xo, *yo, *zo, xt, yt, zt, phi, xi, yi, zi);
+}
+/* randvec_target_circle */
+
+/*******************************************************************************
+ * randvec_target_rect_angular: Choose random direction towards target at
+ * (xi,yi,zi) with given ANGULAR dimension height x width. height=phi_x=[0,PI],
+ * width=phi_y=[0,2*PI] (radians)
+ * If height or width is zero, choose random direction in full 4PI, no target.
+ *******************************************************************************/
+void _randvec_target_rect_angular(double *xo, double *yo, double *zo, double *solid_angle,
+        double xi, double yi, double zi, double width, double height, Rotation A,
+        _class_particle* _particle)
+{
+  double theta, phi, nx, ny, nz, xt, yt, zt, xu, yu, zu;
+  Coords tmp;
+  Rotation Ainverse;
+
+  rot_transpose(A, Ainverse);
+
+  if(height == 0.0 || width == 0.0)
+  {
+    randvec_target_circle(xo, yo, zo, solid_angle, xi, yi, zi, 0);
+    return;
+  }
+  else
+  {
+    if(solid_angle)
+    {
+      /* Compute solid angle of target as seen from origin. */
+      *solid_angle = 2*fabs(width*sin(height/2));
+    }
+
+    /* Go to global coordinate system */
+
+    tmp = coords_set(xi, yi, zi);
+    tmp = rot_apply(Ainverse, tmp);
+    coords_get(tmp, &xi, &yi, &zi);
+
+    /* Now choose point uniformly on the unit sphere segment with angle theta/phi */
+    phi   = width*randpm1()/2.0;
+    theta = asin(randpm1()*sin(height/2.0));
+    /* Now, to obtain the desired vector rotate (xi,yi,zi) angle theta around
+       n, and then phi around u. */
+    if(xi == 0 && zi == 0)
+    {
+      nx = 1;
+      ny = 0;
+      nz = 0;
+    }
+    else
+    {
+      nx = -zi;
+      nz = xi;
+      ny = 0;
+    }
+  }
+
+  /* [xyz]u = [xyz]i x n[xyz] (usually vertical) */
+  vec_prod(xu,  yu,  zu, xi, yi, zi,        nx, ny, nz);
+  /* [xyz]t = [xyz]i rotated theta around [xyz]u */
+  rotate  (xt,  yt,  zt, xi, yi, zi, theta, nx, ny, nz);
+  /* [xyz]o = [xyz]t rotated phi around n[xyz] */
+  rotate (*xo, *yo, *zo, xt, yt, zt, phi, xu,  yu,  zu);
+
+  /* Go back to local coordinate system */
+  tmp = coords_set(*xo, *yo, *zo);
+  tmp = rot_apply(A, tmp);
+  coords_get(tmp, &*xo, &*yo, &*zo);
+}
+/* randvec_target_rect_angular */
+
+/*******************************************************************************
+ * randvec_target_rect_real: Choose random direction towards target at (xi,yi,zi)
+ * with given dimension height x width (in meters !).
+ *
+ * Local emission coordinate is taken into account and corrected for 'order' times.
+ * (See remarks posted to mcstas-users by George Apostolopoulus <gapost@ipta.demokritos.gr>)
+ *
+ * If height or width is zero, choose random direction in full 4PI, no target.
+ *
+ * Traditionally, this routine had the name randvec_target_rect - this is now a
+ * a define (see mcstas-r.h) pointing here. If you use the old rouine, you are NOT
+ * taking the local emmission coordinate into account.
+*******************************************************************************/
+void _randvec_target_rect_real(double *xo, double *yo, double *zo, double *solid_angle,
+        double xi, double yi, double zi,
+        double width, double height, Rotation A,
+        double lx, double ly, double lz, int order,
+        _class_particle* _particle)
+{
+  double dx, dy, dist, dist_p, nx, ny, nz, mx, my, mz, n_norm, m_norm;
+  double cos_theta;
+  Coords tmp;
+  Rotation Ainverse;
+
+  rot_transpose(A, Ainverse);
+
+  if(height == 0.0 || width == 0.0)
+  {
+    randvec_target_circle(xo, yo, zo, solid_angle,
+               xi, yi, zi, 0);
+    return;
+  }
+  else
+  {
+    /* Now choose point uniformly on rectangle within width x height */
+    dx = width*randpm1()/2.0;
+    dy = height*randpm1()/2.0;
+
+    /* Determine distance to target plane*/
+    dist = sqrt(xi*xi + yi*yi + zi*zi);
+    /* Go to global coordinate system */
+
+    tmp = coords_set(xi, yi, zi);
+    tmp = rot_apply(Ainverse, tmp);
+    coords_get(tmp, &xi, &yi, &zi);
+
+    /* Determine vector normal to trajectory axis (z) and gravity [0 1 0] */
+    vec_prod(nx, ny, nz, xi, yi, zi, 0, 1, 0);
+
+    /* This now defines the x-axis, normalize: */
+    n_norm=sqrt(nx*nx + ny*ny + nz*nz);
+    nx = nx/n_norm;
+    ny = ny/n_norm;
+    nz = nz/n_norm;
+
+    /* Now, determine our y-axis (vertical in many cases...) */
+    vec_prod(mx, my, mz, xi, yi, zi, nx, ny, nz);
+    m_norm=sqrt(mx*mx + my*my + mz*mz);
+    mx = mx/m_norm;
+    my = my/m_norm;
+    mz = mz/m_norm;
+
+    /* Our output, random vector can now be defined by linear combination: */
+
+    *xo = xi + dx * nx + dy * mx;
+    *yo = yi + dx * ny + dy * my;
+    *zo = zi + dx * nz + dy * mz;
+
+    /* Go back to local coordinate system */
+    tmp = coords_set(*xo, *yo, *zo);
+    tmp = rot_apply(A, tmp);
+    coords_get(tmp, &*xo, &*yo, &*zo);
+
+    /* Go back to local coordinate system */
+    tmp = coords_set(xi, yi, zi);
+    tmp = rot_apply(A, tmp);
+    coords_get(tmp, &xi, &yi, &zi);
+
+    if (solid_angle) {
+      /* Calculate vector from local point to remote random point */
+      lx = *xo - lx;
+      ly = *yo - ly;
+      lz = *zo - lz;
+      dist_p = sqrt(lx*lx + ly*ly + lz*lz);
+
+      /* Adjust the 'solid angle' */
+      /* 1/r^2 to the chosen point times cos(\theta) between the normal */
+      /* vector of the target rectangle and direction vector of the chosen point. */
+      cos_theta = (xi * lx + yi * ly + zi * lz) / (dist * dist_p);
+      *solid_angle = width * height / (dist_p * dist_p);
+      int counter;
+      for (counter = 0; counter < order; counter++) {
+        *solid_angle = *solid_angle * cos_theta;
+      }
+    }
+  }
+}
+/* randvec_target_rect_real */
+
+#endif /* !MC_RUNTIME_LIBRARY */
 /* End of file "mccode-r.c". */
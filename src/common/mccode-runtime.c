@@ -0,0 +1,34 @@
+/*******************************************************************************
+*
+* McCode, neutron/xray ray-tracing package
+*         Copyright (C) 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Runtime: share/mccode-runtime.c
+*
+* %Identification
+* Written by: McCode developers
+* Date:    2024
+* Release: McStas 3.x/McXtrace 3.x
+* Version: $Revision$
+*
+* Separately compiled runtime library: the runtime otherwise embedded in each
+* instrument, except its functions depending on the particle structure.
+* See mccode-runtime.h.
+*
+* Usage: compiled by the mccode_runtime CMake target
+*
+*******************************************************************************/
+
+#include "mccode-runtime.h"
+
+#include "mccode-r.c"
+#if MCCODE_PARTICLE_CODE == 2112
+#include "mcstas-r.c"
+#elif MCCODE_PARTICLE_CODE == 22
+#include "mcxtrace-r.c"
+#endif
+#include "metadata-r.c"
+
+/* end of mccode-runtime.c */
@@ -0,0 +1,77 @@
+/*******************************************************************************
+*
+* McCode, neutron/xray ray-tracing package
+*         Copyright (C) 1997-2024, All rights reserved
+*         DTU Physics, Lyngby, Denmark
+*         Institut Laue Langevin, Grenoble, France
+*
+* Runtime: share/mccode-runtime.h
+*
+* %Identification
+* Written by: McCode developers
+* Date:    2024
+* Release: McStas 3.x/McXtrace 3.x
+* Version: $Revision$
+*
+* Header of the separately compiled runtime library (mccode_runtime target).
+*
+* The generated code of an instrument starts with the base types of the runtime
+* and the particle structure, which holds the instrument USERVARs and JUMP
+* logic. The runtime library is compiled once for all instruments, so this
+* header declares the same base types, and the particle structure as an
+* incomplete type: the functions of the runtime which depend on its layout are
+* compiled with the instrument (MC_RUNTIME_PARTICLE), see mccode-r.c.
+*
+* Instruments are generated for the library with 'mcstas --no-runtime'. The
+* library and the instruments must be compiled with the same RNG_ALG, USE_MPI,
+* USE_NEXUS, OPENACC and MC_PORTABLE options.
+*
+* Usage: compiled into the runtime library by mccode-runtime.c
+*
+*******************************************************************************/
+
+#ifndef MCCODE_RUNTIME_H
+#define MCCODE_RUNTIME_H "$Revision$"
+
+#define MC_RUNTIME_LIBRARY
+
+#ifndef WIN32
+#  ifndef OPENACC
+#    define _GNU_SOURCE
+#  endif
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <string.h>
+#include <inttypes.h>
+
+/* same as the beginning of the generated code, see cogen_header() */
+typedef double MCNUM;
+typedef struct {MCNUM x, y, z;} Coords;
+typedef MCNUM Rotation[3][3];
+#define MCCODE_BASE_TYPES
+
+#define _RNG_ALG_MT         1
+#define _RNG_ALG_KISS       2
+#ifndef RNG_ALG
+#  define RNG_ALG  _RNG_ALG_KISS
+#endif
+#if RNG_ALG == _RNG_ALG_MT // MT
+#define randstate_t uint32_t
+#elif RNG_ALG == _RNG_ALG_KISS  // KISS
+#define randstate_t uint64_t
+#endif
+
+/* defined by each instrument */
+typedef struct _struct_particle _class_particle;
+
+#include "mccode-r.h"
+#if MCCODE_PARTICLE_CODE == 2112
+#include "mcstas-r.h"
+#elif MCCODE_PARTICLE_CODE == 22
+#include "mcxtrace-r.h"
+#endif
+
+#endif /* MCCODE_RUNTIME_H */
+
+/* end of mccode-runtime.h */
@@ -126,58 +126,67 @@ int mccode_main(int argc, char *argv[])
 #endif /* !NOSIGNALS */
 
 
-  // init executed by master/host
-  siminfo_init(NULL); /* open SIM */
-  SIG_MESSAGE("[" __FILE__ "] main INITIALISE");
-  init();
+  /* each point of a --scan is simulated in turn, see mcscan_next */
+  do {
+    // init executed by master/host
+    siminfo_init(NULL); /* open SIM */
+    SIG_MESSAGE("[" __FILE__ "] main INITIALISE");
+    init();
 
 
 #ifndef NOSIGNALS
 #ifdef SIGINT
-  if (signal( SIGINT ,sighandler) == SIG_IGN)
-    signal( SIGINT,SIG_IGN);    /* interrupt (rubout) only after INIT */
+    if (signal( SIGINT ,sighandler) == SIG_IGN)
+      signal( SIGINT,SIG_IGN);    /* interrupt (rubout) only after INIT */
 #endif
 #endif /* !NOSIGNALS */
 
-/* ================ main particle generation/propagation loop ================ */
+  /* ================ main particle generation/propagation loop ================ */
 #ifdef USE_MPI
-  /* sliced Ncount on each MPI node */
-  mcncount = mpi_node_count > 1 ?
-    floor(mcncount / mpi_node_count) :
-    mcncount; /* number of rays per node */
+    /* sliced Ncount on each MPI node */
+    mcncount = mpi_node_count > 1 ?
+      floor(mcncount / mpi_node_count) :
+      mcncount; /* number of rays per node */
 #endif
 
-// MT specific init, note that per-ray init is empty
+  // MT specific init, note that per-ray init is empty
 #if RNG_ALG == 2
-  mt_srandom(mcseed);
+    mt_srandom(mcseed);
 #endif
 
 
-// main raytrace work loop
+  // main raytrace work loop
+    mcprogress_start();
+    mccheckpoint_start(); /* restore the --resume state, if any */
 #ifndef FUNNEL
-  // legacy version
-  raytrace_all(mcncount, mcseed);
+    // legacy version
+    raytrace_all(mcncount, mcseed);
 #else
-  MPI_MASTER(
-  // "funneled" version in which propagation is more parallelizable
-  printf("\nNOTE: CPU COMPONENT grammar activated:\n 1) \"FUNNEL\" raytrace algorithm enabled.\n 2) Any SPLIT's are dynamically allocated based on available buffer size. \n");
-	     );
-  raytrace_all_funnel(mcncount, mcseed);
+    MPI_MASTER(
+    // "funneled" version in which propagation is more parallelizable
+    printf("\nNOTE: CPU COMPONENT grammar activated:\n 1) \"FUNNEL\" raytrace algorithm enabled.\n 2) Any SPLIT's are dynamically allocated based on available buffer size. \n");
+  	     );
+    raytrace_all_funnel(mcncount, mcseed);
 #endif
+    mccheckpoint_stop();
+    mctrace_close(); /* write the binary trace stream, if any */
+    mcprogress_stop();  /* final status, before the MPI merge of the counters */
 
 
 #ifdef USE_MPI
- /* merge run_num from MPI nodes */
-  if (mpi_node_count > 1) {
-  double mcrun_num_double = (double)mcrun_num;
-  mc_MPI_Sum(&mcrun_num_double, 1);
-  mcrun_num = (unsigned long long)mcrun_num_double;
-  }
+   /* merge run_num from MPI nodes */
+    if (mpi_node_count > 1) {
+    double mcrun_num_double = (double)mcprogress.events;
+    mc_MPI_Sum(&mcrun_num_double, 1);
+    mcprogress.events = (unsigned long long)mcrun_num_double;
+    }
 #endif
+    mcbound_finish(); /* normalise a run ended by --time-limit or --target-error */
 
 
-  // save/finally executed by master node/thread/host
-  finally();
+    // save/finally executed by master node/thread/host
+    finally();
+  } while (mcscan_next());
 
 
 #ifdef USE_MPI
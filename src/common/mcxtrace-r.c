@@ -30,6 +30,7 @@
 #ifndef MCXTRACE_H
 
 
+#ifndef MC_RUNTIME_LIBRARY /* depends on the particle structure, see mccode-r.c */
 /*******************************************************************************
 * mcsetstate: transfer parameters into global McXtrace variables
 *******************************************************************************/
@@ -84,6 +85,9 @@ _class_particle mcgetstate(_class_particle mcphoton, double *x, double *y, doubl
 
   return(mcphoton);
 } /* mcgetstate */
+#endif /* !MC_RUNTIME_LIBRARY */
+
+#ifndef MC_RUNTIME_PARTICLE
 
 
 /*******************************************************************************
@@ -465,4 +469,6 @@ int paraboloid_normal(double *nx, double *ny, double *nz, double x,double y, dou
 
 
 
+#endif /* !MC_RUNTIME_PARTICLE */
+
 #endif /* !MCXTRACE_H */
@@ -193,9 +193,11 @@
 #ifdef DEBUG
 
 #define DEBUG_STATE() if(!mcdotrace); else \
+  DEBUG_BINARY(mctrace_state(MCTRACE_STATE, 12, x,y,z,kx,ky,kz,phi,t,Ex,Ey,Ez,p)) \
   printf("STATE: %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g\n", \
       x,y,z,kx,ky,kz,phi,t,Ex,Ey,Ez,p);
 #define DEBUG_SCATTER() if(!mcdotrace); else \
+  DEBUG_BINARY(mctrace_state(MCTRACE_SCATTER, 12, x,y,z,kx,ky,kz,phi,t,Ex,Ey,Ez,p)) \
   printf("SCATTER: %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g\n", \
       x,y,z,kx,ky,kz,phi,t,Ex,Ey,Ez,p);
 
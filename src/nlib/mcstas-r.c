@@ -34,6 +34,7 @@
 *******************************************************************************/
 
 /*the magnet stack*/
+#ifndef MC_RUNTIME_PARTICLE
 #ifdef MC_POL_COMPAT
 void (*mcMagnetPrecession) (double, double, double, double, double, double,
     double, double*, double*, double*, double, Coords, Rotation)=NULL;
@@ -43,15 +44,18 @@ double*  mcMagnetData                = NULL;
 /* mcMagneticField(x, y, z, t, Bx, By, Bz) */
 int (*mcMagneticField) (double, double, double, double,
     double*, double*, double*, void *) = NULL;
+#endif /* MC_POL_COMPAT */
 #endif
 
+
 #ifndef MCSTAS_H
 
+#ifndef MC_RUNTIME_LIBRARY /* depends on the particle structure, see mccode-r.c */
 /*******************************************************************************
 * mcsetstate: transfer parameters into global McStas variables
 *******************************************************************************/
 _class_particle mcsetstate(double x, double y, double z, double vx, double vy, double vz,
-			   double t, double sx, double sy, double sz, double p, int mcgravitation, void *mcMagnet, int mcallowbackprop)
+			   double t, double sx, double sy, double sz, double p, int mcgravitation, int mcMagnet, int mcallowbackprop)
 {
   _class_particle mcneutron;
 
@@ -68,6 +72,7 @@ _class_particle mcsetstate(double x, double y, double z, double vx, double vy, d
   mcneutron.p  = p;
   mcneutron.mcgravitation = mcgravitation;
   mcneutron.mcMagnet = mcMagnet;
+  mcneutron.mcMagnetTop = 0;
   mcneutron.allow_backprop = mcallowbackprop;
   mcneutron._uid       = 0;
   mcneutron._index     = 1;
@@ -104,6 +109,9 @@ _class_particle mcgetstate(_class_particle mcneutron, double *x, double *y, doub
 
   return(mcneutron);
 } /* mcgetstate */
+#endif /* !MC_RUNTIME_LIBRARY */
+
+#ifndef MC_RUNTIME_PARTICLE
 
 
 /*******************************************************************************
@@ -367,4 +375,6 @@ int plane_intersect(double *t, double x, double y, double z,
   else return 1;
 } /* plane_intersect */
 
+#endif /* !MC_RUNTIME_PARTICLE */
+
 #endif /* !MCSTAS_H */
@@ -202,9 +202,11 @@
 #ifdef DEBUG
 
 #define DEBUG_STATE() if(!mcdotrace); else \
+  DEBUG_BINARY(mctrace_state(MCTRACE_STATE, 11, x,y,z,vx,vy,vz,t,sx,sy,sz,p)) \
   printf("STATE: %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g\n", \
          x,y,z,vx,vy,vz,t,sx,sy,sz,p);
 #define DEBUG_SCATTER() if(!mcdotrace); else \
+  DEBUG_BINARY(mctrace_state(MCTRACE_SCATTER, 11, x,y,z,vx,vy,vz,t,sx,sy,sz,p)) \
   printf("SCATTER: %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g\n", \
          x,y,z,vx,vy,vz,t,sx,sy,sz,p);
 
@@ -34,10 +34,8 @@
 %include "read_table-lib"
 %include "interpolation-lib"
 
-/*definition of the magnetic stack*/
-#ifndef MCMAGNET_STACKSIZE
-#define MCMAGNET_STACKSIZE 12
-#endif
+/*the magnetic stack is stored in the particle, with MCMAGNET_STACKSIZE
+  elements (default 12) defined by the code generator*/
 
 /*Threshold below which two magnetic fields are considered to be
  * in the same direction.*/
@@ -47,7 +45,17 @@
 
 /*The maximal timestep taken by neutrons in a const field*/
 #ifndef mc_pol_initial_timestep
-#define mc_pol_initial_timestep 1e-5;
+#define mc_pol_initial_timestep 1e-5
+#endif
+
+/*The largest timestep MagnusMagnetPrecession may grow to*/
+#ifndef mc_pol_max_timestep
+#define mc_pol_max_timestep (16*mc_pol_initial_timestep)
+#endif
+
+/*The spin rotation error [rad] allowed per step by MagnusMagnetPrecession*/
+#ifndef mc_pol_precession_tolerance
+#define mc_pol_precession_tolerance 1e-4
 #endif
 
 #ifdef PROP_MAGNET
@@ -58,10 +66,18 @@
     Rotation rotLM; \
     Coords   posLM = POS_A_CURRENT_COMP; \
     rot_transpose(ROT_A_CURRENT_COMP, rotLM); \
-    SimpleNumMagnetPrecession(posLM, rotLM, _particle, dt); \
+    MC_POL_PRECESSION(posLM, rotLM, _particle, dt); \
   } while(0)
 #endif
 
+/*The spin precession integrator used by PROP_MAGNET. Compile with
+  -DMC_POL_SIMPLE_PRECESSION to use the original field-direction bisection.*/
+#ifdef MC_POL_SIMPLE_PRECESSION
+#define MC_POL_PRECESSION SimpleNumMagnetPrecession
+#else
+#define MC_POL_PRECESSION MagnusMagnetPrecession
+#endif
+
 enum field_functions{
   tabled=-1,
   none=0,
@@ -114,24 +130,23 @@ int magnetic_field_dispatcher(int func_id, double x, double y, double z, double
 /*traverse the stack and return the magnetic field*/
 #pragma acc routine seq
 int mcmagnet_get_field(_class_particle *_particle, double x, double y, double z, double t, double *bx,double *by, double *bz, double dummy[8]){
-  mcmagnet_field_info *p,**stack;
+  mcmagnet_field_info *p;
   Coords in,loc,b,bsum={0,0,0};
   Rotation r;
-  /*extract the magnetic field stack experienced by this particle*/
-  stack=((mcmagnet_field_info **) _particle->mcMagnet);
 
   /*PROP_MAGNET takes care of transforming local "PROP" coordinates to lab system*/
   in.x=x;in.y=y;in.z=z;
 
-  int i=0,stat=1;
-  p=stack[i];
+  int i,k,stat=1;
   *bx=0;*by=0;*bz=0;
-  if (p==NULL || p->func_id==0){
-    *bx=0;*by=0;*bz=0;
+  if (_particle->mcMagnet<=0 || _particle->mcMagnetStack[_particle->mcMagnetTop].func_id==0){
     return 0;
   }
-  
-  while(p!=NULL){
+
+  /*the magnet stack experienced by this particle is a ring, with the top at mcMagnetTop*/
+  for (k=0; k<_particle->mcMagnet; k++){
+    i=(_particle->mcMagnetTop - k + MCMAGNET_STACKSIZE) % MCMAGNET_STACKSIZE;
+    p=&(_particle->mcMagnetStack[i]);
     /*transform to the coordinate system of the particular magnetic function*/
     loc=coords_sub(rot_apply(*(p->rot),in),*(p->pos));
     stat=magnetic_field_dispatcher((p->func_id),loc.x,loc.y,loc.z,t,&(b.x),&(b.y),&(b.z),p->field_parameters);
@@ -144,7 +159,6 @@ int mcmagnet_get_field(_class_particle *_particle, double x, double y, double z,
       //printf("Bs=(%g %g %g), B=(%g %g %g)\n",bsum.x,bsum.y,bsum.z,loc.x,loc.y,loc.z);
     }
     if (p->stop) break;
-    p=stack[++i];
   }
   /*we now have the magnetic field in lab coords in loc., transfer it back to caller*/
   *bx=bsum.x;
@@ -153,60 +167,31 @@ int mcmagnet_get_field(_class_particle *_particle, double x, double y, double z,
   return 0;
 }
 
+/*push a field on the magnet stack of the particle. The stack is a fixed ring
+  of MCMAGNET_STACKSIZE elements stored in the particle: when it is full, the
+  deepest field is overwritten.*/
 #pragma acc routine seq
 void *mcmagnet_push(_class_particle *_particle, int func_id, Rotation *magnet_rot, Coords *magnet_pos, int stopbit, double prms[8]){
-  /*check if any field has been pushed already*/
-  if (_particle->mcMagnet==NULL){
-    /*No fields exist in the stack so allocate room for it and point _particle->mcMagnet to it*/
-    #ifdef OPENACC
-    _particle->mcMagnet=malloc(MCMAGNET_STACKSIZE*sizeof(mcmagnet_field_info *));
-    /* Lack of a calloc makes us NULLify manually since we check for NULL further down */ 
-    for (int ll=0; ll<MCMAGNET_STACKSIZE; ll++) {
-      ((mcmagnet_field_info **) _particle->mcMagnet)[ll]=NULL;
-    }
-    #else
-    _particle->mcMagnet=calloc(MCMAGNET_STACKSIZE,sizeof(mcmagnet_field_info *));
-    #endif
-  }
-  mcmagnet_field_info **stack=((mcmagnet_field_info **) _particle->mcMagnet);
-
-  /*move the stack one step down start from -2 since we have 0-indexing (i.e. last item is stacksize-1) */
-  int i;
-  for (i=MCMAGNET_STACKSIZE-2;i>=0;i--){
-    stack[i+1]=stack[i];
+  if (_particle->mcMagnet<=0){
+    /*No fields exist in the stack: start from the first element*/
+    _particle->mcMagnet=0;
+    _particle->mcMagnetTop=MCMAGNET_STACKSIZE-1;
   }
-  /*allocate momery for the new stack item*/
-  #ifdef OPENACC
-  stack[0]=malloc(sizeof(mcmagnet_field_info));
-  #else
-  stack[0]=calloc(1, sizeof(mcmagnet_field_info));
-  #endif
+  _particle->mcMagnetTop=(_particle->mcMagnetTop+1) % MCMAGNET_STACKSIZE;
+  if (_particle->mcMagnet<MCMAGNET_STACKSIZE) _particle->mcMagnet++;
   /*drop the new item in*/
-  mcmagnet_pack(stack[0],func_id,magnet_rot,magnet_pos,stopbit,prms);
-  return NULL;// (void *) stack[0];
+  mcmagnet_pack(&(_particle->mcMagnetStack[_particle->mcMagnetTop]),func_id,magnet_rot,magnet_pos,stopbit,prms);
+  return NULL;
 }
 
+/*pop the top field from the magnet stack of the particle. When the stack is
+  empty, mcMagnet is 0 to flag that precession propagation is no longer needed*/
 #pragma acc routine seq
 void *mcmagnet_pop(_class_particle *_particle) {
-  mcmagnet_field_info **stack=((mcmagnet_field_info **) _particle->mcMagnet);
-  /*free memory for upper element*/
-#ifdef OPENACC
-  free(stack[0]);
-#else
-  free(stack[0]);
-#endif
-  /*move the stack one step up*/
-  int i;
-  for (i=0;i<MCMAGNET_STACKSIZE-2;i++){
-    stack[i]=stack[i+1];
-  }
-  /*if this makes the upper element go NULL also NULL _particle->mcMagnet
-    to flag that precession propagation is no longer needed*/
-  if(stack[0]==NULL){
-    free(_particle->mcMagnet);
-    _particle->mcMagnet=NULL;
-  }
-  return NULL;// (void*) (stack[0]);
+  if (_particle->mcMagnet<=0) return NULL;
+  _particle->mcMagnetTop=(_particle->mcMagnetTop - 1 + MCMAGNET_STACKSIZE) % MCMAGNET_STACKSIZE;
+  _particle->mcMagnet--;
+  return NULL;
 }
 
 /*Example magnetic field functions*/
@@ -463,6 +448,107 @@ void SimpleNumMagnetPrecession(Coords posMagnet, Rotation rotMagnet, _class_part
   precess_particle->sz=pp->sz;
 }
 
+/****************************************************************************
+* int mcmagnet_field_is_constant(_class_particle *_particle)
+*
+* Return 1 when all fields active on the magnet stack of the particle (down
+* to the first one with its stop bit set) are uniform and static, that is
+* 'constant' or 'none'.
+*****************************************************************************/
+#pragma acc routine seq
+int mcmagnet_field_is_constant(_class_particle *_particle) {
+  int i,k;
+  for (k=0; k<_particle->mcMagnet; k++){
+    i=(_particle->mcMagnetTop - k + MCMAGNET_STACKSIZE) % MCMAGNET_STACKSIZE;
+    if (_particle->mcMagnetStack[i].func_id!=constant && _particle->mcMagnetStack[i].func_id!=none)
+      return 0;
+    if (_particle->mcMagnetStack[i].stop) break;
+  }
+  return 1;
+}
+
+/****************************************************************************
+* void MagnusMagnetPrecession(Coords posMagnet, Rotation rotMagnet,
+*                             _class_particle *particle, double dt)
+*
+* ACTION: precess the spin of the particle along its straight path of
+* duration dt, in the fields of its magnet stack.
+*
+* The spin obeys ds/dt = w x s with w = omegaL*B. Each step of length h
+* rotates the spin about the 4th order Magnus vector
+*   theta = h/6*(w0 + 4*wm + w1) + h^2/12 * (w1 x w0)
+* from the fields at the start, middle and end of the step. The end field is
+* reused as the start field of the next step, so that a step costs two field
+* evaluations. The step is accepted when theta differs from the midpoint
+* rotation h*wm by less than mc_pol_precession_tolerance, and its length is
+* adapted from that difference, up to mc_pol_max_timestep.
+* When all fields are constant, the spin is rotated once over dt.
+*****************************************************************************/
+#pragma acc routine seq
+void MagnusMagnetPrecession(Coords posMagnet, Rotation rotMagnet, _class_particle *particle, double dt) {
+
+  Coords pos, vel, spin, w0, wm, w1, theta, dtheta;
+  Rotation rotBack;
+  double t = particle->t, h, err, ang, factor;
+
+  if (dt <= 0) return;
+  /* change coordinates from current local system to lab system */
+  pos  = coords_add(rot_apply(rotMagnet, coords_set(particle->x, particle->y, particle->z)), posMagnet);
+  vel  = rot_apply(rotMagnet, coords_set(particle->vx, particle->vy, particle->vz));
+  spin = rot_apply(rotMagnet, coords_set(particle->sx, particle->sy, particle->sz));
+
+  mcmagnet_get_field(particle, pos.x, pos.y, pos.z, t, &(w0.x), &(w0.y), &(w0.z), NULL);
+  w0 = coords_scale(w0, mc_pol_omegaL);
+
+  if (mcmagnet_field_is_constant(particle)) {
+    /* uniform static field: a single rotation */
+    theta = coords_scale(w0, dt);
+    ang   = coords_len(theta);
+    if (ang > 0)
+      rotate(spin.x, spin.y, spin.z, spin.x, spin.y, spin.z, ang, theta.x, theta.y, theta.z);
+  } else {
+    h = (dt < mc_pol_initial_timestep ? dt : mc_pol_initial_timestep);
+    while (dt > 0) {
+      if (h > dt) h = dt;
+      mcmagnet_get_field(particle, pos.x+vel.x*h/2, pos.y+vel.y*h/2, pos.z+vel.z*h/2, t+h/2,
+        &(wm.x), &(wm.y), &(wm.z), NULL);
+      mcmagnet_get_field(particle, pos.x+vel.x*h, pos.y+vel.y*h, pos.z+vel.z*h, t+h,
+        &(w1.x), &(w1.y), &(w1.z), NULL);
+      wm = coords_scale(wm, mc_pol_omegaL);
+      w1 = coords_scale(w1, mc_pol_omegaL);
+
+      theta = coords_scale(coords_add(coords_add(w0, w1), coords_scale(wm, 4)), h/6);
+      vec_prod(dtheta.x, dtheta.y, dtheta.z, w1.x, w1.y, w1.z, w0.x, w0.y, w0.z);
+      theta = coords_add(theta, coords_scale(dtheta, h*h/12));
+      err   = coords_len(coords_sub(theta, coords_scale(wm, h)));
+
+      if (err <= mc_pol_precession_tolerance || h <= FLT_EPSILON) {
+        /* accept the step */
+        ang = coords_len(theta);
+        if (ang > 0)
+          rotate(spin.x, spin.y, spin.z, spin.x, spin.y, spin.z, ang, theta.x, theta.y, theta.z);
+        pos = coords_add(pos, coords_scale(vel, h));
+        t  += h;
+        dt -= h;
+        w0  = w1;
+      }
+      /* the midpoint error scales as h^3 */
+      factor = (err > 0 ? 0.9*cbrt(mc_pol_precession_tolerance/err) : 4);
+      if (factor < 0.25) factor = 0.25;
+      if (factor > 4)    factor = 4;
+      h *= factor;
+      if (h > mc_pol_max_timestep) h = mc_pol_max_timestep;
+    }
+  }
+
+  /* change back spin coordinates from lab system to local system */
+  rot_transpose(rotMagnet, rotBack);
+  spin = rot_apply(rotBack, spin);
+  particle->sx = spin.x;
+  particle->sy = spin.y;
+  particle->sz = spin.z;
+}
+
 /****************************************************************************
 * double GetConstantField(double length, double lambda, double angle)
 *
@@ -45,16 +45,10 @@ typedef int mcmagnet_field_func (double, double, double, double, double *, doubl
 typedef void mcmagnet_prec_func (Coords, Rotation, _class_particle *, double);
 typedef va_list mcmagnet_data;
 
-/*here's where the mcstas magnet stack is declared*/
-/*the magnet stack*/
-
-typedef struct mcmagnet_field_info {
-  int func_id;
-  Rotation *rot;
-  Coords *pos;
-  double *field_parameters;
-  int stop;
-} mcmagnet_field_info;
+/*the magnet stack: mcmagnet_field_info is declared with the particle
+  structure, which holds the stack as a ring of MCMAGNET_STACKSIZE fields
+  (mcMagnetStack), its depth (mcMagnet) and top index (mcMagnetTop). The
+  stack is only in the particle of instruments which include pol-lib*/
 
 void mc_pol_set_timestep(double);
 void mc_pol_set_angular_accuracy(double);
@@ -118,6 +112,8 @@ void SetMonoPolTransOut(double, double, double, double*, double*, double*);
 
 // Routines for spin precession in magnetic fields
 void SimpleNumMagnetPrecession(Coords, Rotation, _class_particle *, double);
+void MagnusMagnetPrecession(Coords, Rotation, _class_particle *, double);
+int  mcmagnet_field_is_constant(_class_particle *);
 
 // Routines to help calculate the required magnetic field
 double GetConstantField(double, double, double);